@@ -28,6 +28,7 @@ struct FastPMCosmology {
     int ncdm_linearresponse; // bool: Enable the linear response module for neutrinos.
     FastPMGrowthMode growth_mode;
     FastPMFDInterp * FDinterp;
+    struct FastPMBackground * background; /* tables of the growth and the distances; built by fastpm_cosmology_init */
 };
 
 double interpolate(const double xa[], const double ya[], size_t size, double xi);
@@ -82,6 +83,8 @@ double DGrowthFactorDa(FastPMGrowthInfo * growth_info);
 double D2GrowthFactorDa2(FastPMGrowthInfo * growth_info);
 
 double ComovingDistance(double a, FastPMCosmology * c);
+double KickIntegral(double ai, double af, FastPMCosmology * c);
+double DriftIntegral(double ai, double af, FastPMCosmology * c);
 double OmegaA(double a, FastPMCosmology * c);
 
 FASTPM_END_DECLS
@@ -16,15 +16,8 @@ double HorizonDistance(double a, FastPMHorizon * horizon);
 double HorizonGrowthFactor(double a, FastPMHorizon * horizon);
 double VolumeDensityFromEll(double ell_lim, double z, FastPMHorizon * horizon);
 
-void *
-fastpm_horizon_solve_start();
-
-void
-fastpm_horizon_solve_end(void * );
-
 int
 fastpm_horizon_solve(FastPMHorizon * horizon,
-    void * context,
     double * solution,
     double a_i, double a_f,
     double (*func)(double a, void * userdata),
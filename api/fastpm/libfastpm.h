@@ -18,6 +18,7 @@
 FASTPM_BEGIN_DECLS
 
 typedef struct PM PM;
+typedef struct PMDomain PMDomain;
 typedef struct FastPMStore FastPMStore;
 typedef struct FastPMPainter FastPMPainter;
 typedef struct FastPMTransition FastPMTransition;
@@ -53,10 +54,23 @@ typedef enum { FASTPM_SOFTENING_NONE,
                FASTPM_SOFTENING_GAUSSIAN, FASTPM_SOFTENING_GADGET_LONG_RANGE,
                FASTPM_SOFTENING_TWO_THIRD, FASTPM_SOFTENING_GAUSSIAN36 } FastPMSofteningType;
 
+/* planning effort of the FFT plans; measured plans are faster but take long to make,
+ * unless the wisdom of an earlier run is imported. */
+typedef enum { FASTPM_FFT_ESTIMATE = 0,
+               FASTPM_FFT_MEASURE,
+               FASTPM_FFT_PATIENT,
+            } FastPMFFTPlanning;
+
 
 void libfastpm_init();
 void libfastpm_cleanup();
 void libfastpm_set_memory_bound(size_t size);
+void libfastpm_set_exchange_budget(size_t size);
+void libfastpm_set_node_aware_exchange(int on);
+void libfastpm_set_ranks_per_node(int n);
+void libfastpm_set_fft_planning(FastPMFFTPlanning planning);
+int libfastpm_import_fft_wisdom(const char * filename, MPI_Comm comm);
+int libfastpm_export_fft_wisdom(const char * filename, MPI_Comm comm);
 
 extern const char * LIBFASTPM_VERSION;
 
@@ -94,6 +108,10 @@ typedef double (*fastpm_kernelfunc)(double x, double hsupport);
 FASTPM_BEGIN_DECLS
 
 FastPMMemory * _libfastpm_get_gmem();
+size_t _libfastpm_get_exchange_budget();
+int _libfastpm_get_node_aware_exchange();
+int _libfastpm_get_ranks_per_node();
+FastPMFFTPlanning _libfastpm_get_fft_planning();
 
 FASTPM_END_DECLS
 
@@ -59,6 +59,12 @@ fastpm_memory_free(FastPMMemory * m, void * p);
 void *
 fastpm_memory_alloc_details(FastPMMemory * m, const char * name, size_t s, enum FastPMMemoryLocation loc, const char * file, const int line);
 
+void *
+fastpm_memory_realloc_details(FastPMMemory * m, const char * name, void * p, size_t s, const char * file, const int line);
+
+size_t
+fastpm_memory_realloc_cost(FastPMMemory * m, void * p, size_t s);
+
 void
 fastpm_memory_dump_status(FastPMMemory * m, int fd);
 
@@ -66,6 +72,7 @@ void
 fastpm_memory_dump_status_str(FastPMMemory * m, char * buf, int n);
 
 #define fastpm_memory_alloc(m, name, s, loc) fastpm_memory_alloc_details(m, name, s, loc, __FILE__, __LINE__)
+#define fastpm_memory_realloc(m, name, p, s) fastpm_memory_realloc_details(m, name, p, s, __FILE__, __LINE__)
 
 FASTPM_END_DECLS
 
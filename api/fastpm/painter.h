@@ -6,6 +6,8 @@ struct FastPMPainter {
     PM * pm;
 
     void   (*paint)(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir);
+    /* same as paint, without atomics; the caller shall own the touched cells. */
+    void   (*paint_exclusive)(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir);
     double (*readout)(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], int diffdir);
     fastpm_kernelfunc kernel;
     fastpm_kernelfunc diff;
@@ -17,6 +19,7 @@ struct FastPMPainter {
     int left; /* offset to start the kernel, (support - 1) / 2*/
     int Npoints; /* (support) ** 3 */
     double shift;
+    int use_atomic; /* paint with omp atomic instead of colouring the particles by slabs */
 };
 
 void fastpm_painter_init(FastPMPainter * painter, PM * pm,
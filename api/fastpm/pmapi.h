@@ -102,6 +102,32 @@ pm_r2c(PM * pm, FastPMFloat * from, FastPMFloat * to);
 void 
 pm_c2r(PM * pm, FastPMFloat * inplace);
 
+/*
+ * Batched transforms move nbatch fields through one plan, such that the
+ * global transposes of all fields are shared.
+ *
+ * A batch holds the fields interleaved, element by element; use
+ * pm_batch_put and pm_batch_take to move a field in and out of slot ibatch.
+ * is_complex selects whether the elements are complex (before c2r, after r2c)
+ * or real (after c2r, before r2c). Batched transforms are in-place.
+ * */
+FastPMFloat * pm_batch_alloc(PM * pm, int nbatch);
+void pm_batch_free(PM * pm, FastPMFloat * batch);
+
+void
+pm_batch_put(PM * pm, FastPMFloat * batch, int nbatch, int ibatch, FastPMFloat * field, int is_complex);
+void
+pm_batch_take(PM * pm, FastPMFloat * batch, int nbatch, int ibatch, FastPMFloat * field, int is_complex);
+
+void
+pm_r2c_batch(PM * pm, FastPMFloat * batch, int nbatch);
+void
+pm_c2r_batch(PM * pm, FastPMFloat * batch, int nbatch);
+
+/* in-place c2r of several fields; batched if the PM is initialized with batch. */
+void
+pm_c2r_many(PM * pm, FastPMFloat * fields[], int nbatch);
+
 PM *
 fastpm_create_pm(int Ngrid, int NprocY, int transposed, double BoxSize, MPI_Comm comm);
 
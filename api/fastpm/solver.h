@@ -64,12 +64,23 @@ typedef struct {
     /* FIXME: give them better looking names. */
     FastPMPainterType PAINTER_TYPE;
     int painter_support;
+    int PaintAtomic; /* 1 to paint with omp atomic instead of colouring the particles */
     FastPMForceType FORCE_TYPE;
     FastPMKernelType KERNEL_TYPE;
     FastPMSofteningType SOFTENING_TYPE;
+    int FD_GRADIENT; /* 1 for the real space finite difference gradient of the potential */
 
     int NprocY;  /* Use 0 for auto */
     int UseFFTW; /* Use 0 for PFFT 1 for FFTW */
+    int FFTBatch; /* 1 to batch the c2r of several fields into one transform */
+    int FuseHalfSteps; /* 1 to apply consecutive kicks (drifts) with the same reference time in one pass */
+    int ForceFFTPrecision; /* precision of the force transforms, 32 or 64; 0 for FASTPM_FFT_PRECISION */
+    int BalancedDomain; /* 1 to decompose particles by counts instead of by the PM mesh */
+    int MeshHalo; /* 1 to exchange the margin cells of the mesh instead of particle ghosts */
+    double DecomposeSkin; /* skin in PM cells for the incremental decomposition; 0 to test all particles */
+    int LocalSortInterval; /* sort the particles on a rank along a Morton curve every this many full decompositions; 0 to never sort */
+    int CompactPosition; /* 1 to store the cdm positions as 32-bit fixed point fractions of the box */
+    int CompactLPTDisplacement; /* 1 to store the dx1 and dx2 kept for COLA as 16-bit scaled integers */
     int pgdc;
     double pgdc_alpha0;
     double pgdc_A;
@@ -106,6 +117,20 @@ typedef struct {
 
     PM * basepm;
     PM * lptpm;
+
+    /* particle domains of the last decomposition; NULL if particles follow the PM mesh with ghosts. */
+    PMDomain * domain;
+
+    /* incremental decomposition: after the last full decomposition on skinpm, the
+     * first ninterior[si] particles of a species were farther than skin from the
+     * edges of the local region; they have moved by at most skindrift since. */
+    PM * skinpm;
+    double skin;
+    double skindrift;
+    ptrdiff_t ninterior[FASTPM_SOLVER_NSPECIES];
+
+    /* number of full decompositions; for LocalSortInterval */
+    int ndecompose;
 } FastPMSolver;
 
 enum FastPMAction {
@@ -124,6 +149,7 @@ struct FastPMDriftFactor {
     int nsamples;
     double Dv1; /* at ac */
     double Dv2; /* at ac */
+    double pgdc_weight; /* of the PGD displacement over the full range; 0.5 for a drift between two forces */
 
     double dyyy[32];
     double da1[32];
@@ -179,7 +205,7 @@ void
 fastpm_kick_store(FastPMKickFactor * kick,
     FastPMStore * pi, FastPMStore * po, double af);
 
-void 
+double
 fastpm_drift_store(FastPMDriftFactor * drift,
                FastPMStore * pi, FastPMStore * po,
                double af);
@@ -56,6 +56,9 @@ typedef enum FastPMColumnTags {
     COLUMN_MASS = 1L << 20,
     COLUMN_RAND = 1L << 21,
     COLUMN_RMOM = 1L << 22,  /* Radial momentum m * rhat dot (a dx/dt), used in lightcone map*/
+    COLUMN_POS_FIXED = 1L << 23, /* compact position; see fastpm_store_get_position */
+    COLUMN_DX1_FIXED = 1L << 24, /* compact LPT displacements; see fastpm_store_get_lpt_displacement */
+    COLUMN_DX2_FIXED = 1L << 25,
 
 } FastPMColumnTags;
 
@@ -96,6 +99,11 @@ struct FastPMStore {
         double _q_scale[3];
         ptrdiff_t _q_strides[3];
         ptrdiff_t _q_size;
+
+        /* period of the compact positions; set by fastpm_store_fill, not saved. */
+        double _x_box[3];
+        /* unit of the compact LPT displacements; set by fastpm_store_encode_lpt_displacement, not saved. */
+        double _dx_scale[2];
     } meta;
 
     union {
@@ -130,6 +138,13 @@ struct FastPMStore {
             /* other fields */
             float (* rand);   /* a random number between 0 and 1 */
             float (* rmom);   /* radial momentum, m rhat dot (a dx/dt) */
+
+            /* position in units of meta._x_box / 2**32; used in place of x. */
+            uint32_t (* xfix)[3];
+
+            /* LPT displacements in units of meta._dx_scale; used in place of dx1 and dx2. */
+            int16_t (* dx1fix)[3];
+            int16_t (* dx2fix)[3];
         };
     };
 };
@@ -198,6 +213,14 @@ void
 fastpm_packing_plan_unpack(FastPMPackingPlan * plan,
             FastPMStore * p, ptrdiff_t i, void * packed);
 
+void
+fastpm_packing_plan_pack_many(FastPMPackingPlan * plan,
+            FastPMStore * p, const ptrdiff_t * index, ptrdiff_t start, size_t n, void * packed);
+
+void
+fastpm_packing_plan_unpack_many(FastPMPackingPlan * plan,
+            FastPMStore * p, ptrdiff_t start, size_t n, void * packed);
+
 void
 fastpm_packing_plan_unpack_ci(FastPMPackingPlan * plan, int ci,
             FastPMStore * p, ptrdiff_t i, void * packed);
@@ -205,6 +228,9 @@ fastpm_packing_plan_unpack_ci(FastPMPackingPlan * plan, int ci,
 void
 fastpm_store_destroy(FastPMStore * p);
 
+int
+fastpm_store_grow(FastPMStore * p, size_t np_upper);
+
 void
 fastpm_store_summary(FastPMStore * p,
         FastPMColumnTags attribute,
@@ -215,24 +241,31 @@ fastpm_store_summary(FastPMStore * p,
 void
 fastpm_store_wrap(FastPMStore * p, double BoxSize[3]);
 
+void
+fastpm_store_wrap_from(FastPMStore * p, ptrdiff_t start, double BoxSize[3]);
+
 typedef int (*fastpm_store_target_func)(FastPMStore * p, ptrdiff_t index, void * data);
 
 int
 fastpm_store_decompose(FastPMStore * p, fastpm_store_target_func target_func, void * data, MPI_Comm comm);
 
+int
+fastpm_store_decompose_from(FastPMStore * p, ptrdiff_t start, fastpm_store_target_func target_func, void * data, MPI_Comm comm);
+
 void
-fastpm_store_permute(FastPMStore * p, int * ind);
+fastpm_store_permute(FastPMStore * p, ptrdiff_t * ind);
 
-int
-FastPMLocalSortByID(const int i1,
-                    const int i2,
-                    FastPMStore * p);
+typedef uint64_t (*fastpm_store_sort_key_func)(FastPMStore * p, ptrdiff_t index, void * userdata);
+
+uint64_t FastPMLocalSortByID(FastPMStore * p, ptrdiff_t i, void * userdata);
+uint64_t FastPMLocalSortByMinID(FastPMStore * p, ptrdiff_t i, void * userdata);
+uint64_t FastPMLocalSortByMorton(FastPMStore * p, ptrdiff_t i, void * userdata);
 
 void
 FastPMReduceAddFloat(FastPMStore * src, ptrdiff_t isrc, FastPMStore * dest, ptrdiff_t idest, int ci, void * userdata);
 
 void
-fastpm_store_sort(FastPMStore * p, int (*cmpfunc)(const int i1, const int i2, FastPMStore * p));
+fastpm_store_sort(FastPMStore * p, fastpm_store_sort_key_func key_func, void * userdata);
 
 size_t
 fastpm_store_get_np_total(FastPMStore * p, MPI_Comm comm);
@@ -253,6 +286,9 @@ fastpm_store_fill_subsample_mask_from_array(FastPMStore * p,
 size_t
 fastpm_store_subsample(FastPMStore * in, FastPMParticleMaskType * mask, FastPMStore * out);
 
+size_t
+fastpm_store_partition(FastPMStore * p, FastPMParticleMaskType * mask);
+
 void
 fastpm_store_copy(FastPMStore * in, FastPMStore * out);
 
@@ -266,8 +302,18 @@ void
 fastpm_store_extend(FastPMStore * p, FastPMStore * extra);
 
 void fastpm_store_get_position(FastPMStore * p, ptrdiff_t index, double pos[3]);
+void fastpm_store_set_position(FastPMStore * p, ptrdiff_t index, const double pos[3]);
+FastPMColumnTags fastpm_store_get_position_attribute(FastPMStore * p);
 void fastpm_store_get_lagrangian_position(FastPMStore * p, ptrdiff_t index, double pos[3]);
 
+void fastpm_store_get_lpt_displacement(FastPMStore * p, ptrdiff_t index, float dx1[3], float dx2[3]);
+
+void
+fastpm_store_encode_lpt_displacement(FastPMStore * p, MPI_Comm comm);
+
+void
+fastpm_store_decode_lpt_displacement(FastPMStore * p);
+
 int
 FastPMTargetPM (FastPMStore * p, ptrdiff_t i, PM * pm);
 
@@ -1,5 +1,28 @@
+#ifndef __FASTPM_TRANSFER_H__
+#define __FASTPM_TRANSFER_H__
+
 FASTPM_BEGIN_DECLS
 
+#define FASTPM_FUSED_TRANSFER_MAX_OPS 8
+
+enum { FASTPM_FUSED_LAPLACE, FASTPM_FUSED_LOWPASS, FASTPM_FUSED_ANY };
+
+/* A composition of transfer functions that is applied in one pass. */
+typedef struct FastPMFusedTransfer {
+    PM * pm;
+    double scale;
+    double * fac[3]; /* factors separable in the axes; NULL for 1. */
+    int nimag;       /* number of factors of i from the gradients */
+    int nops;
+    struct {
+        int type;
+        int order;
+        double kth2;
+        fastpm_fkfunc func;
+        void * data;
+    } ops[FASTPM_FUSED_TRANSFER_MAX_OPS]; /* factors that are not separable */
+} FastPMFusedTransfer;
+
 void
 fastpm_apply_smoothing_transfer(PM * pm, FastPMFloat * from, FastPMFloat * to, double sml);
 
@@ -36,4 +59,41 @@ fastpm_apply_set_mode_transfer(PM * pm, FastPMFloat * from, FastPMFloat * to, pt
 double
 fastpm_apply_get_mode_transfer(PM * pm, FastPMFloat * from, ptrdiff_t * mode);
 
+void
+fastpm_fused_transfer_init(FastPMFusedTransfer * tr, PM * pm);
+
+void
+fastpm_fused_transfer_destroy(FastPMFusedTransfer * tr);
+
+void
+fastpm_fused_transfer_add_multiply(FastPMFusedTransfer * tr, double value);
+
+void
+fastpm_fused_transfer_add_smoothing(FastPMFusedTransfer * tr, double sml);
+
+void
+fastpm_fused_transfer_add_decic(FastPMFusedTransfer * tr);
+
+/* i k; order 0 for the exact k, 1 for the 4 point central difference */
+void
+fastpm_fused_transfer_add_grad(FastPMFusedTransfer * tr, int dir, int order);
+
+/* same as add_grad with order 1, agrees with fastpm_apply_diff_transfer */
+void
+fastpm_fused_transfer_add_diff(FastPMFusedTransfer * tr, int dir);
+
+void
+fastpm_fused_transfer_add_laplace(FastPMFusedTransfer * tr, int order);
+
+void
+fastpm_fused_transfer_add_lowpass(FastPMFusedTransfer * tr, double kth);
+
+void
+fastpm_fused_transfer_add_any(FastPMFusedTransfer * tr, fastpm_fkfunc func, void * data);
+
+void
+fastpm_fused_transfer_apply(FastPMFusedTransfer * tr, FastPMFloat * from, FastPMFloat * to);
+
 FASTPM_END_DECLS
+
+#endif
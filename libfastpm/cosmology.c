@@ -1,10 +1,13 @@
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include <gsl/gsl_integration.h>
 #include <gsl/gsl_roots.h>
 #include <gsl/gsl_sf_hyperg.h>
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_math.h>
 #include <gsl/gsl_odeiv2.h>
+#include <gsl/gsl_interp.h>
 
 #include <fastpm/libfastpm.h>
 #include <fastpm/logging.h>
@@ -18,6 +21,8 @@
 double HubbleDistance = 2997.92458; /* Mpc/h */
 double HubbleConstant = 100.0;      /* km/s / Mpc/h */
 
+static void fastpm_background_init(FastPMCosmology * c);
+static void fastpm_background_destroy(FastPMCosmology * c);
 
 void
 fastpm_cosmology_init(FastPMCosmology * c)
@@ -47,6 +52,10 @@ fastpm_cosmology_init(FastPMCosmology * c)
 
     // Set Omega_Lambda at z=0 by closing Friedmann's equation
     c->Omega_Lambda = 1 - c->Omega_m - Omega_r(c) - c->Omega_k;
+
+    /* the background tables need the closed cosmology */
+    c->background = NULL;
+    fastpm_background_init(c);
 }
 
 void
@@ -56,6 +65,9 @@ fastpm_cosmology_destroy(FastPMCosmology * c)
         fastpm_fd_interp_destroy(c->FDinterp);
         free(c->FDinterp);
     }
+    if (c->background) {
+        fastpm_background_destroy(c);
+    }
 }
 
 
@@ -318,31 +330,43 @@ static int growth_ode(double a, const double y[], double dyda[], void *params)
     return GSL_SUCCESS;
 }
 
-static ode_soln growth_ode_solve(double a, FastPMCosmology * c)
+// FIXME: need to make sure this is less than the starting a. For now using z=159.
+#define GROWTH_AINI 0.00625
+
+static void growth_ode_init(double aini, double yini[4])
 {
-    /* This returns an array of {d1, F1, d2, F2} (unnormalised) */
-    gsl_odeiv2_system F;
-    F.function = &growth_ode;
-    F.jacobian = NULL;
-    F.dimension = 4;
-    F.params = (void*) c;
-    
-    gsl_odeiv2_driver * drive 
-        = gsl_odeiv2_driver_alloc_standard_new(&F,
-                                               gsl_odeiv2_step_rkf45, 
+    // assume matter domination
+    yini[0] = aini;
+    yini[1] = aini;
+    yini[2] = - 3./7. * aini*aini;
+    yini[3] = 2 * yini[2];
+}
+
+static gsl_odeiv2_driver * growth_ode_driver(gsl_odeiv2_system * F, FastPMCosmology * c)
+{
+    F->function = &growth_ode;
+    F->jacobian = NULL;
+    F->dimension = 4;
+    F->params = (void*) c;
+
+    return gsl_odeiv2_driver_alloc_standard_new(F,
+                                               gsl_odeiv2_step_rkf45,
                                                1e-6,
                                                1e-8,
                                                1e-8,
                                                1,
                                                1);
-    
-    // assume matter domination
-    double aini = 0.00625;  // FIXME: need to make sure this is less than the starting a. For now using z=159.
+}
+
+static ode_soln growth_ode_solve(double a, FastPMCosmology * c)
+{
+    /* This returns an array of {d1, F1, d2, F2} (unnormalised) */
+    gsl_odeiv2_system F;
+    gsl_odeiv2_driver * drive = growth_ode_driver(&F, c);
+
+    double aini = GROWTH_AINI;
     double yini[4];
-    yini[0] = aini;
-    yini[1] = aini;
-    yini[2] = - 3./7. * aini*aini;
-    yini[3] = 2 * yini[2];
+    growth_ode_init(aini, yini);
     
     int status = gsl_odeiv2_driver_apply(drive, &aini, a, yini);
     gsl_odeiv2_driver_free(drive);
@@ -371,14 +395,213 @@ static ode_soln growth_ode_solve(double a, FastPMCosmology * c)
     return soln;
 }
 
+static double
+comoving_distance_int(double a, void * params)
+{
+    FastPMCosmology * c = (FastPMCosmology * ) params;
+    return 1. / (a * a * HubbleEa(a, c));
+}
+
+static double
+drift_int(double a, void * params)
+{
+    FastPMCosmology * c = (FastPMCosmology * ) params;
+    return 1. / (a * a * a * HubbleEa(a, c));
+}
+
+static double
+integrate_background(double (*func)(double, void *), double ai, double af, double epsrel,
+        FastPMCosmology * c, gsl_integration_workspace * workspace, size_t worksize)
+{
+    double result, abserr;
+    gsl_function F;
+    F.function = func;
+    F.params = (void*) c;
+
+    gsl_integration_qag(&F, ai, af, 0, epsrel, worksize, GSL_INTEG_GAUSS41,
+            workspace, &result, &abserr);
+    return result;
+}
+
+/* Tables of the background on a uniform grid of log a, from the start of the growth ODE
+ * to a = 1. The growth ODE is integrated once through all nodes, and the integrals are
+ * summed over the intervals between the nodes; the lookups are cubic splines in log a.
+ * Outside of the grid the functions fall back to solving the ODE or the integral. */
+#define BACKGROUND_SIZE 1024
+
+enum {
+    BACKGROUND_GROWTH = 0,  /* 4 columns: ODE {d1, F1, d2, F2} unnormalised; LCDM solve_growth_int in the first */
+    BACKGROUND_CHI = 4,     /* comoving distance to a = 1, in units of the Hubble distance */
+    BACKGROUND_DRIFT = 5,   /* integral of da / (a^3 E) from amin */
+    BACKGROUND_NCOLUMNS = 6,
+};
+
+struct FastPMBackground {
+    double amin;
+    double amax;
+    double lna[BACKGROUND_SIZE];
+    double y[BACKGROUND_NCOLUMNS][BACKGROUND_SIZE];
+    gsl_interp * interp[BACKGROUND_NCOLUMNS];
+};
+
+static void
+fastpm_background_init(FastPMCosmology * c)
+{
+    struct FastPMBackground * bg = malloc(sizeof(bg[0]));
+    memset(bg, 0, sizeof(bg[0]));
+
+    bg->amin = GROWTH_AINI;
+    bg->amax = 1.0;
+
+    int i, j;
+    double a[BACKGROUND_SIZE];
+    for(i = 0; i < BACKGROUND_SIZE; i ++) {
+        bg->lna[i] = log(bg->amin) + (log(bg->amax) - log(bg->amin)) * i / (BACKGROUND_SIZE - 1);
+        a[i] = exp(bg->lna[i]);
+    }
+    /* exact ends; the normalization of the growth is at the last node */
+    bg->lna[0] = log(bg->amin);
+    bg->lna[BACKGROUND_SIZE - 1] = log(bg->amax);
+    a[0] = bg->amin;
+    a[BACKGROUND_SIZE - 1] = bg->amax;
+
+    int WORKSIZE = 1000;
+    gsl_integration_workspace * workspace = gsl_integration_workspace_alloc(WORKSIZE);
+
+    switch (c->growth_mode) {
+        case FASTPM_GROWTH_MODE_LCDM: {
+            gsl_function F;
+            F.function = &growth_int;
+            F.params = (double[]) {c->Omega_m, c->Omega_Lambda};
+
+            double I, abserr;
+            gsl_integration_qag(&F, 0, a[0], 0, 1.0e-9, WORKSIZE, GSL_INTEG_GAUSS41,
+                    workspace, &I, &abserr);
+            bg->y[BACKGROUND_GROWTH][0] = HubbleEa(a[0], c) * I;
+            for(i = 1; i < BACKGROUND_SIZE; i ++) {
+                double dI;
+                gsl_integration_qag(&F, a[i - 1], a[i], 0, 1.0e-9, WORKSIZE, GSL_INTEG_GAUSS41,
+                        workspace, &dI, &abserr);
+                I += dI;
+                bg->y[BACKGROUND_GROWTH][i] = HubbleEa(a[i], c) * I;
+            }
+            /* unused */
+            for(j = 1; j < 4; j ++) {
+                memcpy(bg->y[BACKGROUND_GROWTH + j], bg->y[BACKGROUND_GROWTH], sizeof(bg->y[0]));
+            }
+        break; }
+        case FASTPM_GROWTH_MODE_ODE: {
+            gsl_odeiv2_system F;
+            gsl_odeiv2_driver * drive = growth_ode_driver(&F, c);
+            double t = a[0];
+            double y[4];
+            growth_ode_init(t, y);
+            for(i = 0; i < BACKGROUND_SIZE; i ++) {
+                if(i > 0) {
+                    int status = gsl_odeiv2_driver_apply(drive, &t, a[i], y);
+                    if (status != GSL_SUCCESS) {
+                        fastpm_raise(-1, "Growth ODE unsuccesful at a=%g.", a[i]);
+                    }
+                }
+                for(j = 0; j < 4; j ++) {
+                    bg->y[BACKGROUND_GROWTH + j][i] = y[j];
+                }
+            }
+            gsl_odeiv2_driver_free(drive);
+        break; }
+        default:
+            fastpm_raise(-1, "Please enter a valid growth mode.\n");
+    }
+
+    bg->y[BACKGROUND_CHI][BACKGROUND_SIZE - 1] = 0;
+    for(i = BACKGROUND_SIZE - 2; i >= 0; i --) {
+        bg->y[BACKGROUND_CHI][i] = bg->y[BACKGROUND_CHI][i + 1]
+            + integrate_background(comoving_distance_int, a[i], a[i + 1], 1.0e-9, c, workspace, WORKSIZE);
+    }
+
+    bg->y[BACKGROUND_DRIFT][0] = 0;
+    for(i = 1; i < BACKGROUND_SIZE; i ++) {
+        bg->y[BACKGROUND_DRIFT][i] = bg->y[BACKGROUND_DRIFT][i - 1]
+            + integrate_background(drift_int, a[i - 1], a[i], 1.0e-9, c, workspace, WORKSIZE);
+    }
+
+    gsl_integration_workspace_free(workspace);
+
+    for(j = 0; j < BACKGROUND_NCOLUMNS; j ++) {
+        bg->interp[j] = gsl_interp_alloc(gsl_interp_cspline, BACKGROUND_SIZE);
+        gsl_interp_init(bg->interp[j], bg->lna, bg->y[j], BACKGROUND_SIZE);
+    }
+    c->background = bg;
+}
+
+static void
+fastpm_background_destroy(FastPMCosmology * c)
+{
+    struct FastPMBackground * bg = c->background;
+    int j;
+    for(j = 0; j < BACKGROUND_NCOLUMNS; j ++) {
+        gsl_interp_free(bg->interp[j]);
+    }
+    free(bg);
+    c->background = NULL;
+}
+
+static int
+fastpm_background_covers(FastPMCosmology * c, double a)
+{
+    return c->background && a >= c->background->amin && a <= c->background->amax;
+}
+
+/* no accelerator; the lookups can run in threads */
+static double
+fastpm_background_eval(FastPMCosmology * c, int column, double a)
+{
+    struct FastPMBackground * bg = c->background;
+    return gsl_interp_eval(bg->interp[column], bg->lna, bg->y[column], log(a), NULL);
+}
+
+/* solve_growth_int, from the tables if possible */
+static double lcdm_growth(double a, FastPMCosmology * c)
+{
+    if(a == 1.0 && c->background) {
+        return c->background->y[BACKGROUND_GROWTH][BACKGROUND_SIZE - 1];
+    }
+    if(fastpm_background_covers(c, a)) {
+        return fastpm_background_eval(c, BACKGROUND_GROWTH, a);
+    }
+    return solve_growth_int(a, c);
+}
+
+/* growth_ode_solve, from the tables if possible */
+static ode_soln ode_growth(double a, FastPMCosmology * c)
+{
+    if(a == 1.0 && c->background) {
+        ode_soln soln;
+        soln.y0 = c->background->y[BACKGROUND_GROWTH + 0][BACKGROUND_SIZE - 1];
+        soln.y1 = c->background->y[BACKGROUND_GROWTH + 1][BACKGROUND_SIZE - 1];
+        soln.y2 = c->background->y[BACKGROUND_GROWTH + 2][BACKGROUND_SIZE - 1];
+        soln.y3 = c->background->y[BACKGROUND_GROWTH + 3][BACKGROUND_SIZE - 1];
+        return soln;
+    }
+    if(fastpm_background_covers(c, a)) {
+        ode_soln soln;
+        soln.y0 = fastpm_background_eval(c, BACKGROUND_GROWTH + 0, a);
+        soln.y1 = fastpm_background_eval(c, BACKGROUND_GROWTH + 1, a);
+        soln.y2 = fastpm_background_eval(c, BACKGROUND_GROWTH + 2, a);
+        soln.y3 = fastpm_background_eval(c, BACKGROUND_GROWTH + 3, a);
+        return soln;
+    }
+    return growth_ode_solve(a, c);
+}
+
 void fastpm_growth_info_init(FastPMGrowthInfo * growth_info, double a, FastPMCosmology * c) {
     growth_info->a = a;
     growth_info->c = c;
 
     switch (c->growth_mode) {
         case FASTPM_GROWTH_MODE_LCDM: {
-            double d1 = solve_growth_int(a, c);
-            double d1_a1 = solve_growth_int(1, c);
+            double d1 = lcdm_growth(a, c);
+            double d1_a1 = lcdm_growth(1, c);
             double Om = Omega_m(a, c);
 
             growth_info->D1 = d1 / d1_a1;
@@ -387,8 +610,8 @@ void fastpm_growth_info_init(FastPMGrowthInfo * growth_info, double a, FastPMCos
             growth_info->f2 = 2 * pow(Om, 6./11.);
         break; }
         case FASTPM_GROWTH_MODE_ODE: {
-            ode_soln soln = growth_ode_solve(a, c);
-            ode_soln soln_a1 = growth_ode_solve(1, c);
+            ode_soln soln = ode_growth(a, c);
+            ode_soln soln_a1 = ode_growth(1, c);
 
             growth_info->D1 = soln.y0 / soln_a1.y0;
             growth_info->f1 = soln.y1 / soln.y0;    /* f = d log D / d log a. Note soln.y1 is d d1 / d log a */
@@ -412,7 +635,7 @@ double DGrowthFactorDa(FastPMGrowthInfo * growth_info) {
     switch (c->growth_mode) {
         case FASTPM_GROWTH_MODE_LCDM: {
             double E = HubbleEa(a, c);
-            double EI = solve_growth_int(1.0, c);
+            double EI = lcdm_growth(1.0, c);
             double t1 = DHubbleEaDa(a, c) * growth_info->D1 / E;
             double t2 = E * pow(a * E, -3) / EI;
             ans = t1 + t2;
@@ -440,7 +663,7 @@ double D2GrowthFactorDa2(FastPMGrowthInfo * growth_info) {
             double d2Eda2 = D2HubbleEaDa2(a, c);
             double dEda = DHubbleEaDa(a, c);
             double E = HubbleEa(a, c);
-            double EI = solve_growth_int(1., c);
+            double EI = lcdm_growth(1., c);
             double t1 = d2Eda2 * growth_info->D1 / E;
             double t2 = (dEda + 3 / a * E) * pow(a * E, -3) / EI;
             ans = t1 - t2;
@@ -461,15 +684,12 @@ double D2GrowthFactorDa2(FastPMGrowthInfo * growth_info) {
     return ans;
 }
 
-static double
-comoving_distance_int(double a, void * params)
-{
-    FastPMCosmology * c = (FastPMCosmology * ) params;
-    return 1. / (a * a * HubbleEa(a, c));
-}
-
 double ComovingDistance(double a, FastPMCosmology * c) {
 
+    if(fastpm_background_covers(c, a)) {
+        return fastpm_background_eval(c, BACKGROUND_CHI, a);
+    }
+
     /* We tested using ln_a doesn't seem to improve accuracy */
     int WORKSIZE = 100000;
 
@@ -491,6 +711,34 @@ double ComovingDistance(double a, FastPMCosmology * c) {
     return result;
 }
 
+/* integral of da / (a^2 E) from ai to af; the kick of the standard PM scheme */
+double KickIntegral(double ai, double af, FastPMCosmology * c)
+{
+    if(fastpm_background_covers(c, ai) && fastpm_background_covers(c, af)) {
+        return fastpm_background_eval(c, BACKGROUND_CHI, ai)
+             - fastpm_background_eval(c, BACKGROUND_CHI, af);
+    }
+    int WORKSIZE = 5000;
+    gsl_integration_workspace * workspace = gsl_integration_workspace_alloc(WORKSIZE);
+    double result = integrate_background(comoving_distance_int, ai, af, 1e-8, c, workspace, WORKSIZE);
+    gsl_integration_workspace_free(workspace);
+    return result;
+}
+
+/* integral of da / (a^3 E) from ai to af; the drift of the standard PM scheme */
+double DriftIntegral(double ai, double af, FastPMCosmology * c)
+{
+    if(fastpm_background_covers(c, ai) && fastpm_background_covers(c, af)) {
+        return fastpm_background_eval(c, BACKGROUND_DRIFT, af)
+             - fastpm_background_eval(c, BACKGROUND_DRIFT, ai);
+    }
+    int WORKSIZE = 5000;
+    gsl_integration_workspace * workspace = gsl_integration_workspace_alloc(WORKSIZE);
+    double result = integrate_background(drift_int, ai, af, 1e-8, c, workspace, WORKSIZE);
+    gsl_integration_workspace_free(workspace);
+    return result;
+}
+
 #ifdef TEST_COSMOLOGY
 int main() {
     /* the old COLA growthDtemp is 6 * pow(1 - c.OmegaM, 1.5) times growth */
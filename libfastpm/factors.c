@@ -69,50 +69,70 @@ fastpm_drift_lookup(FastPMDriftFactor * drift, double af, double * dyyy, double
     }
 }
 
-inline void
-fastpm_drift_one(FastPMDriftFactor * drift, FastPMStore * p, ptrdiff_t i, double xo[3], double af)
+/* the drift factors from ai to af; the same for all particles of a store */
+static inline void
+fastpm_drift_factors(FastPMDriftFactor * drift, double ai, double af, double * dyyy, double * da1, double * da2)
 {
-
     double dyyy_f, da1_f, da2_f;
     double dyyy_i, da1_i, da2_i;
-    double dyyy, da1, da2;
 
     fastpm_drift_lookup(drift, af, &dyyy_f, &da1_f, &da2_f);
-    fastpm_drift_lookup(drift, p->meta.a_x, &dyyy_i, &da1_i, &da2_i);
+    fastpm_drift_lookup(drift, ai, &dyyy_i, &da1_i, &da2_i);
+
+    *dyyy = dyyy_f - dyyy_i;
+    *da1 = da1_f - da1_i;
+    *da2 = da2_f - da2_i;
+}
+
+static inline void
+fastpm_drift_particle(FastPMDriftFactor * drift, FastPMStore * p, ptrdiff_t i, double xo[3],
+        double dyyy, double da1, double da2)
+{
+    double xi[3];
+    fastpm_store_get_position(p, i, xi);
 
-    dyyy = dyyy_f - dyyy_i;
-    da1 = da1_f - da1_i;
-    da2 = da2_f - da2_i;
+    float dx1[3], dx2[3];
+    if(drift->forcemode != FASTPM_FORCE_FASTPM && drift->forcemode != FASTPM_FORCE_PM) {
+        fastpm_store_get_lpt_displacement(p, i, dx1, dx2);
+    }
 
     int d;
     for(d = 0; d < 3; d ++) {
         double v;
         switch(drift->forcemode) {
             case FASTPM_FORCE_2LPT:
-                xo[d] = p->x[i][d] + p->dx1[i][d] * da1 + p->dx2[i][d] * da2;
+                xo[d] = xi[d] + dx1[d] * da1 + dx2[d] * da2;
             break;
             case FASTPM_FORCE_ZA:
-                xo[d] = p->x[i][d] + p->dx1[i][d] * da1;
+                xo[d] = xi[d] + dx1[d] * da1;
             break;
             case FASTPM_FORCE_FASTPM:
             case FASTPM_FORCE_PM:
-                xo[d] = p->x[i][d] + p->v[i][d] * dyyy;
+                xo[d] = xi[d] + p->v[i][d] * dyyy;
             break;
             case FASTPM_FORCE_COLA:
                 /* For cola, remove the lpt velocity to find the residual velocity v*/
-                v = p->v[i][d] - (p->dx1[i][d]*drift->Dv1 + p->dx2[i][d]*drift->Dv2);
-                xo[d] = p->x[i][d] + v * dyyy;
-                xo[d] += p->dx1[i][d] * da1 + p->dx2[i][d] * da2;
+                v = p->v[i][d] - (dx1[d]*drift->Dv1 + dx2[d]*drift->Dv2);
+                xo[d] = xi[d] + v * dyyy;
+                xo[d] += dx1[d] * da1 + dx2[d] * da2;
             break;
         }
         /* if PGDCorrection is enabled, add it */
         if(p->pgdc) {
             /* no drift; to protect the pgdc line */
             if (drift->ai == drift->af) continue;
-            xo[d] += 0.5 * p->pgdc[i][d] * dyyy / drift->dyyy[drift->nsamples-1];
+            xo[d] += drift->pgdc_weight * p->pgdc[i][d] * dyyy / drift->dyyy[drift->nsamples-1];
         }
     }
 }
+
+inline void
+fastpm_drift_one(FastPMDriftFactor * drift, FastPMStore * p, ptrdiff_t i, double xo[3], double af)
+{
+    double dyyy, da1, da2;
+    fastpm_drift_factors(drift, p->meta.a_x, af, &dyyy, &da1, &da2);
+    fastpm_drift_particle(drift, p, i, xo, dyyy, da1, da2);
+}
 static inline void
 fastpm_kick_lookup(FastPMKickFactor * kick, double af, double * dda, double * Dv1, double * Dv2)
 {
@@ -144,51 +164,85 @@ fastpm_kick_lookup(FastPMKickFactor * kick, double af, double * dda, double * Dv
     }
 }
 
-inline void
-fastpm_kick_one(FastPMKickFactor * kick, FastPMStore * p, ptrdiff_t i, float vo[3], double af)
+/* the kick factors from ai to af; the same for all particles of a store */
+static inline void
+fastpm_kick_factors(FastPMKickFactor * kick, double ai, double af, double * dda, double * Dv1, double * Dv2)
 {
     double dda_i, Dv1_i, Dv2_i;
     double dda_f, Dv1_f, Dv2_f;
-    double dda, Dv1, Dv2;
 
     fastpm_kick_lookup(kick, af, &dda_f, &Dv1_f, &Dv2_f);
-    fastpm_kick_lookup(kick, p->meta.a_v, &dda_i, &Dv1_i, &Dv2_i);
-    dda = dda_f - dda_i;
-    Dv1 = Dv1_f - Dv1_i;
-    Dv2 = Dv2_f - Dv2_i;
+    fastpm_kick_lookup(kick, ai, &dda_i, &Dv1_i, &Dv2_i);
+    *dda = dda_f - dda_i;
+    *Dv1 = Dv1_f - Dv1_i;
+    *Dv2 = Dv2_f - Dv2_i;
+}
+
+static inline void
+fastpm_kick_particle(FastPMKickFactor * kick, FastPMStore * p, ptrdiff_t i, float vo[3],
+        double dda, double Dv1, double Dv2)
+{
+    float dx1[3], dx2[3];
+    if(kick->forcemode == FASTPM_FORCE_COLA) {
+        fastpm_store_get_lpt_displacement(p, i, dx1, dx2);
+    }
 
     int d;
     for(d = 0; d < 3; d++) {
         float ax = p->acc[i][d];       // unlike a_x, which means a at which x is calcd
         if(kick->forcemode == FASTPM_FORCE_COLA) {
-            ax += (p->dx1[i][d]*kick->q1 + p->dx2[i][d]*kick->q2);
+            ax += (dx1[d]*kick->q1 + dx2[d]*kick->q2);
         }
         vo[d] = p->v[i][d] + ax * dda;
         if(kick->forcemode == FASTPM_FORCE_COLA) {
-            vo[d] += (p->dx1[i][d] * Dv1 + p->dx2[i][d] * Dv2);
+            vo[d] += (dx1[d] * Dv1 + dx2[d] * Dv2);
         }
     }
 }
 
+inline void
+fastpm_kick_one(FastPMKickFactor * kick, FastPMStore * p, ptrdiff_t i, float vo[3], double af)
+{
+    double dda, Dv1, Dv2;
+    fastpm_kick_factors(kick, p->meta.a_v, af, &dda, &Dv1, &Dv2);
+    fastpm_kick_particle(kick, p, i, vo, dda, Dv1, Dv2);
+}
+
 // Leap frog time integration
 
 void 
 fastpm_kick_store(FastPMKickFactor * kick,
     FastPMStore * pi, FastPMStore * po, double af)
 {
-    int np = pi->np;
+    ptrdiff_t np = pi->np;
 
     // Kick using acceleration at a= ac
     // Assume forces at a=ac is in particles->force
 
-    int i;
+    /* the factors do not depend on the particle; look them up once per store */
+    double dda, Dv1, Dv2;
+    fastpm_kick_factors(kick, pi->meta.a_v, af, &dda, &Dv1, &Dv2);
+
+    ptrdiff_t i;
+    if(kick->forcemode != FASTPM_FORCE_COLA) {
+        /* only the acceleration; a stream over v and acc */
 #pragma omp parallel for
-    for(i=0; i<np; i++) {
-        int d;
-        float vo[3];
-        fastpm_kick_one(kick, pi, i, vo, af);
-        for(d = 0; d < 3; d++) {
-            po->v[i][d] = vo[d];
+        for(i = 0; i < np; i ++) {
+            int d;
+            for(d = 0; d < 3; d++) {
+                float ax = pi->acc[i][d];
+                po->v[i][d] = pi->v[i][d] + ax * dda;
+            }
+        }
+    } else {
+#pragma omp parallel for
+        for(i = 0; i < np; i ++) {
+            int d;
+            float vo[3];
+            fastpm_kick_particle(kick, pi, i, vo, dda, Dv1, Dv2);
+            for(d = 0; d < 3; d++) {
+                po->v[i][d] = vo[d];
+            }
         }
     }
 
@@ -366,29 +420,57 @@ fastpm_drift_init(FastPMDriftFactor * drift, FastPMSolver * fastpm,
     drift->af = af;
     drift->ai = ai;
     drift->ac = ac;
+    drift->pgdc_weight = 0.5;
     drift->Dv1 = D1_c * ac * ac * E_c * f1_c;
     drift->Dv2 = D2_c * ac * ac * E_c * f2_c;
 }
 
-void
+/* returns the largest displacement along any direction */
+double
 fastpm_drift_store(FastPMDriftFactor * drift,
                FastPMStore * pi, FastPMStore * po,
                double af)
 {
-    int np = pi->np;
+    ptrdiff_t np = pi->np;
+    double dxmax = 0;
 
-    int i;
+    /* the factors do not depend on the particle; look them up once per store */
+    double dyyy, da1, da2;
+    fastpm_drift_factors(drift, pi->meta.a_x, af, &dyyy, &da1, &da2);
+
+    ptrdiff_t i;
     // Drift
-#pragma omp parallel for
-    for(i=0; i<np; i++) {
-        double xo[3] = {0};
-        fastpm_drift_one(drift, pi, i, xo, af);
-        int d;
-        for(d = 0; d < 3; d ++) {
-            po->x[i][d] = xo[d];
+    if((drift->forcemode == FASTPM_FORCE_FASTPM || drift->forcemode == FASTPM_FORCE_PM)
+    && pi->x && po->x && !pi->pgdc) {
+        /* only the velocity; a stream over x and v */
+#pragma omp parallel for reduction(max: dxmax)
+        for(i = 0; i < np; i ++) {
+            int d;
+            for(d = 0; d < 3; d ++) {
+                double xi = pi->x[i][d];
+                double xo = xi + pi->v[i][d] * dyyy;
+                double dx = fabs(xo - xi);
+                if(dx > dxmax) dxmax = dx;
+                po->x[i][d] = xo;
+            }
+        }
+    } else {
+#pragma omp parallel for reduction(max: dxmax)
+        for(i = 0; i < np; i ++) {
+            double xi[3];
+            double xo[3] = {0};
+            fastpm_store_get_position(pi, i, xi);
+            fastpm_drift_particle(drift, pi, i, xo, dyyy, da1, da2);
+            int d;
+            for(d = 0; d < 3; d ++) {
+                double dx = fabs(xo[d] - xi[d]);
+                if(dx > dxmax) dxmax = dx;
+            }
+            fastpm_store_set_position(po, i, xo);
         }
     }
     po->meta.a_x = af;
+    return dxmax;
 }
 
 //
@@ -403,18 +485,10 @@ double gpQ(double a, double nLPT) {
     return pow(a, nLPT);
 }
 
-static double stddriftfunc (double a, struct iparam * iparam) {
-    return 1 / (pow(a, 3) * HubbleEa(a, iparam->cosmology));
-}
-
 static double nonstddriftfunc (double a, struct iparam * iparam) {
     return gpQ(a, iparam->nLPT)/(pow(a, 3) * HubbleEa(a, iparam->cosmology));
 }
 
-static double stdkickfunc (double a, struct iparam * iparam) {
-    return 1/ (pow(a, 2) * HubbleEa(a, iparam->cosmology));
-}
-
 static double integrand(double a, void * params) {
     void ** p = (void**) params;
     double (*func)(double a, struct iparam * s) = p[0];
@@ -453,24 +527,20 @@ double integrate(double ai, double af,
 static double 
 Sq(double ai, double af, double aRef, double nLPT, FastPMCosmology * c, int USE_NONSTDDA)
 {
-    double resultstd, result;
+    double result;
     struct iparam iparam[1];
     iparam->cosmology = c;
     iparam->nLPT = nLPT;
 
-    resultstd = integrate(ai, af, iparam, stddriftfunc);
+    if (!USE_NONSTDDA) {
+        /* from the background tables */
+        return DriftIntegral(ai, af, c);
+    }
 
     result = integrate(ai, af, iparam, nonstddriftfunc);
     result /= gpQ(aRef, nLPT);
 
-    /*
-    fastpm_info("ref time = %6.4f, std drift =%g, non std drift = %g \n",
-        aRef, resultstd, result); */
-
-    if (USE_NONSTDDA)
-        return result;
-    else
-        return resultstd;
+    return result;
 }
 
 double DERgpQ(double a, double nLPT) { 
@@ -483,24 +553,14 @@ static double
 Sphi(double ai, double af, double aRef, double nLPT, FastPMCosmology * c, int USE_NONSTDDA)
 {
     double result;
-    double resultstd;
 
-    struct iparam iparam[1];
-    iparam->cosmology = c;
-    iparam->nLPT = nLPT;
+    if (!USE_NONSTDDA) {
+        /* from the background tables */
+        return KickIntegral(ai, af, c);
+    }
 
     result = (gpQ(af, nLPT) - gpQ(ai, nLPT)) * aRef 
         / (pow(aRef, 3) * HubbleEa(aRef, c) * DERgpQ(aRef, nLPT));
 
-    resultstd = integrate(ai, af, iparam, stdkickfunc);
-
-    /*
-    fastpm_info("ref time = %6.4f, std kick = %g, non std kick = %g\n",
-            aRef, resultstd, result); */
-
-    if (USE_NONSTDDA) {
-        return result;
-    } else {
-        return resultstd;
-    }
+    return result;
 }
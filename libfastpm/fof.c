@@ -369,7 +369,8 @@ _fof_global_merge(
         /* merge ghosts into the p, reducing the MINID on p */
 
         p->minid = minid; /* only update up to p->np */
-        pm_ghosts_reduce(pgd, COLUMN_MINID, FastPMReduceFOF, &data);
+        /* the merge follows the heads of the groups; it cannot run in parallel. */
+        pm_ghosts_reduce_serial(pgd, COLUMN_MINID, FastPMReduceFOF, &data);
         p->minid = NULL;
 
         size_t nmerged = data.nmerged;
@@ -557,18 +558,6 @@ fastpm_fof_apply_length_cut(FastPMFOFFinder * finder, FastPMStore * halos, ptrdi
             fastpm_store_get_np_total(halos, comm));
 }
 
-/* first every undecided halo; then the real halo with particles */
-static int
-FastPMLocalSortByMinID(const int i1,
-                    const int i2,
-                    FastPMStore * p)
-{
-    int v1 = (p->minid[i1] < p->minid[i2]);
-    int v2 = (p->minid[i1] > p->minid[i2]);
-
-    return v2 - v1;
-}
-
 static int
 FastPMTargetMinID(FastPMStore * store, ptrdiff_t i, void * userdata)
 {
@@ -624,7 +613,7 @@ fastpm_fof_reduce_halo_attrs(FastPMFOFFinder * finder, FastPMStore * halos,
     uint64_t lastminid = 0;
 
     /* ind is the array to use to replicate items */
-    int * ind = fastpm_memory_alloc(finder->p->mem, "HaloPermutation", sizeof(ind[0]) * halos->np, FASTPM_MEMORY_STACK);
+    ptrdiff_t * ind = fastpm_memory_alloc(finder->p->mem, "HaloPermutation", sizeof(ind[0]) * halos->np, FASTPM_MEMORY_STACK);
 
     /* the following items will have mask[i] == 1, but we will mark some to 0 if
      * they are not the principle (first) halos segment with this minid */
@@ -730,7 +719,7 @@ fastpm_fof_compute_halo_attrs(FastPMFOFFinder * finder, FastPMStore * halos,
 
     /* to combine, first local sort by minid; those without local particles are moved to the beginning
      * so we can easily skip them. */
-    fastpm_store_sort(halos, FastPMLocalSortByMinID);
+    fastpm_store_sort(halos, FastPMLocalSortByMinID, NULL);
 
     /* reduce and update properties */
     fastpm_fof_reduce_halo_attrs(finder, halos, add_func, reduce_func);
@@ -741,7 +730,7 @@ fastpm_fof_compute_halo_attrs(FastPMFOFFinder * finder, FastPMStore * halos,
         fastpm_raise(-1, "out of space for gathering halos this shall never happen.\n");
     }
     /* local sort by id (restore the order) */
-    fastpm_store_sort(halos, FastPMLocalSortByID);
+    fastpm_store_sort(halos, FastPMLocalSortByID, NULL);
 
     /* now head[i] is again the halo attribute of particle i. */
 }
@@ -1003,6 +992,8 @@ fastpm_fof_allocate_halos(FastPMStore * halos,
     attributes &= ~COLUMN_POTENTIAL;
     attributes &= ~COLUMN_DENSITY;
     attributes &= ~COLUMN_TIDAL;
+    /* the snapshot has double positions and float displacements */
+    attributes &= ~(COLUMN_POS_FIXED | COLUMN_DX1_FIXED | COLUMN_DX2_FIXED);
 
     /* store initial position only for periodic case. non-periodic suggests light cone and
      * we cannot infer q from ID sensibly. (crashes there) */
@@ -9,58 +9,84 @@
 
 #include "pmpfft.h"
 #include "pmghosts.h"
-
-static void
-apply_pot_transfer(PM * pm, FastPMFloat * from, FastPMFloat * to, int order)
-{
-    fastpm_apply_laplace_transfer(pm, from, to, order);
-    fastpm_apply_multiply_transfer(pm, to, to, -1);
-}
-
+#include "pmhalo.h"
+#include "pmdomain.h"
+
+/* Gradient of a real field along dir with the 4 point central difference.
+ *
+ * The stencil is the same as the k_finite kernel in Fourier space
+ * (gradorder = 1), (8 sin(w) - sin(2w)) / 6, thus the result agrees with
+ * the Fourier space gradient of order 1. The planes along the decomposed directions
+ * are taken from the halo; z is never decomposed.
+ * */
 static void
-apply_grad_transfer(PM * pm, FastPMFloat * from, FastPMFloat * to, int dir, int order)
+apply_fd_gradient(PM * pm, FastPMFloat * from, FastPMFloat * to, int dir)
 {
-    /* no need to print these, since we will check for FFT fields with pm_check_values.*/
-    if(0) {
-        PMKIter kiter;
-        pm_kiter_init(pm, &kiter);
-        float ** klist[2] = {kiter.k, kiter.k_finite};
-        int i;
-        for(i = 0; i < pm_nmesh(pm)[dir]; i ++) {
-            double k_finite = klist[order][dir][i];
-            fastpm_info("fourier space kernel[%d] = %g\n", i, k_finite);
+    const double c1 = 8.0 / 12.0 * pm->InvCellSize[dir];
+    const double c2 = - 1.0 / 12.0 * pm->InvCellSize[dir];
+    ptrdiff_t * size = pm->IRegion.size;
+    ptrdiff_t * strides = pm->IRegion.strides;
+    ptrdiff_t Nz = pm->Nmesh[2];
+
+    if(dir == 2) {
+        ptrdiff_t ij;
+#pragma omp parallel for
+        for(ij = 0; ij < size[0] * size[1]; ij ++) {
+            ptrdiff_t offset = (ij / size[1]) * strides[0] + (ij % size[1]) * strides[1];
+            FastPMFloat * f = from + offset;
+            FastPMFloat * g = to + offset;
+            ptrdiff_t k;
+            for(k = 0; k < Nz; k ++) {
+                ptrdiff_t kp1 = k + 1 >= Nz ? k + 1 - Nz : k + 1;
+                ptrdiff_t kp2 = k + 2 >= Nz ? k + 2 - Nz : k + 2;
+                ptrdiff_t km1 = k - 1 < 0 ? k - 1 + Nz : k - 1;
+                ptrdiff_t km2 = k - 2 < 0 ? k - 2 + Nz : k - 2;
+                g[k] = c1 * (f[kp1] - f[km1]) + c2 * (f[kp2] - f[km2]);
+            }
         }
+        return;
     }
-#pragma omp parallel
-    {
-        PMKIter kiter;
-        ptrdiff_t * Nmesh = pm_nmesh(pm);
-        float ** klist[2] = {kiter.k, kiter.k_finite};
-        pm_kiter_init(pm, &kiter);
-        for(;
-            !pm_kiter_stop(&kiter);
-            pm_kiter_next(&kiter)) {
-            double k_finite;
-            k_finite = klist[order][dir][kiter.iabs[dir]];
-            ptrdiff_t ind = kiter.ind;
-            /* i k[d] */
-            /* Watch out the data dependency */
-            if(
-                kiter.iabs[0] == (Nmesh[0] - kiter.iabs[0]) % Nmesh[0] &&
-                kiter.iabs[1] == (Nmesh[1] - kiter.iabs[1]) % Nmesh[1] &&
-                kiter.iabs[2] == (Nmesh[2] - kiter.iabs[2]) % Nmesh[2]
-            ) {
-                /* We are at the nyquist and the diff operator shall be zero;
-                 * otherwise the force is not real! */
-                to[kiter.ind + 0] = 0;
-                to[kiter.ind + 1] = 0;
+
+    size_t planesize = pm_halo_plane_size(pm, dir);
+    FastPMFloat * halo = fastpm_memory_alloc(pm->mem, "FDHalo", sizeof(FastPMFloat) * planesize * 4, FASTPM_MEMORY_STACK);
+
+    pm_halo_fetch_planes(pm, from, dir, 2, halo);
+
+    ptrdiff_t n = size[dir];
+    ptrdiff_t nrows = size[1 - dir];
+    ptrdiff_t i;
+#pragma omp parallel for
+    for(i = 0; i < n; i ++) {
+        FastPMFloat * f[5];
+        ptrdiff_t s[5];
+        int o;
+        for(o = 0; o < 5; o ++) {
+            ptrdiff_t ii = i + o - 2;
+            if(ii < 0) {
+                f[o] = halo + (ii + 2) * planesize;
+                s[o] = Nz;
+            } else if(ii >= n) {
+                f[o] = halo + (2 + ii - n) * planesize;
+                s[o] = Nz;
             } else {
-                FastPMFloat tmp = from[ind + 0] * (k_finite);
-                to[ind + 0] = - from[ind + 1] * (k_finite);
-                to[ind + 1] = tmp;
+                f[o] = from + ii * strides[dir];
+                s[o] = strides[1 - dir];
+            }
+        }
+        FastPMFloat * g = to + i * strides[dir];
+        ptrdiff_t a, k;
+        for(a = 0; a < nrows; a ++) {
+            FastPMFloat * gr = g + a * strides[1 - dir];
+            FastPMFloat * fm2 = f[0] + a * s[0];
+            FastPMFloat * fm1 = f[1] + a * s[1];
+            FastPMFloat * fp1 = f[3] + a * s[3];
+            FastPMFloat * fp2 = f[4] + a * s[4];
+            for(k = 0; k < Nz; k ++) {
+                gr[k] = c1 * (fp1[k] - fm1[k]) + c2 * (fp2[k] - fm2[k]);
             }
         }
     }
+    fastpm_memory_free(pm->mem, halo);
 }
 
 static void
@@ -165,66 +191,41 @@ gravity_apply_kernel_transfer(FastPMKernelType type,
     int potorder, gradorder, deconvolveorder;
     fastpm_kernel_type_get_orders(type, &potorder, &gradorder, &deconvolveorder);
 
-    while(deconvolveorder > 0) {
-        fastpm_apply_decic_transfer(pm, canvas, canvas);
-        deconvolveorder--;
-    }
-    int d1, d2;
+    /* The deconvolution used to be applied to canvas right before canvas
+     * was overwritten by the potential, thus it never had an effect;
+     * we keep the forces unchanged and do not add it to the transfer. */
+
+    static const int TIDAL_D1[] = {0, 1, 2, 0, 1, 2};
+    static const int TIDAL_D2[] = {0, 1, 2, 1, 2, 0};
+
+    FastPMFusedTransfer tr[1];
+    fastpm_fused_transfer_init(tr, pm);
 
     switch(field.attribute) {
         case COLUMN_POTENTIAL:
-            apply_pot_transfer(pm, delta_k, canvas, potorder);
+            fastpm_fused_transfer_add_laplace(tr, potorder);
+            fastpm_fused_transfer_add_multiply(tr, -1);
             break;
         case COLUMN_DENSITY:
-            fastpm_apply_multiply_transfer(pm, delta_k, canvas, 1.0);
             break;
         case COLUMN_TIDAL:
-            switch(field.memb) {
-                case 0:
-                    d1 = 0; d2 = 0;
-                    apply_pot_transfer(pm, delta_k, canvas, potorder);
-                    apply_grad_transfer(pm, canvas, canvas, d1, gradorder);
-                    apply_grad_transfer(pm, canvas, canvas, d2, gradorder);
-                    break;
-                case 1:
-                    d1 = 1; d2 = 1;
-                    apply_pot_transfer(pm, delta_k, canvas, potorder);
-                    apply_grad_transfer(pm, canvas, canvas, d1, gradorder);
-                    apply_grad_transfer(pm, canvas, canvas, d2, gradorder);
-                    break;
-                case 2:
-                    d1 = 2; d2 = 2;
-                    apply_pot_transfer(pm, delta_k, canvas, potorder);
-                    apply_grad_transfer(pm, canvas, canvas, d1, gradorder);
-                    apply_grad_transfer(pm, canvas, canvas, d2, gradorder);
-                    break;
-                case 3:
-                    d1 = 0; d2 = 1;
-                    apply_pot_transfer(pm, delta_k, canvas, potorder);
-                    apply_grad_transfer(pm, canvas, canvas, d1, gradorder);
-                    apply_grad_transfer(pm, canvas, canvas, d2, gradorder);
-                    break;
-                case 4:
-                    d1 = 1; d2 = 2;
-                    apply_pot_transfer(pm, delta_k, canvas, potorder);
-                    apply_grad_transfer(pm, canvas, canvas, d1, gradorder);
-                    apply_grad_transfer(pm, canvas, canvas, d2, gradorder);
-                    break;
-                case 5:
-                    d1 = 2; d2 = 0;
-                    apply_pot_transfer(pm, delta_k, canvas, potorder);
-                    apply_grad_transfer(pm, canvas, canvas, d1, gradorder);
-                    apply_grad_transfer(pm, canvas, canvas, d2, gradorder);
-                    break;
-            }
+            fastpm_fused_transfer_add_laplace(tr, potorder);
+            fastpm_fused_transfer_add_multiply(tr, -1);
+            fastpm_fused_transfer_add_grad(tr, TIDAL_D1[field.memb], gradorder);
+            fastpm_fused_transfer_add_grad(tr, TIDAL_D2[field.memb], gradorder);
             break;
         case COLUMN_ACC:
-            apply_pot_transfer(pm, delta_k, canvas, potorder);
-            apply_grad_transfer(pm, canvas, canvas, field.memb, gradorder);
+            fastpm_fused_transfer_add_laplace(tr, potorder);
+            fastpm_fused_transfer_add_multiply(tr, -1);
+            fastpm_fused_transfer_add_grad(tr, field.memb, gradorder);
             break;
         default:
             fastpm_raise(-1, "Unknown type for gravity attribute\n");
     }
+
+    /* one pass over the complex mesh */
+    fastpm_fused_transfer_apply(tr, delta_k, canvas);
+    fastpm_fused_transfer_destroy(tr);
 }
 static void
 apply_softening_transfer(FastPMSofteningType type, PM * pm, FastPMFloat * from, FastPMFloat * to)
@@ -255,18 +256,31 @@ apply_softening_transfer(FastPMSofteningType type, PM * pm, FastPMFloat * from,
     }
 }
 
+/* the particle domains for pm, if the mesh cells are exchanged instead of particle ghosts:
+ * balanced domains, or the regions of the PM mesh with mesh_halo. */
+static PMDomain *
+_fastpm_solver_get_domain(FastPMSolver * fastpm, PM * pm)
+{
+    if(fastpm->domain && fastpm->domain->pm == pm) return fastpm->domain;
+    return NULL;
+}
+
 void
 _fastpm_solver_create_ghosts(FastPMSolver * fastpm, PM * pm, int support, PMGhostData * pgd[6])
 {
 
     CLOCK(ghosts);
 
+    /* with domains the mesh cells are exchanged instead of the particles */
+    PMDomain * domain = _fastpm_solver_get_domain(fastpm, pm);
+
     int si;
     for(si = 0; si < FASTPM_SOLVER_NSPECIES; si++) {
         FastPMStore * p = fastpm_solver_get_species(fastpm, si);
-        if(!p) continue;
+        pgd[si] = NULL;
+        if(!p || domain) continue;
         pgd[si] = pm_ghosts_create(pm, p, p->attributes, support);
-        pm_ghosts_send(pgd[si], COLUMN_POS);
+        pm_ghosts_send(pgd[si], fastpm_store_get_position_attribute(p));
         pm_ghosts_send(pgd[si], COLUMN_ID);
         if(p->mass)
             pm_ghosts_send(pgd[si], COLUMN_MASS);
@@ -280,7 +294,7 @@ _fastpm_solver_destroy_ghosts(FastPMSolver * fastpm, PMGhostData * pgd[6])
     int si;
     for(si = FASTPM_SOLVER_NSPECIES - 1; si >= 0; si--) {
         FastPMStore * p = fastpm_solver_get_species(fastpm, si);
-        if(!p) continue;
+        if(!p || !pgd[si]) continue;
         pm_ghosts_free(pgd[si]);
     }
 
@@ -304,6 +318,15 @@ _fastpm_solver_compute_delta_k(FastPMSolver * fastpm, PM * pm, FastPMPainter * p
      * with gravity constants into 1.5 OmegaM,
      * */
     CLOCK(paint);
+    CLOCK(exchange);
+
+    PMDomain * domain = _fastpm_solver_get_domain(fastpm, pm);
+    FastPMPainter boxpainter[1];
+    FastPMFloat * box = NULL;
+    if(domain) {
+        pm_domain_painter(domain, painter, boxpainter);
+        box = pm_domain_alloc(domain);
+    }
 
     int si;
     for(si = 0; si < FASTPM_SOLVER_NSPECIES; si++) {
@@ -311,7 +334,6 @@ _fastpm_solver_compute_delta_k(FastPMSolver * fastpm, PM * pm, FastPMPainter * p
         if(!p) continue;
 
         VALGRIND_CHECK_MEM_IS_DEFINED(p->x, sizeof(p->x[0]) * p->np);
-        VALGRIND_CHECK_MEM_IS_DEFINED(pgd[si]->p->x, sizeof(pgd[si]->p->x[0]) * pgd[si]->p->np);
 
         double total_mass1 = 0;
         ptrdiff_t i;
@@ -319,11 +341,23 @@ _fastpm_solver_compute_delta_k(FastPMSolver * fastpm, PM * pm, FastPMPainter * p
             total_mass1 += fastpm_store_get_mass(p, i);
         }
         total_mass += total_mass1;
-        fastpm_paint_local(painter, canvas, p, p->np, FASTPM_FIELD_DESCR_NONE);
-        fastpm_paint_local(painter, canvas, pgd[si]->p, pgd[si]->p->np, FASTPM_FIELD_DESCR_NONE);
+        if(domain) {
+            fastpm_paint_local(boxpainter, box, p, p->np, FASTPM_FIELD_DESCR_NONE);
+        } else {
+            VALGRIND_CHECK_MEM_IS_DEFINED(pgd[si]->p->x, sizeof(pgd[si]->p->x[0]) * pgd[si]->p->np);
+            fastpm_paint_local(painter, canvas, p, p->np, FASTPM_FIELD_DESCR_NONE);
+            fastpm_paint_local(painter, canvas, pgd[si]->p, pgd[si]->p->np, FASTPM_FIELD_DESCR_NONE);
+        }
     }
     LEAVE(paint);
 
+    if(domain) {
+        ENTER(exchange);
+        pm_domain_reduce(domain, box, canvas);
+        pm_domain_free(domain, box);
+        LEAVE(exchange);
+    }
+
     MPI_Allreduce(MPI_IN_PLACE, &total_mass, 1, MPI_DOUBLE, MPI_SUM, fastpm->comm);
     double mean_mass_per_cell = total_mass / pm->Norm;
 
@@ -341,8 +375,44 @@ _fastpm_solver_compute_delta_k(FastPMSolver * fastpm, PM * pm, FastPMPainter * p
 
 }
 
-void
-_fastpm_solver_compute_force(FastPMSolver * fastpm,
+static void
+_fastpm_solver_readout(FastPMSolver * fastpm,
+    FastPMPainter * reader,
+    PMGhostData * pgd[6],
+    FastPMFloat * canvas,
+    FastPMFieldDescr field)
+{
+    PMDomain * domain = _fastpm_solver_get_domain(fastpm, reader->pm);
+    if(domain) {
+        FastPMPainter boxreader[1];
+        pm_domain_painter(domain, reader, boxreader);
+        FastPMFloat * box = pm_domain_alloc(domain);
+        pm_domain_gather(domain, canvas, box);
+
+        int si;
+        for(si = 0; si < FASTPM_SOLVER_NSPECIES; si ++) {
+            FastPMStore * p = fastpm_solver_get_species(fastpm, si);
+            if(!p) continue;
+            fastpm_readout_local(boxreader, box, p, p->np, field);
+        }
+        pm_domain_free(domain, box);
+        return;
+    }
+
+    int si;
+    for(si = 0; si < FASTPM_SOLVER_NSPECIES; si ++) {
+        FastPMStore * p = fastpm_solver_get_species(fastpm, si);
+        if(!p) continue;
+        fastpm_readout_local(reader, canvas, p, p->np, field);
+        fastpm_readout_local(reader, canvas, pgd[si]->p, pgd[si]->p->np, field);
+    }
+}
+
+/* Compute the force from the potential in real space:
+ * one c2r of the potential, then a finite difference gradient per direction.
+ * */
+static void
+_fastpm_solver_compute_force_fd(FastPMSolver * fastpm,
     PM * pm,
     FastPMPainter * reader,
     FastPMKernelType kernel,
@@ -351,34 +421,119 @@ _fastpm_solver_compute_force(FastPMSolver * fastpm,
     FastPMFloat * delta_k, FastPMFieldDescr * ACC, int nacc)
 {
     int d;
+    int potorder, gradorder, deconvolveorder;
+    fastpm_kernel_type_get_orders(kernel, &potorder, &gradorder, &deconvolveorder);
+    if(gradorder != 1) {
+        fastpm_info("Finite difference gradient replaces the gradient of order %d in the force kernel.\n", gradorder);
+    }
 
     CLOCK(transfer);
     CLOCK(c2r);
+    CLOCK(fdgradient);
     CLOCK(readout);
-    CLOCK(reduce);
 
-    for(d = 0; d < nacc; d ++) {
+    FastPMFieldDescr POTENTIAL = {COLUMN_POTENTIAL, 0};
 
-        ENTER(transfer);
-        gravity_apply_kernel_transfer(kernel, pm, delta_k, canvas, ACC[d]);
-        LEAVE(transfer);
+    ENTER(transfer);
+    gravity_apply_kernel_transfer(kernel, pm, delta_k, canvas, POTENTIAL);
+    LEAVE(transfer);
 
-        ENTER(c2r);
-        pm_check_values(pm, canvas, "Before c2r %d", d);
-        pm_c2r(pm, canvas);
-        pm_check_values(pm, canvas, "After c2r %d", d);
-        LEAVE(c2r);
+    ENTER(c2r);
+    pm_check_values(pm, canvas, "Before c2r potential");
+    pm_c2r(pm, canvas);
+    pm_check_values(pm, canvas, "After c2r potential");
+    LEAVE(c2r);
 
-        ENTER(readout);
-        int si;
-        for(si = 0; si < FASTPM_SOLVER_NSPECIES; si ++) {
-            FastPMStore * p = fastpm_solver_get_species(fastpm, si);
-            if(!p) continue;
-            fastpm_readout_local(reader, canvas, p, p->np, ACC[d]);
-            fastpm_readout_local(reader, canvas, pgd[si]->p, pgd[si]->p->np, ACC[d]);
+    FastPMFloat * grad = pm_alloc(pm);
+
+    for(d = 0; d < nacc; d ++) {
+        FastPMFloat * field = canvas;
+        if(ACC[d].attribute == COLUMN_ACC) {
+            ENTER(fdgradient);
+            apply_fd_gradient(pm, canvas, grad, ACC[d].memb);
+            LEAVE(fdgradient);
+            field = grad;
+        } else if(ACC[d].attribute != COLUMN_POTENTIAL) {
+            fastpm_raise(-1, "Finite difference force does not support this attribute\n");
         }
+
+        ENTER(readout);
+        _fastpm_solver_readout(fastpm, reader, pgd, field, ACC[d]);
         LEAVE(readout);
+    }
 
+    pm_free(pm, grad);
+}
+
+void
+_fastpm_solver_compute_force(FastPMSolver * fastpm,
+    PM * pm,
+    FastPMPainter * reader,
+    FastPMKernelType kernel,
+    PMGhostData * pgd[6],
+    FastPMFloat * canvas,
+    FastPMFloat * delta_k, FastPMFieldDescr * ACC, int nacc)
+{
+    int d;
+
+    CLOCK(reduce);
+
+    if(fastpm->config->FD_GRADIENT) {
+        _fastpm_solver_compute_force_fd(fastpm, pm, reader, kernel, pgd, canvas, delta_k, ACC, nacc);
+    } else if(pm->init.batch && nacc > 1) {
+        CLOCK(transfer);
+        CLOCK(c2r);
+        CLOCK(readout);
+
+        /* all fields of a batch share the transposes of one c2r */
+        int d0;
+        for(d0 = 0; d0 < nacc; d0 += PM_MAX_BATCH) {
+            int nbatch = nacc - d0;
+            if(nbatch > PM_MAX_BATCH) nbatch = PM_MAX_BATCH;
+
+            FastPMFloat * batch = pm_batch_alloc(pm, nbatch);
+
+            ENTER(transfer);
+            for(d = 0; d < nbatch; d ++) {
+                gravity_apply_kernel_transfer(kernel, pm, delta_k, canvas, ACC[d0 + d]);
+                pm_batch_put(pm, batch, nbatch, d, canvas, 1);
+            }
+            LEAVE(transfer);
+
+            ENTER(c2r);
+            pm_c2r_batch(pm, batch, nbatch);
+            LEAVE(c2r);
+
+            for(d = 0; d < nbatch; d ++) {
+                ENTER(readout);
+                pm_batch_take(pm, batch, nbatch, d, canvas, 0);
+                pm_check_values(pm, canvas, "After c2r %d", d0 + d);
+                _fastpm_solver_readout(fastpm, reader, pgd, canvas, ACC[d0 + d]);
+                LEAVE(readout);
+            }
+            pm_batch_free(pm, batch);
+        }
+    } else {
+        CLOCK(transfer);
+        CLOCK(c2r);
+        CLOCK(readout);
+
+        for(d = 0; d < nacc; d ++) {
+
+            ENTER(transfer);
+            gravity_apply_kernel_transfer(kernel, pm, delta_k, canvas, ACC[d]);
+            LEAVE(transfer);
+
+            ENTER(c2r);
+            pm_check_values(pm, canvas, "Before c2r %d", d);
+            pm_c2r(pm, canvas);
+            pm_check_values(pm, canvas, "After c2r %d", d);
+            LEAVE(c2r);
+
+            ENTER(readout);
+            _fastpm_solver_readout(fastpm, reader, pgd, canvas, ACC[d]);
+            LEAVE(readout);
+        }
     }
 
     int si;
@@ -391,6 +546,9 @@ _fastpm_solver_compute_force(FastPMSolver * fastpm,
             fastpm_info("p%s    acc[%d]: %g %g %g %g\n",
                 p->name, d, acc_min[d], acc_std[d], acc_mean[d], acc_max[d]);
         }
+        /* no ghosts with balanced domains; the read out is already complete */
+        if(!pgd[si]) continue;
+
         fastpm_store_summary(pgd[si]->p, COLUMN_ACC, pm_comm(pm), "<s->", acc_min, acc_std, acc_mean, acc_max);
         for(d = 0; d < 3; d ++) {
             fastpm_info("ghost acc[%d]: %g %g %g %g\n",
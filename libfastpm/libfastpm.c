@@ -6,6 +6,10 @@
 
 void fastpm_utils_init_randtable();
 FastPMMemory GMEM;
+static size_t EXCHANGE_BUDGET = 0;
+static int NODE_AWARE_EXCHANGE = 0;
+static int RANKS_PER_NODE = 0;
+static FastPMFFTPlanning FFT_PLANNING = FASTPM_FFT_ESTIMATE;
 
 void libfastpm_init()
 {
@@ -32,3 +36,62 @@ FastPMMemory * _libfastpm_get_gmem()
 {
     return &GMEM;
 }
+
+/* bytes of buffer for moving particles between ranks; 0 for no limit. */
+void libfastpm_set_exchange_budget(size_t size)
+{
+    EXCHANGE_BUDGET = size;
+}
+
+size_t _libfastpm_get_exchange_budget()
+{
+    return EXCHANGE_BUDGET;
+}
+
+/* route the sparse all to all exchanges through one leader rank per shared memory node. */
+void libfastpm_set_node_aware_exchange(int on)
+{
+    NODE_AWARE_EXCHANGE = on;
+}
+
+int _libfastpm_get_node_aware_exchange()
+{
+    return NODE_AWARE_EXCHANGE;
+}
+
+/* group the consecutive ranks into nodes of this size instead of by shared memory; 0 for shared memory. */
+void libfastpm_set_ranks_per_node(int n)
+{
+    RANKS_PER_NODE = n;
+}
+
+int _libfastpm_get_ranks_per_node()
+{
+    return RANKS_PER_NODE;
+}
+
+/* planning effort of the FFT plans made after this call. */
+void libfastpm_set_fft_planning(FastPMFFTPlanning planning)
+{
+    FFT_PLANNING = planning;
+}
+
+FastPMFFTPlanning _libfastpm_get_fft_planning()
+{
+    return FFT_PLANNING;
+}
+
+/* FFT plans made after the import reuse the measurements in the file, if the mesh size,
+ * the process mesh and the precision match those of the run that exported it.
+ * Returns 0 if the file cannot be read. Collective. */
+int libfastpm_import_fft_wisdom(const char * filename, MPI_Comm comm)
+{
+    return pm_module_import_wisdom(filename, comm);
+}
+
+/* write the measurements of the FFT plans made so far, including the imported ones.
+ * Returns 0 if the file cannot be written. Collective. */
+int libfastpm_export_fft_wisdom(const char * filename, MPI_Comm comm)
+{
+    return pm_module_export_wisdom(filename, comm);
+}
@@ -106,9 +106,13 @@ struct funct_params {
     double tileshift[4];
     double a1;
     double a2;
-    void * context;
 };
 
+/* The distance to the horizon of particle i at a.
+ *
+ * Evaluated one particle at a time: the secant steps land on a different a for
+ * every particle, so only the two bracket ends share their drift factors. Evaluating
+ * a whole tile per step, vectorised over the particles, is left for later. */
 static double
 funct(double a, void *params)
 {
@@ -126,9 +130,7 @@ funct(double a, void *params)
     if(p->v) {
         fastpm_drift_one(drift, p, i, xi, a);
     } else {
-        for(d = 0; d < 3; d ++) {
-            xi[d] = p->x[i][d];
-        }
+        fastpm_store_get_position(p, i, xi);
     }
     for(d = 0; d < 4; d ++) {
         xi[d] += Fp->tileshift[d];
@@ -168,7 +170,6 @@ _fastpm_usmesh_intersect_one(FastPMUSMesh * mesh,
     params->i = i;
 
     return fastpm_horizon_solve(mesh->lc->horizon,
-        params->context,
         solution,
         params->a1, params->a2,
         funct, params);
@@ -384,10 +385,11 @@ fastpm_usmesh_intersect_tile(FastPMUSMesh * mesh, double * tileshift,
     params.tileshift[3] = 0;
 
     ptrdiff_t i;
+    ptrdiff_t np0 = pout->np;
 
+again:
     #pragma omp parallel firstprivate(params)
     {
-        params.context = fastpm_horizon_solve_start();
         #pragma omp for
         for(i = 0; i < p->np; i ++) {
             double a_emit = 0;
@@ -406,9 +408,7 @@ fastpm_usmesh_intersect_tile(FastPMUSMesh * mesh, double * tileshift,
                 /* can we drift? if we are using a fixed grid there is no v. */
                 fastpm_drift_one(drift, p, i, xi, a_emit);
             } else {
-                for(d = 0; d < 3; d ++) {
-                    xi[d] = p->x[i][d];
-                }
+                fastpm_store_get_position(p, i, xi);
             }
             for(d = 0; d < 4; d ++) {
                 xi[d] += params.tileshift[d];
@@ -472,10 +472,18 @@ fastpm_usmesh_intersect_tile(FastPMUSMesh * mesh, double * tileshift,
                 }
             }
         }
-        fastpm_horizon_solve_end(params.context);
     }
 
-    if(pout->np >= pout->np_upper) {
+    if(pout->np > pout->np_upper) {
+        /* all particles of the tile were counted; grow and redo the tile.
+         * np == np_upper means everything fit and needs no retry. */
+        size_t wanted = pout->np;
+        size_t newsize = wanted + wanted / 8;
+        if(newsize <= pout->np_upper) newsize = pout->np_upper + 1;
+        if(0 == fastpm_store_grow(pout, newsize)) {
+            pout->np = np0;
+            goto again;
+        }
         fastpm_raise(-1, "Too many particles in the light cone; limit = %td, wanted = %td\n", pout->np_upper, pout->np);
     }
     return 0;
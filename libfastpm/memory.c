@@ -12,6 +12,7 @@ struct MemoryBlock {
     void * p;
     size_t size;
     MemoryBlock * prev; /* pointer to previous block */
+    int retired; /* moved away; released when it reaches the top of the pool */
     char tag[128]; /* tag */
 };
 
@@ -143,7 +144,7 @@ fastpm_memory_dump_status_str(FastPMMemory * m, char * buffer, int n)
     int pool;
     for(pool = 0; pool < FASTPM_MEMORY_MAX; pool++) {
         for(entry = m->pools[pool]; entry != &head; entry = entry->prev) {
-            snprintf(buf, n, "%c 0x%016tx : %010td : %s\n", P[pool], (ptrdiff_t) entry->p, entry->size, entry->tag);
+            snprintf(buf, n, "%c 0x%016tx : %010td : %s%s\n", P[pool], (ptrdiff_t) entry->p, entry->size, entry->tag, entry->retired ? " (retired)" : "");
             buf += strlen(buf);
             n -= strlen(buf);
             if(n < 0) break;
@@ -161,7 +162,7 @@ fastpm_memory_dump_status(FastPMMemory * m, int fd)
     int pool;
     for(pool = 0; pool < FASTPM_MEMORY_MAX; pool++) {
         for(entry = m->pools[pool]; entry != &head; entry = entry->prev) {
-            sprintf(buf, "%c 0x%016tx : %010td : %s\n", P[pool], (ptrdiff_t) entry->p, entry->size, entry->tag);
+            sprintf(buf, "%c 0x%016tx : %010td : %s%s\n", P[pool], (ptrdiff_t) entry->p, entry->size, entry->tag, entry->retired ? " (retired)" : "");
             write(fd, buf, strlen(buf));
         }
     }
@@ -193,6 +194,7 @@ fastpm_memory_alloc0(FastPMMemory * m, size_t s, enum FastPMMemoryLocation pool)
             m->peakfunc(m, m->userdata);
     }
     MemoryBlock * entry = _sys_malloc(m, sizeof(head));
+    entry->retired = 0;
 
     int loc = pool;
     if(m->base0 == NULL) { /* allocate from floating but account in the requested loc */
@@ -256,6 +258,31 @@ MemoryBlock * _delist(MemoryBlock ** start, void * p, int * isfirst)
 }
 
 
+static void
+_release(FastPMMemory * m, int pool, MemoryBlock * entry)
+{
+    int loc = pool;
+    /* unbacked */
+    if(m->base0 == NULL) {
+        loc = FASTPM_MEMORY_FLOATING;
+    }
+    switch(loc) {
+        case FASTPM_MEMORY_STACK:
+            m->top += entry->size;
+        break;
+        case FASTPM_MEMORY_HEAP:
+            m->base -= entry->size;
+        break;
+        case FASTPM_MEMORY_FLOATING:
+            free(entry->p);
+        break;
+    }
+    m->used_bytes -= entry->size;
+    m->free_bytes += entry->size;
+
+    free(entry);
+}
+
 void
 fastpm_memory_free(FastPMMemory * m, void * p)
 {
@@ -268,30 +295,125 @@ fastpm_memory_free(FastPMMemory * m, void * p)
             if(pool != FASTPM_MEMORY_FLOATING && !isfirst) {
                 _sys_abort(m);
             }
-            int loc = pool;
-            /* unbacked */
-            if(m->base0 == NULL) {
-                loc = FASTPM_MEMORY_FLOATING;
-            }
-            switch(loc) {
-                case FASTPM_MEMORY_STACK:
-                    m->top += entry->size;
-                break;
-                case FASTPM_MEMORY_HEAP:
-                    m->base -= entry->size;
-                break;
-                case FASTPM_MEMORY_FLOATING:
-                    free(entry->p);
-                break;
+            _release(m, pool, entry);
+
+            /* the retired blocks now on the top go too */
+            while(m->pools[pool] != &head && m->pools[pool]->retired) {
+                entry = m->pools[pool];
+                m->pools[pool] = entry->prev;
+                _release(m, pool, entry);
             }
-            goto exit;
+            return;
         }
     }
-exit:
+    /* not found, die */
+    _sys_abort(m);
+}
+
+/* Bytes that resizing the block p to s bytes takes from the free bytes.
+ *
+ * A block resized in place only takes the difference; a buried block is
+ * copied to the floating pool and takes all of s.
+ * */
+size_t
+fastpm_memory_realloc_cost(FastPMMemory * m, void * p, size_t s)
+{
+    MemoryBlock * entry = NULL;
+    int pool;
+    for(pool = 0; pool < FASTPM_MEMORY_MAX; pool++) {
+        for(entry = m->pools[pool]; entry != &head; entry = entry->prev) {
+            if(entry->p == p) break;
+        }
+        if(entry != &head) break;
+    }
+    if(pool == FASTPM_MEMORY_MAX) {
+        /* not found, die */
+        _sys_abort(m);
+    }
+    s = _align(s, m->alignment);
+
+    int inplace = entry == m->pools[pool] || pool == FASTPM_MEMORY_FLOATING || m->base0 == NULL;
+    if(!inplace) return s;
+    return s > entry->size ? s - entry->size : 0;
+}
+
+/* Resize a block, keeping the content.
+ *
+ * A block on the top of the heap or the stack is resized in place, and
+ * floating blocks are reallocated. Any other block moves to the floating pool;
+ * the old block is retired and its space is released once all blocks above it
+ * are freed, such that the heap and the stack stay in order.
+ * */
+void *
+fastpm_memory_realloc_details(FastPMMemory * m, const char * name,
+        void * p, size_t s, const char * file, const int line)
+{
+    MemoryBlock * entry = NULL;
+    int pool;
+    for(pool = 0; pool < FASTPM_MEMORY_MAX; pool++) {
+        for(entry = m->pools[pool]; entry != &head; entry = entry->prev) {
+            if(entry->p == p) break;
+        }
+        if(entry != &head) break;
+    }
+    if(pool == FASTPM_MEMORY_MAX) {
+        /* not found, die */
+        _sys_abort(m);
+    }
+
+    int isfirst = entry == m->pools[pool];
+    int loc = pool;
+    /* unbacked */
+    if(m->base0 == NULL) {
+        loc = FASTPM_MEMORY_FLOATING;
+    }
+
+    s = _align(s, m->alignment);
+
+    if(loc != FASTPM_MEMORY_FLOATING && !isfirst) {
+        void * r = fastpm_memory_alloc_details(m, name, s, FASTPM_MEMORY_FLOATING, file, line);
+        memcpy(r, entry->p, s < entry->size ? s : entry->size);
+        entry->retired = 1;
+        return r;
+    }
+
+    if(s > entry->size && m->free_bytes <= s - entry->size) {
+        _sys_abort(m);
+    }
+
+    switch(loc) {
+        case FASTPM_MEMORY_HEAP:
+            m->base += s;
+            m->base -= entry->size;
+        break;
+        case FASTPM_MEMORY_STACK:
+            m->top += entry->size;
+            m->top -= s;
+            memmove(m->top, entry->p, s < entry->size ? s : entry->size);
+            entry->p = m->top;
+        break;
+        case FASTPM_MEMORY_FLOATING:
+            entry->p = realloc(entry->p, s);
+            if(entry->p == NULL) {
+                _sys_abort(m);
+            }
+        break;
+    }
+
+    m->used_bytes += s;
     m->used_bytes -= entry->size;
     m->free_bytes += entry->size;
+    m->free_bytes -= s;
+    entry->size = s;
 
-    free(entry);
+    if(m->used_bytes > m->peak_bytes) {
+        m->peak_bytes = m->used_bytes;
+        if(m->peakfunc)
+            m->peakfunc(m, m->userdata);
+    }
 
-    return;
+    char buf[80];
+    sprintf(buf, "%20s: %20s:%d", name, file, line);
+    strncpy(entry->tag, buf, 120);
+    return entry->p;
 }
@@ -11,18 +11,27 @@ cic_readout_tuned(FastPMPainter * painter, FastPMFloat * canvas, double pos[3],
 static void
 cic_paint_tuned(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir);
 
+static void
+cic_paint_tuned_exclusive(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir);
+
 void
 fastpm_painter_init_cic(FastPMPainter * painter) {
     painter->readout = cic_readout_tuned;
     painter->paint = cic_paint_tuned;
+    painter->paint_exclusive = cic_paint_tuned_exclusive;
 }
 
 
 static inline double WRtPlus(FastPMFloat * const d, 
-        const int i, const int j, const int k, const double f, PM * pm)
+        const int i, const int j, const int k, const double f, PM * pm, const int atomic)
 {
+    ptrdiff_t ind = k * pm->IRegion.strides[2] + j * pm->IRegion.strides[1] + i * pm->IRegion.strides[0];
+    if(atomic) {
 #pragma omp atomic
-    d[k * pm->IRegion.strides[2] + j * pm->IRegion.strides[1] + i * pm->IRegion.strides[0]] += f;
+        d[ind] += f;
+    } else {
+        d[ind] += f;
+    }
     return f;
 }
 static inline double REd(FastPMFloat const * const d, const int i, const int j, const int k, const double w, PM * pm)
@@ -30,8 +39,8 @@ static inline double REd(FastPMFloat const * const d, const int i, const int j,
     return d[k * pm->IRegion.strides[2] + j * pm->IRegion.strides[1] + i * pm->IRegion.strides[0]] * w;
 }
 
-static void
-cic_paint_tuned(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir)
+static inline void
+cic_paint_tuned_any(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir, const int atomic)
 {
     PM * pm = painter->pm;
     int d;
@@ -60,7 +69,14 @@ cic_paint_tuned(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], do
     }
 
 
-    // Do periodic wrapup in all directions. 
+    /* start[2] == 0 */
+    for(d = 0; d < 2; d ++) {
+        IJK[d] -= pm->IRegion.start[d];
+        IJK1[d] -= pm->IRegion.start[d];
+    }
+
+    // Do periodic wrapup in all directions, relative to the start of the region,
+    // such that a region across the periodic boundary also works.
     // Buffer particles are copied from adjacent nodes
     for(d = 0; d < 3; d ++) {
         while(UNLIKELY(IJK[d] < 0)) IJK[d] += pm->Nmesh[d];
@@ -69,46 +85,52 @@ cic_paint_tuned(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], do
         while(UNLIKELY(IJK1[d] >= pm->Nmesh[d])) IJK1[d] -= pm->Nmesh[d];
     }
 
-    /* start[2] == 0 */
-    for(d = 0; d < 2; d ++) {
-        IJK[d] -= pm->IRegion.start[d];
-        IJK1[d] -= pm->IRegion.start[d];
-    }
-
     D[1] *= weight;
     T[1] *= weight;
 
     if(LIKELY(0 <= IJK[0] && IJK[0] < pm->IRegion.size[0])) {
         if(LIKELY(0 <= IJK[1] && IJK[1] < pm->IRegion.size[1])) {
             if(LIKELY(0 <= IJK[2] && IJK[2] < pm->IRegion.size[2]))
-                WRtPlus(canvas, IJK[0], IJK[1],  IJK[2],  T[2]*T[0]*T[1], pm);
+                WRtPlus(canvas, IJK[0], IJK[1],  IJK[2],  T[2]*T[0]*T[1], pm, atomic);
             if(LIKELY(0 <= IJK1[2] && IJK1[2] < pm->IRegion.size[2]))
-                WRtPlus(canvas, IJK[0], IJK[1],  IJK1[2], D[2]*T[0]*T[1], pm);
+                WRtPlus(canvas, IJK[0], IJK[1],  IJK1[2], D[2]*T[0]*T[1], pm, atomic);
         }
         if(LIKELY(0 <= IJK1[1] && IJK1[1] < pm->IRegion.size[1])) {
             if(LIKELY(0 <= IJK[2] && IJK[2] < pm->IRegion.size[2]))
-                WRtPlus(canvas, IJK[0], IJK1[1], IJK[2],  T[2]*T[0]*D[1], pm);
+                WRtPlus(canvas, IJK[0], IJK1[1], IJK[2],  T[2]*T[0]*D[1], pm, atomic);
             if(LIKELY(0 <= IJK1[2] && IJK1[2] < pm->IRegion.size[2]))
-                WRtPlus(canvas, IJK[0], IJK1[1], IJK1[2], D[2]*T[0]*D[1], pm);
+                WRtPlus(canvas, IJK[0], IJK1[1], IJK1[2], D[2]*T[0]*D[1], pm, atomic);
         }
     }
 
     if(LIKELY(0 <= IJK1[0] && IJK1[0] < pm->IRegion.size[0])) {
         if(LIKELY(0 <= IJK[1] && IJK[1] < pm->IRegion.size[1])) {
             if(LIKELY(0 <= IJK[2] && IJK[2] < pm->IRegion.size[2]))
-                WRtPlus(canvas, IJK1[0], IJK[1],  IJK[2],  T[2]*D[0]*T[1], pm);
+                WRtPlus(canvas, IJK1[0], IJK[1],  IJK[2],  T[2]*D[0]*T[1], pm, atomic);
             if(LIKELY(0 <= IJK1[2] && IJK1[2] < pm->IRegion.size[2]))
-                WRtPlus(canvas, IJK1[0], IJK[1],  IJK1[2], D[2]*D[0]*T[1], pm);
+                WRtPlus(canvas, IJK1[0], IJK[1],  IJK1[2], D[2]*D[0]*T[1], pm, atomic);
         }
         if(LIKELY(0 <= IJK1[1] && IJK1[1] < pm->IRegion.size[1])) {
             if(LIKELY(0 <= IJK[2] && IJK[2] < pm->IRegion.size[2]))
-                WRtPlus(canvas, IJK1[0], IJK1[1], IJK[2],  T[2]*D[0]*D[1], pm);
+                WRtPlus(canvas, IJK1[0], IJK1[1], IJK[2],  T[2]*D[0]*D[1], pm, atomic);
             if(LIKELY(0 <= IJK1[2] && IJK1[2] < pm->IRegion.size[2]))
-                WRtPlus(canvas, IJK1[0], IJK1[1], IJK1[2], D[2]*D[0]*D[1], pm);
+                WRtPlus(canvas, IJK1[0], IJK1[1], IJK1[2], D[2]*D[0]*D[1], pm, atomic);
         }
     }
 }
 
+static void
+cic_paint_tuned(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir)
+{
+    cic_paint_tuned_any(painter, canvas, pos, weight, diffdir, 1);
+}
+
+static void
+cic_paint_tuned_exclusive(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir)
+{
+    cic_paint_tuned_any(painter, canvas, pos, weight, diffdir, 0);
+}
+
 static double
 cic_readout_tuned(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], int diffdir)
 {
@@ -140,7 +162,14 @@ cic_readout_tuned(FastPMPainter * painter, FastPMFloat * canvas, double pos[3],
     }
 
 
-    // Do periodic wrapup in all directions. 
+    /* start[2] == 0 */
+    for(d = 0; d < 2; d ++) {
+        IJK[d] -= pm->IRegion.start[d];
+        IJK1[d] -= pm->IRegion.start[d];
+    }
+
+    // Do periodic wrapup in all directions, relative to the start of the region,
+    // such that a region across the periodic boundary also works.
     // Buffer particles are copied from adjacent nodes
     for(d = 0; d < 3; d ++) {
         while(UNLIKELY(IJK[d] < 0)) IJK[d] += pm->Nmesh[d];
@@ -149,12 +178,6 @@ cic_readout_tuned(FastPMPainter * painter, FastPMFloat * canvas, double pos[3],
         while(UNLIKELY(IJK1[d] >= pm->Nmesh[d])) IJK1[d] -= pm->Nmesh[d];
     }
 
-    /* start[2] == 0 */
-    for(d = 0; d < 2; d ++) {
-        IJK[d] -= pm->IRegion.start[d];
-        IJK1[d] -= pm->IRegion.start[d];
-    }
-
     double value = 0;
 
     if(LIKELY(0 <= IJK[0] && IJK[0] < pm->IRegion.size[0])) {
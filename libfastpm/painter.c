@@ -6,11 +6,17 @@
 #include "pmpfft.h"
 #include "pmghosts.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 /* from cic.c */
 void fastpm_painter_init_cic(FastPMPainter * painter);
 
 static void
 _generic_paint(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir);
+static void
+_generic_paint_exclusive(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir);
 static double
 _generic_readout(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], int diffdir);
 
@@ -130,7 +136,9 @@ fastpm_painter_init(FastPMPainter * painter, PM * pm,
 {
     painter->pm = pm;
     painter->paint = _generic_paint;
+    painter->paint_exclusive = _generic_paint_exclusive;
     painter->readout = _generic_readout;
+    painter->use_atomic = 0;
 
     switch(type) {
         case FASTPM_PAINTER_CIC:
@@ -213,8 +221,8 @@ _fill_k(FastPMPainter * painter, double pos[3], int ipos[3], double k[3][64], in
     }
 }
 
-static void
-_generic_paint(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir)
+static inline void
+_generic_paint_any(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir, const int atomic)
 {
     PM * pm = painter->pm;
     int ipos[3];
@@ -245,8 +253,12 @@ _generic_paint(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], dou
                 goto outside;
             ind += pm->IRegion.strides[d] * targetpos;
         }
+        if(atomic) {
 #pragma omp atomic
-        canvas[ind] += weight * kernel;
+            canvas[ind] += weight * kernel;
+        } else {
+            canvas[ind] += weight * kernel;
+        }
 
     outside:
         rel[2] ++;
@@ -263,6 +275,18 @@ _generic_paint(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], dou
     return;
 }
 
+static void
+_generic_paint(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir)
+{
+    _generic_paint_any(painter, canvas, pos, weight, diffdir, 1);
+}
+
+static void
+_generic_paint_exclusive(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], double weight, int diffdir)
+{
+    _generic_paint_any(painter, canvas, pos, weight, diffdir, 0);
+}
+
 static double
 _generic_readout(FastPMPainter * painter, FastPMFloat * canvas, double pos[3], int diffdir)
 {
@@ -316,6 +340,149 @@ outside:
     return value;
 }
 
+static double
+_get_weight(FastPMStore * p, ptrdiff_t i, int ci, FastPMFieldDescr field)
+{
+    if (!field.attribute) {
+        return fastpm_store_get_mass(p, i);
+    } else {
+        return fastpm_store_get_mass(p, i) * p->_column_info[ci].to_double(p, i, ci, field.memb);
+    }
+}
+
+/* The first local x-plane touched by the kernel of a particle.
+ * Returns -1 if the kernel touches no local planes, and
+ * -2 if the touched planes are not contiguous, which happens when
+ * the kernel wraps around the periodic boundary inside the local region.
+ * */
+static int
+_first_plane(FastPMPainter * painter, double pos[3])
+{
+    PM * pm = painter->pm;
+    int x0 = floor(pos[0] * pm->InvCellSize[0] + painter->shift) - painter->left - pm->IRegion.start[0];
+    int first = -1;
+    int last = -1;
+    int n = 0;
+    int r;
+    for(r = 0; r < painter->support; r ++) {
+        int targetpos = x0 + r;
+        while(targetpos >= pm->Nmesh[0]) {
+            targetpos -= pm->Nmesh[0];
+        }
+        while(targetpos < 0) {
+            targetpos += pm->Nmesh[0];
+        }
+        if(targetpos >= pm->IRegion.size[0]) continue;
+        if(first < 0 || targetpos < first) first = targetpos;
+        if(targetpos > last) last = targetpos;
+        n ++;
+    }
+    if(n == 0) return -1;
+    if(last - first + 1 != n) return -2;
+    return first;
+}
+
+/* Paint without atomics by colouring the particles.
+ *
+ * The local x-planes are cut into slabs that are at least as thick as the
+ * kernel support, such that a particle binned to the slab of its first plane
+ * only touches this slab and the next one. Even slabs are then painted in
+ * parallel, followed by odd slabs, each slab by a single thread.
+ * Particles that wrap around the periodic boundary are painted last.
+ * */
+static void
+_paint_local_coloured(FastPMPainter * painter, FastPMFloat * canvas,
+    FastPMStore * p, size_t size, int ci, FastPMFieldDescr field, int Nthreads)
+{
+    PM * pm = painter->pm;
+
+    int width = pm->IRegion.size[0] / (4 * Nthreads);
+    if(width < painter->support) width = painter->support;
+
+    int nslabs = (pm->IRegion.size[0] + width - 1) / width;
+
+    /* the two extra bins are for wrapped and untouched particles */
+    int nbins = nslabs + 2;
+    int * bin = fastpm_memory_alloc(pm->mem, "PaintBin", sizeof(bin[0]) * size, FASTPM_MEMORY_STACK);
+    ptrdiff_t * index = fastpm_memory_alloc(pm->mem, "PaintIndex", sizeof(index[0]) * size, FASTPM_MEMORY_STACK);
+    /* number of particles per thread per bin; later the offset to write to */
+    size_t * Ncount = calloc((size_t) Nthreads * nbins, sizeof(size_t));
+    size_t * Obin = calloc(nbins + 1, sizeof(size_t));
+
+#pragma omp parallel
+    {
+#ifdef _OPENMP
+        int nth = omp_get_num_threads();
+        int ith = omp_get_thread_num();
+#else
+        int nth = 1;
+        int ith = 0;
+#endif
+        size_t * count = &Ncount[(size_t) ith * nbins];
+        ptrdiff_t start = ith * size / nth;
+        ptrdiff_t end = (ith + 1) * size / nth;
+        ptrdiff_t i;
+        for(i = start; i < end; i ++) {
+            double pos[3];
+            fastpm_store_get_position(p, i, pos);
+            int first = _first_plane(painter, pos);
+            if(first == -1) {
+                bin[i] = nslabs + 1;
+            } else if(first == -2) {
+                bin[i] = nslabs;
+            } else {
+                bin[i] = first / width;
+            }
+            count[bin[i]] ++;
+        }
+#pragma omp barrier
+#pragma omp single
+        {
+            int b, t;
+            for(b = 0; b < nbins; b ++) {
+                size_t offset = Obin[b];
+                for(t = 0; t < nth; t ++) {
+                    size_t n = Ncount[(size_t) t * nbins + b];
+                    Ncount[(size_t) t * nbins + b] = offset;
+                    offset += n;
+                }
+                Obin[b + 1] = offset;
+            }
+        }
+        for(i = start; i < end; i ++) {
+            index[count[bin[i]]++] = i;
+        }
+    }
+
+    int phase;
+    for(phase = 0; phase < 2; phase ++) {
+        int b;
+#pragma omp parallel for schedule(dynamic, 1)
+        for(b = phase; b < nslabs; b += 2) {
+            size_t k;
+            for(k = Obin[b]; k < Obin[b + 1]; k ++) {
+                ptrdiff_t i = index[k];
+                double pos[3];
+                fastpm_store_get_position(p, i, pos);
+                painter->paint_exclusive(painter, canvas, pos, _get_weight(p, i, ci, field), painter->diffdir);
+            }
+        }
+    }
+
+    size_t k;
+    for(k = Obin[nslabs]; k < Obin[nslabs + 1]; k ++) {
+        ptrdiff_t i = index[k];
+        double pos[3];
+        fastpm_store_get_position(p, i, pos);
+        painter->paint_exclusive(painter, canvas, pos, _get_weight(p, i, ci, field), painter->diffdir);
+    }
+
+    free(Obin);
+    free(Ncount);
+    fastpm_memory_free(pm->mem, index);
+    fastpm_memory_free(pm->mem, bin);
+}
+
 void
 fastpm_paint_local(FastPMPainter * painter, FastPMFloat * canvas,
     FastPMStore * p, size_t size,
@@ -324,17 +491,32 @@ fastpm_paint_local(FastPMPainter * painter, FastPMFloat * canvas,
     ptrdiff_t i;
     int ci = fastpm_store_find_column_id(p, field.attribute);
 
+#ifdef _OPENMP
+    int Nthreads = omp_get_max_threads();
+#else
+    int Nthreads = 1;
+#endif
+
+    if(Nthreads == 1) {
+        for (i = 0; i < size; i ++) {
+            double pos[3];
+            fastpm_store_get_position(p, i, pos);
+            painter->paint_exclusive(painter, canvas, pos, _get_weight(p, i, ci, field), painter->diffdir);
+        }
+        return;
+    }
+
+    /* colouring needs at least two slabs of each colour to be useful. */
+    if(!painter->use_atomic && painter->pm->IRegion.size[0] >= 4 * painter->support) {
+        _paint_local_coloured(painter, canvas, p, size, ci, field, Nthreads);
+        return;
+    }
+
 #pragma omp parallel for
     for (i = 0; i < size; i ++) {
         double pos[3];
-        double weight;
-        if (!field.attribute) {
-            weight = fastpm_store_get_mass(p, i);
-        } else {
-            weight = fastpm_store_get_mass(p, i) * p->_column_info[ci].to_double(p, i, ci, field.memb);
-        }
         fastpm_store_get_position(p, i, pos);
-        painter->paint(painter, canvas, pos, weight, painter->diffdir);
+        painter->paint(painter, canvas, pos, _get_weight(p, i, ci, field), painter->diffdir);
     }
 }
 
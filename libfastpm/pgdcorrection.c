@@ -73,7 +73,7 @@ fastpm_pgdc_calculate(FastPMPGDCorrection * pgdc,
 
     CLOCK(ghosts);
     PMGhostData * pgd = pm_ghosts_create(pm, p, p->attributes, reader->support);
-    pm_ghosts_send(pgd, COLUMN_POS);
+    pm_ghosts_send(pgd, fastpm_store_get_position_attribute(p));
     LEAVE(ghosts);
 
     int d;
@@ -28,9 +28,12 @@ pm_2lpt_solve(PM * pm, FastPMFloat * delta_k, FastPMFuncK * growth_rate_func_k,
      * Because we will read out from the (de-)shifted positions.
      * Otherwise the IC will have artifacts along the edges of domains. */
     for(i = 0; i < p->np; i ++) {
+        double pos[3];
+        fastpm_store_get_position(p, i, pos);
         for(d = 0; d < 3; d ++) {
-            p->x[i][d] -= shift[d];
+            pos[d] -= shift[d];
         }
+        fastpm_store_set_position(p, i, pos);
     }
     FastPMPainter painter[1];
     fastpm_painter_init(painter, pm, FASTPM_PAINTER_CIC, 0);
@@ -41,7 +44,7 @@ pm_2lpt_solve(PM * pm, FastPMFloat * delta_k, FastPMFuncK * growth_rate_func_k,
     } else {
         pgd = pm_ghosts_create(pm, p, p->attributes | COLUMN_DX1 | COLUMN_DX2, painter->support);
     }
-    pm_ghosts_send(pgd, COLUMN_POS);
+    pm_ghosts_send(pgd, fastpm_store_get_position_attribute(p));
 
     FastPMFloat * source =  pm_alloc(pm);
     FastPMFloat * workspace = pm_alloc(pm);
@@ -60,39 +63,56 @@ pm_2lpt_solve(PM * pm, FastPMFloat * delta_k, FastPMFuncK * growth_rate_func_k,
     int D1[] = {1, 2, 0};
     int D2[] = {2, 0, 1};
 
+    /* Each group of three fields goes through one pm_c2r_many, which shares the
+     * transposes of the three transforms if the PM is initialized with batch. */
+
     /* 1LPT */
     for(d = 0; d < 3; d++) {
         /* dx1 */
-        fastpm_apply_laplace_transfer(pm, delta_k, workspace, potorder);
-        fastpm_apply_diff_transfer(pm, workspace, workspace, d);
-
-        pm_c2r(pm, workspace);
-
-        fastpm_readout_local(painter, workspace, p, p->np, DX1[d]);
-        fastpm_readout_local(painter, workspace, pgd->p, pgd->p->np, DX1[d]);
-
-        /* dv1 */
-        if (p->dv1) {
-            fastpm_apply_laplace_transfer(pm, delta_k, workspace, potorder);
-            fastpm_apply_diff_transfer(pm, workspace, workspace, d);
+        FastPMFusedTransfer tr[1];
+        fastpm_fused_transfer_init(tr, pm);
+        fastpm_fused_transfer_add_laplace(tr, potorder);
+        fastpm_fused_transfer_add_diff(tr, d);
+        fastpm_fused_transfer_apply(tr, delta_k, field[d]);
+        fastpm_fused_transfer_destroy(tr);
+    }
+    pm_c2r_many(pm, field, 3);
 
-            fastpm_apply_any_transfer(pm, workspace, workspace, (fastpm_fkfunc) fastpm_funck_eval2, growth_rate_func_k);
+    for(d = 0; d < 3; d++) {
+        fastpm_readout_local(painter, field[d], p, p->np, DX1[d]);
+        fastpm_readout_local(painter, field[d], pgd->p, pgd->p->np, DX1[d]);
+    }
 
-            pm_c2r(pm, workspace);
+    /* dv1 */
+    if (p->dv1) {
+        for(d = 0; d < 3; d++) {
+            FastPMFusedTransfer tr[1];
+            fastpm_fused_transfer_init(tr, pm);
+            fastpm_fused_transfer_add_laplace(tr, potorder);
+            fastpm_fused_transfer_add_diff(tr, d);
+            fastpm_fused_transfer_add_any(tr, (fastpm_fkfunc) fastpm_funck_eval2, growth_rate_func_k);
+            fastpm_fused_transfer_apply(tr, delta_k, field[d]);
+            fastpm_fused_transfer_destroy(tr);
+        }
+        pm_c2r_many(pm, field, 3);
 
-            fastpm_readout_local(painter, workspace, p, p->np, DV1[d]);
-            fastpm_readout_local(painter, workspace, pgd->p, pgd->p->np, DV1[d]);
+        for(d = 0; d < 3; d++) {
+            fastpm_readout_local(painter, field[d], p, p->np, DV1[d]);
+            fastpm_readout_local(painter, field[d], pgd->p, pgd->p->np, DV1[d]);
         }
     }
 
     /* 2LPT */
     for(d = 0; d< 3; d++) {
-        fastpm_apply_laplace_transfer(pm, delta_k, field[d], potorder);
-        fastpm_apply_diff_transfer(pm, field[d], field[d], d);
-        fastpm_apply_diff_transfer(pm, field[d], field[d], d);
-
-        pm_c2r(pm, field[d]);
+        FastPMFusedTransfer tr[1];
+        fastpm_fused_transfer_init(tr, pm);
+        fastpm_fused_transfer_add_laplace(tr, potorder);
+        fastpm_fused_transfer_add_diff(tr, d);
+        fastpm_fused_transfer_add_diff(tr, d);
+        fastpm_fused_transfer_apply(tr, delta_k, field[d]);
+        fastpm_fused_transfer_destroy(tr);
     }
+    pm_c2r_many(pm, field, 3);
 
     for(d = 0; d < 3; d++) {
         int d1 = D1[d];
@@ -103,20 +123,27 @@ pm_2lpt_solve(PM * pm, FastPMFloat * delta_k, FastPMFuncK * growth_rate_func_k,
         }
     }
 
+    /* the diagonal terms are consumed; reuse field for the off-diagonal terms */
     for(d = 0; d < 3; d++) {
         int d1 = D1[d];
         int d2 = D2[d];
 
-        fastpm_apply_laplace_transfer(pm, delta_k, workspace, potorder);
-        fastpm_apply_diff_transfer(pm, workspace, workspace, d1);
-        fastpm_apply_diff_transfer(pm, workspace, workspace, d2);
+        FastPMFusedTransfer tr[1];
+        fastpm_fused_transfer_init(tr, pm);
+        fastpm_fused_transfer_add_laplace(tr, potorder);
+        fastpm_fused_transfer_add_diff(tr, d1);
+        fastpm_fused_transfer_add_diff(tr, d2);
+        fastpm_fused_transfer_apply(tr, delta_k, field[d]);
+        fastpm_fused_transfer_destroy(tr);
+    }
+    pm_c2r_many(pm, field, 3);
 
-        pm_c2r(pm, workspace);
+    for(d = 0; d < 3; d++) {
 #pragma omp parallel for
         for(i = 0; i < pm->IRegion.total; i ++) {
-            source[i] -= workspace[i] * workspace[i];
+            source[i] -= field[d][i] * field[d][i];
         }
-    } 
+    }
     pm_r2c(pm, source, workspace);
     pm_assign(pm, workspace, source);
 
@@ -125,16 +152,20 @@ pm_2lpt_solve(PM * pm, FastPMFloat * delta_k, FastPMFuncK * growth_rate_func_k,
          * We absorb some the negative factor in za transfer to below;
          *
          * */
-        fastpm_apply_laplace_transfer(pm, source, workspace, potorder);
-        fastpm_apply_diff_transfer(pm, workspace, workspace, d);
-
-        pm_c2r(pm, workspace);
-
+        FastPMFusedTransfer tr[1];
+        fastpm_fused_transfer_init(tr, pm);
+        fastpm_fused_transfer_add_laplace(tr, potorder);
+        fastpm_fused_transfer_add_diff(tr, d);
         /* this ensures x = x0 + dx1(t) + dx2(t) */
-        fastpm_apply_multiply_transfer(pm, workspace, workspace, 3.0 / 7);
+        fastpm_fused_transfer_add_multiply(tr, 3.0 / 7);
+        fastpm_fused_transfer_apply(tr, source, field[d]);
+        fastpm_fused_transfer_destroy(tr);
+    }
+    pm_c2r_many(pm, field, 3);
 
-        fastpm_readout_local(painter, workspace, p, p->np, DX2[d]);
-        fastpm_readout_local(painter, workspace, pgd->p, pgd->p->np, DX2[d]);
+    for(d = 0; d < 3; d++) {
+        fastpm_readout_local(painter, field[d], p, p->np, DX2[d]);
+        fastpm_readout_local(painter, field[d], pgd->p, pgd->p->np, DX2[d]);
     }
 
     pm_ghosts_reduce(pgd, COLUMN_DX1, FastPMReduceAddFloat, NULL);
@@ -147,9 +178,12 @@ pm_2lpt_solve(PM * pm, FastPMFloat * delta_k, FastPMFuncK * growth_rate_func_k,
 #endif
 
     for(i = 0; i < p->np; i ++) {
+        double pos[3];
+        fastpm_store_get_position(p, i, pos);
         for(d = 0; d < 3; d ++) {
-            p->x[i][d] += shift[d];
+            pos[d] += shift[d];
         }
+        fastpm_store_set_position(p, i, pos);
     }
 
     for(d = 0; d < 3; d ++) {
@@ -191,9 +225,11 @@ pm_2lpt_evolve(double aout, FastPMStore * p, FastPMCosmology * c, int zaonly)
     int i;
 #pragma omp parallel for
     for(i=0; i<np; i++) {
+        double pos[3];
+        fastpm_store_get_position(p, i, pos);
         int d;
         for(d = 0; d < 3; d ++) {
-            p->x[i][d] += D1 * p->dx1[i][d] + D2 * p->dx2[i][d];
+            pos[d] += D1 * p->dx1[i][d] + D2 * p->dx2[i][d];
 
             if(p->v) {
                 p->v[i][d] += p->dx2[i][d]*Dv2;
@@ -204,6 +240,7 @@ pm_2lpt_evolve(double aout, FastPMStore * p, FastPMCosmology * c, int zaonly)
                 }
             }
         }
+        fastpm_store_set_position(p, i, pos);
     }
     p->meta.a_x = p->meta.a_v = aout;
 }
@@ -0,0 +1,468 @@
+#include <string.h>
+#include <math.h>
+#include <mpi.h>
+
+#include <fastpm/libfastpm.h>
+#include <fastpm/logging.h>
+#include "pmpfft.h"
+#include "pmdomain.h"
+
+static ptrdiff_t
+_wrap(ptrdiff_t i, ptrdiff_t n)
+{
+    while(i < 0) i += n;
+    while(i >= n) i -= n;
+    return i;
+}
+
+static void
+_pos_to_cell(PM * pm, double pos[3], ptrdiff_t cell[2])
+{
+    int d;
+    for(d = 0; d < 2; d ++) {
+        cell[d] = _wrap(floor(pos[d] * pm->InvCellSize[d]), pm->Nmesh[d]);
+    }
+}
+
+/* split n planes into nparts, each with about the same number of particles */
+static void
+_balance_edges(int64_t * hist, ptrdiff_t n, int nparts, ptrdiff_t * edges)
+{
+    int64_t total = 0;
+    ptrdiff_t i;
+    int j;
+    for(i = 0; i < n; i ++) {
+        total += hist[i];
+    }
+    edges[0] = 0;
+    edges[nparts] = n;
+    if(total == 0) {
+        for(j = 1; j < nparts; j ++) {
+            edges[j] = j * n / nparts;
+        }
+        return;
+    }
+    int64_t cum = 0;
+    i = 0;
+    for(j = 1; j < nparts; j ++) {
+        while(i < n && cum * nparts < total * j) {
+            cum += hist[i];
+            i ++;
+        }
+        edges[j] = i;
+    }
+}
+
+/* the box of a domain, including the margin; empty if the domain is empty. */
+static void
+_domain_box(PMDomain * dom, int rank, ptrdiff_t start[2], ptrdiff_t size[2])
+{
+    PM * pm = dom->pm;
+    int ix = rank / pm->Nproc[1];
+    int iy = rank % pm->Nproc[1];
+    ptrdiff_t * ey = dom->edges[1] + ix * (pm->Nproc[1] + 1);
+    ptrdiff_t lo[2] = {dom->edges[0][ix], ey[iy]};
+    ptrdiff_t hi[2] = {dom->edges[0][ix + 1], ey[iy + 1]};
+    int empty = hi[0] == lo[0] || hi[1] == lo[1];
+    int d;
+    for(d = 0; d < 2; d ++) {
+        start[d] = lo[d] - dom->margin;
+        size[d] = hi[d] - lo[d] + 2 * dom->margin;
+        if(size[d] >= pm->Nmesh[d]) {
+            start[d] = 0;
+            size[d] = pm->Nmesh[d];
+        }
+        if(empty) size[d] = 0;
+    }
+}
+
+static void
+_build_plan(PMDomain * dom)
+{
+    PM * pm = dom->pm;
+    int NTask = pm->NTask;
+    int cx = pm->ThisTask / pm->Nproc[1];
+    int cy = pm->ThisTask % pm->Nproc[1];
+
+    dom->Nsend = calloc(NTask, sizeof(int));
+    dom->Osend = calloc(NTask, sizeof(int));
+    dom->Nrecv = calloc(NTask, sizeof(int));
+    dom->Orecv = calloc(NTask, sizeof(int));
+
+    ptrdiff_t start[2], size[2];
+    ptrdiff_t a, b;
+
+    /* rows of the local box, to the PM ranks */
+    _domain_box(dom, pm->ThisTask, start, size);
+    int * dest = malloc(sizeof(int) * (size[0] * size[1] + 1));
+    for(a = 0; a < size[0]; a ++) {
+        int rx = pm->Grid.MeshtoCart[0][_wrap(start[0] + a, pm->Nmesh[0])];
+        for(b = 0; b < size[1]; b ++) {
+            int ry = pm->Grid.MeshtoCart[1][_wrap(start[1] + b, pm->Nmesh[1])];
+            dest[a * size[1] + b] = rx * pm->Nproc[1] + ry;
+            dom->Nsend[rx * pm->Nproc[1] + ry] ++;
+        }
+    }
+    size_t Nsendtotal = cumsum(dom->Osend, dom->Nsend, NTask);
+    dom->send_rows = malloc(sizeof(ptrdiff_t) * (Nsendtotal + 1));
+
+    memset(dom->Nsend, 0, sizeof(int) * NTask);
+    for(a = 0; a < size[0] * size[1]; a ++) {
+        int r = dest[a];
+        dom->send_rows[dom->Osend[r] + dom->Nsend[r]] = a * pm->Nmesh[2];
+        dom->Nsend[r] ++;
+    }
+    free(dest);
+
+    /* rows of the PM mesh, from the boxes of all ranks, in the order they are sent */
+    int s;
+    for(s = 0; s < NTask; s ++) {
+        _domain_box(dom, s, start, size);
+        for(a = 0; a < size[0]; a ++) {
+            ptrdiff_t gx = _wrap(start[0] + a, pm->Nmesh[0]);
+            if(pm->Grid.MeshtoCart[0][gx] != cx) continue;
+            for(b = 0; b < size[1]; b ++) {
+                ptrdiff_t gy = _wrap(start[1] + b, pm->Nmesh[1]);
+                if(pm->Grid.MeshtoCart[1][gy] != cy) continue;
+                dom->Nrecv[s] ++;
+            }
+        }
+    }
+    size_t Nrecvtotal = cumsum(dom->Orecv, dom->Nrecv, NTask);
+    dom->recv_rows = malloc(sizeof(ptrdiff_t) * (Nrecvtotal + 1));
+
+    ptrdiff_t irecv = 0;
+    for(s = 0; s < NTask; s ++) {
+        _domain_box(dom, s, start, size);
+        for(a = 0; a < size[0]; a ++) {
+            ptrdiff_t gx = _wrap(start[0] + a, pm->Nmesh[0]);
+            if(pm->Grid.MeshtoCart[0][gx] != cx) continue;
+            for(b = 0; b < size[1]; b ++) {
+                ptrdiff_t gy = _wrap(start[1] + b, pm->Nmesh[1]);
+                if(pm->Grid.MeshtoCart[1][gy] != cy) continue;
+                dom->recv_rows[irecv++] =
+                      (gx - pm->IRegion.start[0]) * pm->IRegion.strides[0]
+                    + (gy - pm->IRegion.start[1]) * pm->IRegion.strides[1];
+            }
+        }
+    }
+}
+
+/* the painters work on the box of the local domain; then the plan to move the boxes */
+static void
+_setup_box(PMDomain * dom)
+{
+    PM * pm = dom->pm;
+    ptrdiff_t start[2], size[2];
+    _domain_box(dom, pm->ThisTask, start, size);
+
+    dom->local = *pm;
+    dom->local.IRegion.start[0] = start[0];
+    dom->local.IRegion.start[1] = start[1];
+    dom->local.IRegion.start[2] = 0;
+    dom->local.IRegion.size[0] = size[0];
+    dom->local.IRegion.size[1] = size[1];
+    dom->local.IRegion.size[2] = pm->Nmesh[2];
+    dom->local.IRegion.strides[2] = 1;
+    dom->local.IRegion.strides[1] = pm->Nmesh[2];
+    dom->local.IRegion.strides[0] = size[1] * pm->Nmesh[2];
+    dom->local.IRegion.total = size[0] * size[1] * pm->Nmesh[2];
+
+    _build_plan(dom);
+}
+
+void
+pm_domain_init(PMDomain * dom, PM * pm, FastPMStore * stores[], int nstores, int margin)
+{
+    dom->pm = pm;
+    dom->margin = margin;
+
+    int Nx = pm->Nproc[0];
+    int Ny = pm->Nproc[1];
+
+    dom->edges[0] = malloc(sizeof(ptrdiff_t) * (Nx + 1));
+    dom->edges[1] = malloc(sizeof(ptrdiff_t) * Nx * (Ny + 1));
+    dom->MeshtoDomain[0] = malloc(sizeof(int) * pm->Nmesh[0]);
+    dom->MeshtoDomain[1] = malloc(sizeof(int) * Nx * pm->Nmesh[1]);
+
+    int64_t * histx = calloc(pm->Nmesh[0], sizeof(int64_t));
+    int64_t * histy = calloc(Nx * pm->Nmesh[1], sizeof(int64_t));
+
+    int s;
+    ptrdiff_t i;
+    ptrdiff_t cell[2];
+    double pos[3];
+
+    for(s = 0; s < nstores; s ++) {
+        FastPMStore * p = stores[s];
+        for(i = 0; i < p->np; i ++) {
+            fastpm_store_get_position(p, i, pos);
+            _pos_to_cell(pm, pos, cell);
+            histx[cell[0]] ++;
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, histx, pm->Nmesh[0], MPI_LONG, MPI_SUM, pm->Comm2D);
+    _balance_edges(histx, pm->Nmesh[0], Nx, dom->edges[0]);
+
+    int j;
+    for(j = 0; j < Nx; j ++) {
+        for(i = dom->edges[0][j]; i < dom->edges[0][j + 1]; i ++) {
+            dom->MeshtoDomain[0][i] = j;
+        }
+    }
+
+    for(s = 0; s < nstores; s ++) {
+        FastPMStore * p = stores[s];
+        for(i = 0; i < p->np; i ++) {
+            fastpm_store_get_position(p, i, pos);
+            _pos_to_cell(pm, pos, cell);
+            histy[dom->MeshtoDomain[0][cell[0]] * pm->Nmesh[1] + cell[1]] ++;
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, histy, Nx * pm->Nmesh[1], MPI_LONG, MPI_SUM, pm->Comm2D);
+
+    for(j = 0; j < Nx; j ++) {
+        ptrdiff_t * ey = dom->edges[1] + j * (Ny + 1);
+        int * m = dom->MeshtoDomain[1] + j * pm->Nmesh[1];
+        _balance_edges(histy + j * pm->Nmesh[1], pm->Nmesh[1], Ny, ey);
+        int k;
+        for(k = 0; k < Ny; k ++) {
+            for(i = ey[k]; i < ey[k + 1]; i ++) {
+                m[i] = k;
+            }
+        }
+    }
+    free(histy);
+    free(histx);
+
+    _setup_box(dom);
+}
+
+void
+pm_domain_init_mesh(PMDomain * dom, PM * pm, int margin)
+{
+    dom->pm = pm;
+    dom->margin = margin;
+
+    int Nx = pm->Nproc[0];
+    int Ny = pm->Nproc[1];
+
+    dom->edges[0] = malloc(sizeof(ptrdiff_t) * (Nx + 1));
+    dom->edges[1] = malloc(sizeof(ptrdiff_t) * Nx * (Ny + 1));
+    dom->MeshtoDomain[0] = malloc(sizeof(int) * pm->Nmesh[0]);
+    dom->MeshtoDomain[1] = malloc(sizeof(int) * Nx * pm->Nmesh[1]);
+
+    memcpy(dom->edges[0], pm->Grid.edges_int[0], sizeof(ptrdiff_t) * (Nx + 1));
+    memcpy(dom->MeshtoDomain[0], pm->Grid.MeshtoCart[0], sizeof(int) * pm->Nmesh[0]);
+    int j;
+    for(j = 0; j < Nx; j ++) {
+        memcpy(dom->edges[1] + j * (Ny + 1), pm->Grid.edges_int[1], sizeof(ptrdiff_t) * (Ny + 1));
+        memcpy(dom->MeshtoDomain[1] + j * pm->Nmesh[1], pm->Grid.MeshtoCart[1], sizeof(int) * pm->Nmesh[1]);
+    }
+
+    _setup_box(dom);
+}
+
+void
+pm_domain_destroy(PMDomain * dom)
+{
+    free(dom->recv_rows);
+    free(dom->send_rows);
+    free(dom->Orecv);
+    free(dom->Nrecv);
+    free(dom->Osend);
+    free(dom->Nsend);
+    free(dom->MeshtoDomain[1]);
+    free(dom->MeshtoDomain[0]);
+    free(dom->edges[1]);
+    free(dom->edges[0]);
+}
+
+int
+pm_domain_pos_to_rank(PMDomain * dom, double pos[3])
+{
+    PM * pm = dom->pm;
+    ptrdiff_t cell[2];
+    _pos_to_cell(pm, pos, cell);
+    int ix = dom->MeshtoDomain[0][cell[0]];
+    int iy = dom->MeshtoDomain[1][ix * pm->Nmesh[1] + cell[1]];
+    return ix * pm->Nproc[1] + iy;
+}
+
+int
+FastPMTargetDomain(FastPMStore * p, ptrdiff_t i, PMDomain * dom)
+{
+    double pos[3];
+    fastpm_store_get_position(p, i, pos);
+    return pm_domain_pos_to_rank(dom, pos);
+}
+
+void
+pm_domain_painter(PMDomain * dom, FastPMPainter * painter, FastPMPainter * boxpainter)
+{
+    *boxpainter = *painter;
+    boxpainter->pm = &dom->local;
+}
+
+FastPMFloat *
+pm_domain_alloc(PMDomain * dom)
+{
+    size_t n = dom->local.IRegion.total + 1;
+    FastPMFloat * box = fastpm_memory_alloc(dom->pm->mem, "DomainBox", sizeof(FastPMFloat) * n, FASTPM_MEMORY_HEAP);
+    memset(box, 0, sizeof(FastPMFloat) * n);
+    return box;
+}
+
+void
+pm_domain_free(PMDomain * dom, FastPMFloat * box)
+{
+    fastpm_memory_free(dom->pm->mem, box);
+}
+
+/* The rows this rank sends to itself are moved directly between the box and the
+ * mesh; only the rows of the other ranks are staged and exchanged. N2 and O2 are
+ * the counts and offsets of the staged rows: those of N and O without this rank. */
+static size_t
+_remote_plan(PMDomain * dom, int * N, int * N2, int * O2)
+{
+    PM * pm = dom->pm;
+    memcpy(N2, N, sizeof(int) * pm->NTask);
+    N2[pm->ThisTask] = 0;
+    return cumsum(O2, N2, pm->NTask);
+}
+
+/* the staged position of row i of the plan N, O, or -1 for a row to this rank */
+static inline ptrdiff_t
+_remote_index(PMDomain * dom, int * N, int * O, ptrdiff_t i)
+{
+    int me = dom->pm->ThisTask;
+    if(i < O[me]) return i;
+    if(i < O[me] + N[me]) return -1;
+    return i - N[me];
+}
+
+static void
+_exchange_rows(PMDomain * dom,
+    FastPMFloat * sendbuf, int * Nsend, int * Osend,
+    FastPMFloat * recvbuf, int * Nrecv, int * Orecv)
+{
+    PM * pm = dom->pm;
+    MPI_Datatype ROW_TYPE;
+    MPI_Type_contiguous(pm->Nmesh[2] * sizeof(FastPMFloat), MPI_BYTE, &ROW_TYPE);
+    MPI_Type_commit(&ROW_TYPE);
+    MPI_Alltoallv_sparse(sendbuf, Nsend, Osend, ROW_TYPE,
+                         recvbuf, Nrecv, Orecv, ROW_TYPE, pm->Comm2D);
+    MPI_Type_free(&ROW_TYPE);
+}
+
+void
+pm_domain_reduce(PMDomain * dom, FastPMFloat * box, FastPMFloat * mesh)
+{
+    PM * pm = dom->pm;
+    int me = pm->ThisTask;
+    ptrdiff_t n2 = pm->Nmesh[2];
+    size_t Nsendall = cumsum(NULL, dom->Nsend, pm->NTask);
+
+    int * Nsend = malloc(sizeof(int) * pm->NTask);
+    int * Osend = malloc(sizeof(int) * pm->NTask);
+    int * Nrecv = malloc(sizeof(int) * pm->NTask);
+    int * Orecv = malloc(sizeof(int) * pm->NTask);
+    size_t Nsendtotal = _remote_plan(dom, dom->Nsend, Nsend, Osend);
+    size_t Nrecvtotal = _remote_plan(dom, dom->Nrecv, Nrecv, Orecv);
+
+    FastPMFloat * sendbuf = fastpm_memory_alloc(pm->mem, "DomainSend", sizeof(FastPMFloat) * n2 * Nsendtotal, FASTPM_MEMORY_STACK);
+    FastPMFloat * recvbuf = fastpm_memory_alloc(pm->mem, "DomainRecv", sizeof(FastPMFloat) * n2 * Nrecvtotal, FASTPM_MEMORY_STACK);
+
+    ptrdiff_t i;
+#pragma omp parallel for
+    for(i = 0; i < Nsendall; i ++) {
+        ptrdiff_t j = _remote_index(dom, dom->Nsend, dom->Osend, i);
+        if(j < 0) continue;
+        memcpy(&sendbuf[j * n2], &box[dom->send_rows[i]], sizeof(FastPMFloat) * n2);
+    }
+
+    _exchange_rows(dom, sendbuf, Nsend, Osend, recvbuf, Nrecv, Orecv);
+
+    /* the rows from a rank are distinct, but the margins of the ranks overlap;
+     * the rows of this rank go first, straight from the box. */
+#pragma omp parallel for
+    for(i = 0; i < dom->Nsend[me]; i ++) {
+        FastPMFloat * row = &mesh[dom->recv_rows[dom->Orecv[me] + i]];
+        FastPMFloat * from = &box[dom->send_rows[dom->Osend[me] + i]];
+        ptrdiff_t k;
+        for(k = 0; k < n2; k ++) {
+            row[k] += from[k];
+        }
+    }
+
+    int s;
+    for(s = 0; s < pm->NTask; s ++) {
+#pragma omp parallel for
+        for(i = Orecv[s]; i < Orecv[s] + Nrecv[s]; i ++) {
+            FastPMFloat * row = &mesh[dom->recv_rows[dom->Orecv[s] + i - Orecv[s]]];
+            ptrdiff_t k;
+            for(k = 0; k < n2; k ++) {
+                row[k] += recvbuf[i * n2 + k];
+            }
+        }
+    }
+
+    fastpm_memory_free(pm->mem, recvbuf);
+    fastpm_memory_free(pm->mem, sendbuf);
+
+    free(Orecv);
+    free(Nrecv);
+    free(Osend);
+    free(Nsend);
+}
+
+void
+pm_domain_gather(PMDomain * dom, FastPMFloat * mesh, FastPMFloat * box)
+{
+    PM * pm = dom->pm;
+    int me = pm->ThisTask;
+    ptrdiff_t n2 = pm->Nmesh[2];
+    size_t Nsendall = cumsum(NULL, dom->Nsend, pm->NTask);
+    size_t Nrecvall = cumsum(NULL, dom->Nrecv, pm->NTask);
+
+    int * Nsend = malloc(sizeof(int) * pm->NTask);
+    int * Osend = malloc(sizeof(int) * pm->NTask);
+    int * Nrecv = malloc(sizeof(int) * pm->NTask);
+    int * Orecv = malloc(sizeof(int) * pm->NTask);
+    size_t Nsendtotal = _remote_plan(dom, dom->Nsend, Nsend, Osend);
+    size_t Nrecvtotal = _remote_plan(dom, dom->Nrecv, Nrecv, Orecv);
+
+    /* the reverse of reduce: the PM ranks send the rows they received */
+    FastPMFloat * sendbuf = fastpm_memory_alloc(pm->mem, "DomainSend", sizeof(FastPMFloat) * n2 * Nrecvtotal, FASTPM_MEMORY_STACK);
+    FastPMFloat * recvbuf = fastpm_memory_alloc(pm->mem, "DomainRecv", sizeof(FastPMFloat) * n2 * Nsendtotal, FASTPM_MEMORY_STACK);
+
+    ptrdiff_t i;
+#pragma omp parallel for
+    for(i = 0; i < Nrecvall; i ++) {
+        ptrdiff_t j = _remote_index(dom, dom->Nrecv, dom->Orecv, i);
+        if(j < 0) continue;
+        memcpy(&sendbuf[j * n2], &mesh[dom->recv_rows[i]], sizeof(FastPMFloat) * n2);
+    }
+
+    _exchange_rows(dom, sendbuf, Nrecv, Orecv, recvbuf, Nsend, Osend);
+
+#pragma omp parallel for
+    for(i = 0; i < Nsendall; i ++) {
+        ptrdiff_t j = _remote_index(dom, dom->Nsend, dom->Osend, i);
+        if(j < 0) {
+            /* a row of this rank, straight from the mesh */
+            j = dom->Orecv[me] + i - dom->Osend[me];
+            memcpy(&box[dom->send_rows[i]], &mesh[dom->recv_rows[j]], sizeof(FastPMFloat) * n2);
+        } else {
+            memcpy(&box[dom->send_rows[i]], &recvbuf[j * n2], sizeof(FastPMFloat) * n2);
+        }
+    }
+
+    fastpm_memory_free(pm->mem, recvbuf);
+    fastpm_memory_free(pm->mem, sendbuf);
+
+    free(Orecv);
+    free(Nrecv);
+    free(Osend);
+    free(Nsend);
+}
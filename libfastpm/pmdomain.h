@@ -0,0 +1,68 @@
+/* Particle domains balanced by particle counts, decoupled from the PM mesh.
+ *
+ * The domains are pencils, like the PM mesh; the x edges follow the particle
+ * counts along x, and the y edges of each x slab follow the particle counts
+ * along y in the slab. The edges are on mesh planes, and the domain of rank
+ * ix * Nproc[1] + iy is (ix, iy).
+ *
+ * A rank paints its particles into a domain box, which covers the domain and
+ * a margin of mesh cells; the cells are then moved to the PM mesh in rows
+ * of Nmesh[2] cells. The read out goes the other way. No particle ghosts are
+ * needed.
+ * */
+struct PMDomain {
+    PM * pm;
+    /* a copy of pm with the IRegion of the domain box; for the painters only. */
+    PM local;
+    int margin;
+
+    /* edges in mesh planes; [Nproc[0] + 1] and [Nproc[0]][Nproc[1] + 1] */
+    ptrdiff_t * edges[2];
+    /* domain coordinate of a mesh plane; [Nmesh[0]] and [Nproc[0]][Nmesh[1]] */
+    int * MeshtoDomain[2];
+
+    /* cell exchange plan, in rows of Nmesh[2] cells */
+    int * Nsend;
+    int * Osend;
+    int * Nrecv;
+    int * Orecv;
+    ptrdiff_t * send_rows; /* offset of rows in the domain box, grouped by the PM rank */
+    ptrdiff_t * recv_rows; /* offset of rows in the PM mesh, grouped by the domain rank */
+};
+
+/* stores shall be wrapped into the box. */
+void
+pm_domain_init(PMDomain * dom, PM * pm, FastPMStore * stores[], int nstores, int margin);
+
+/* domains that are the regions of the PM mesh. The particles are decomposed by the
+ * PM mesh as usual, and only the margin cells of the boxes go to the neighbours:
+ * the traffic follows the surface of the regions, not the particles near the edges. */
+void
+pm_domain_init_mesh(PMDomain * dom, PM * pm, int margin);
+
+void
+pm_domain_destroy(PMDomain * dom);
+
+int
+pm_domain_pos_to_rank(PMDomain * dom, double pos[3]);
+
+int
+FastPMTargetDomain(FastPMStore * p, ptrdiff_t i, PMDomain * dom);
+
+/* a painter on the domain box */
+void
+pm_domain_painter(PMDomain * dom, FastPMPainter * painter, FastPMPainter * boxpainter);
+
+FastPMFloat *
+pm_domain_alloc(PMDomain * dom);
+
+void
+pm_domain_free(PMDomain * dom, FastPMFloat * box);
+
+/* add the cells in the domain boxes to the PM mesh */
+void
+pm_domain_reduce(PMDomain * dom, FastPMFloat * box, FastPMFloat * mesh);
+
+/* fill the domain boxes with cells of the PM mesh */
+void
+pm_domain_gather(PMDomain * dom, FastPMFloat * mesh, FastPMFloat * box);
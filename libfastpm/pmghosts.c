@@ -11,7 +11,9 @@
 #include </usr/include/valgrind/memcheck.h>
 #endif
 
-typedef void (*pm_iter_ghosts_func)(PM * pm, PMGhostData * ppd, void * userdata);
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 void pm_ghosts_free(PMGhostData * pgd) {
     if(pgd->p) {
@@ -19,6 +21,7 @@ void pm_ghosts_free(PMGhostData * pgd) {
         free(pgd->p);
     }
 
+    fastpm_memory_free(pgd->pm->mem, pgd->ighost_by_ipar);
     fastpm_memory_free(pgd->pm->mem, pgd->ighost_to_ipar);
 
     free(pgd->Nsend);
@@ -28,82 +31,291 @@ void pm_ghosts_free(PMGhostData * pgd) {
     free(pgd);
 }
 
+/* ghosts found by one thread, in the order of the particles.
+ * The lists grow from several threads at once, thus from the system allocator
+ * rather than the memory pool. */
+typedef struct {
+    ptrdiff_t * ipar;
+    int * rank;
+    size_t n;
+    size_t size;
+} PMGhostList;
+
 static void
-pm_iter_ghosts(PM * pm, PMGhostData * pgd, 
-    pm_iter_ghosts_func iter_func, void * userdata)
+pm_ghost_list_append(PMGhostList * list, ptrdiff_t ipar, int rank)
 {
+    if(UNLIKELY(list->n == list->size)) {
+        list->size = list->size * 2 + 1024;
+        ptrdiff_t * newipar = realloc(list->ipar, sizeof(list->ipar[0]) * list->size);
+        int * newrank = realloc(list->rank, sizeof(list->rank[0]) * list->size);
+        if(newipar == NULL || newrank == NULL) {
+            fastpm_raise(-1, "No memory for a list of %zu ghosts.\n", list->size);
+        }
+        list->ipar = newipar;
+        list->rank = newrank;
+    }
+    list->ipar[list->n] = ipar;
+    list->rank[list->n] = rank;
+    list->n ++;
+}
 
-    ptrdiff_t i;
-    for (i = 0; i < pgd->source->np; i ++) {
-        PMGhostData localppd = *pgd;
-        double pos[3];
-        int rank;
-        fastpm_store_get_position(pgd->source, i, pos);
-        int d;
+/* find the remote ranks that need a ghost of particle i;
+ * returns the number of ranks, stored into ranks. */
+static int
+pm_ghosts_probe(PM * pm, PMGhostData * pgd, ptrdiff_t i, int ranks[], int maxranks)
+{
+    double pos[3];
+    fastpm_store_get_position(pgd->source, i, pos);
+    int d;
 
-        /* how far the window expands. */
-        int left[3];
-        int right[3];
-        for(d = 0; d < 3; d ++) {
-            /* this condition is not tightest for CIC painting, because
-             * a particle touches a cell doesn't mean cic touches the left edge
-             * of the cell.
-             * */
-            left[d] = floor(pos[d] * pm->InvCellSize[d] + pgd->Below[d]);
-            right[d] = floor(pos[d] * pm->InvCellSize[d] + pgd->Above[d]);
-        }
+    /* how far the window expands. */
+    int left[3];
+    int right[3];
+    for(d = 0; d < 3; d ++) {
+        /* this condition is not tightest for CIC painting, because
+         * a particle touches a cell doesn't mean cic touches the left edge
+         * of the cell.
+         * */
+        left[d] = floor(pos[d] * pm->InvCellSize[d] + pgd->Below[d]);
+        right[d] = floor(pos[d] * pm->InvCellSize[d] + pgd->Above[d]);
+    }
 
-        /* probe neighbours */
-        int j[3];
-        int ranks[1000];
-        int used = 0;
-        localppd.ipar = i;
-        /* no need to run the z loop because the decomposition is in xy */
-        for(j[2] = left[2]; j[2] <= right[2]; j[2] ++)
-        for(j[0] = left[0]; j[0] <= right[0]; j[0] ++)
-        for(j[1] = left[1]; j[1] <= right[1]; j[1] ++)
-        {
-            rank = pm_ipos_to_rank(pm, j);
-            if(LIKELY(rank == pm->ThisTask))  continue;
-            int ptr;
-            for(ptr = 0; ptr < used; ptr++) {
-                if(rank == ranks[ptr]) break;
-            } 
-            if(UNLIKELY(ptr == used)) {
-                ranks[used++] = rank;
-                localppd.rank = rank;
-                localppd.reason = j;
-                iter_func(pm, &localppd, userdata);
+    /* probe neighbours */
+    int j[3];
+    int used = 0;
+    /* no need to run the z loop because the decomposition is in xy */
+    for(j[2] = left[2]; j[2] <= right[2]; j[2] ++)
+    for(j[0] = left[0]; j[0] <= right[0]; j[0] ++)
+    for(j[1] = left[1]; j[1] <= right[1]; j[1] ++)
+    {
+        int rank = pm_ipos_to_rank(pm, j);
+        if(LIKELY(rank == pm->ThisTask))  continue;
+        int ptr;
+        for(ptr = 0; ptr < used; ptr++) {
+            if(rank == ranks[ptr]) break;
+        }
+        if(UNLIKELY(ptr == used)) {
+            if(UNLIKELY(used == maxranks)) {
+                fastpm_raise(-1, "Particle %td has ghosts on more than %d ranks.\n", i, maxranks);
             }
+            ranks[used++] = rank;
         }
     }
+    return used;
 }
 
-static void
-count_ghosts(PM * pm, PMGhostData * pgd, void * userdata)
+/* whether the cells [start, end) of an axis of n cells and the cells [lo, hi] meet, periodically. */
+static int
+pm_ghosts_overlap(ptrdiff_t start, ptrdiff_t end, ptrdiff_t lo, ptrdiff_t hi, ptrdiff_t n)
 {
-#pragma omp atomic
-    pgd->Nsend[pgd->rank] ++;
+    if(start >= end) return 0;
+    if(hi - lo + 1 >= n) return 1;
+    ptrdiff_t shift = lo - ((lo % n) + n) % n;
+    lo -= shift;
+    hi -= shift;
+    int k;
+    for(k = -1; k <= 1; k ++) {
+        if(lo + k * n < end && hi + k * n >= start) return 1;
+    }
+    return 0;
+}
+
+/* The ranks that may send ghosts to or receive ghosts from this rank, for a window of cells.
+ *
+ * A rank is a neighbour if its region meets the region of this rank grown by the window,
+ * or the other way around; the relation is symmetric, and the graph serves the ghosts
+ * and their reduction. The graph is built from the edges of the PM mesh without any
+ * communication other than creating the communicator, and is cached on the PM.
+ * */
+static PMGhostGraph *
+pm_ghosts_graph(PM * pm, int window[2][2])
+{
+    int n;
+    for(n = 0; n < PM_MAX_GHOST_GRAPH; n ++) {
+        if(!pm->ghost_graph[n]) break;
+        if(!memcmp(pm->ghost_graph[n]->window, window, sizeof(pm->ghost_graph[n]->window))) {
+            return pm->ghost_graph[n];
+        }
+    }
+    /* out of slots; the exchange goes over all ranks. */
+    if(n == PM_MAX_GHOST_GRAPH) return NULL;
+
+    PMGhostGraph * graph = malloc(sizeof(graph[0]));
+    memcpy(graph->window, window, sizeof(graph->window));
+    graph->ranks = malloc(sizeof(int) * pm->NTask);
+    graph->degree = 0;
+
+    int me[2] = {pm->ThisTask / pm->Nproc[1], pm->ThisTask % pm->Nproc[1]};
+    int r;
+    for(r = 0; r < pm->NTask; r ++) {
+        if(r == pm->ThisTask) continue;
+        int other[2] = {r / pm->Nproc[1], r % pm->Nproc[1]};
+        int to = 1, from = 1;
+        int d;
+        for(d = 0; d < 2; d ++) {
+            ptrdiff_t * edges = pm->Grid.edges_int[d];
+            to = to && pm_ghosts_overlap(edges[other[d]], edges[other[d] + 1],
+                        edges[me[d]] + window[d][0], edges[me[d] + 1] - 1 + window[d][1], pm->Nmesh[d])
+                    && edges[me[d]] < edges[me[d] + 1];
+            from = from && pm_ghosts_overlap(edges[me[d]], edges[me[d] + 1],
+                        edges[other[d]] + window[d][0], edges[other[d] + 1] - 1 + window[d][1], pm->Nmesh[d])
+                    && edges[other[d]] < edges[other[d] + 1];
+        }
+        if(to || from) graph->ranks[graph->degree++] = r;
+    }
+
+    /* unit weights rather than MPI_UNWEIGHTED; the latter is a sentinel
+     * pointer that some MPI headers make the compiler read through. */
+    int * weights = malloc(sizeof(int) * (graph->degree + 1));
+    for(r = 0; r < graph->degree; r ++) weights[r] = 1;
+
+    MPI_Dist_graph_create_adjacent(pm->Comm2D,
+            graph->degree, graph->ranks, weights,
+            graph->degree, graph->ranks, weights,
+            MPI_INFO_NULL, 0, &graph->comm);
+
+    free(weights);
+
+    pm->ghost_graph[n] = graph;
+    return graph;
 }
 
+/* Exchange the ghosts (or their values) with the counts and offsets indexed by rank;
+ * only the neighbours in the graph are visited, if there is a graph. */
 static void
-build_ghost_buffer(PM * pm, PMGhostData * pgd, void * userdata)
+pm_ghosts_exchange(PMGhostData * pgd,
+        void * sendbuf, int * Nsend, int * Osend,
+        void * recvbuf, int * Nrecv, int * Orecv,
+        MPI_Datatype type)
 {
-    FastPMPackingPlan * plan = userdata;
+    PMGhostGraph * graph = pgd->graph;
+    if(!graph) {
+        MPI_Alltoallv_sparse(sendbuf, Nsend, Osend, type,
+                             recvbuf, Nrecv, Orecv, type, pgd->pm->Comm2D);
+        return;
+    }
+    int * counts = malloc(sizeof(int) * (4 * graph->degree + 1));
+    int k;
+    for(k = 0; k < graph->degree; k ++) {
+        int r = graph->ranks[k];
+        counts[k] = Nsend[r];
+        counts[k + graph->degree] = Osend[r];
+        counts[k + 2 * graph->degree] = Nrecv[r];
+        counts[k + 3 * graph->degree] = Orecv[r];
+    }
+    MPI_Neighbor_alltoallv(sendbuf, counts, counts + graph->degree, type,
+                           recvbuf, counts + 2 * graph->degree, counts + 3 * graph->degree, type,
+                           graph->comm);
+    free(counts);
+}
 
+/* Build the ghost plan: Nsend, Osend and ighost_to_ipar.
+ *
+ * The particles are walked only once, in parallel. Each thread records
+ * the (ipar, rank) pairs of its static range of particles; the pairs
+ * are then scattered into the send order (grouped by rank) with per-thread
+ * offsets, such that the ghosts to a rank remain in the order of the particles.
+ *
+ * pm_ghosts_send and pm_ghosts_reduce replay the plan without walking
+ * the particles again.
+ * */
+static size_t
+pm_ghosts_build_plan(PM * pm, PMGhostData * pgd)
+{
+#ifdef _OPENMP
+    int Nthreads = omp_get_max_threads();
+#else
+    int Nthreads = 1;
+#endif
+    PMGhostList * lists = calloc(Nthreads, sizeof(lists[0]));
+    /* number of ghosts per thread per rank; later the offset to write to */
+    int * Ncount = calloc((size_t) Nthreads * pm->NTask, sizeof(int));
+
+    ptrdiff_t np = pgd->source->np;
+
+#pragma omp parallel
+    {
+#ifdef _OPENMP
+        int nth = omp_get_num_threads();
+        int ith = omp_get_thread_num();
+#else
+        int nth = 1;
+        int ith = 0;
+#endif
+        PMGhostList * list = &lists[ith];
+        int * count = &Ncount[(size_t) ith * pm->NTask];
+
+        ptrdiff_t start = ith * np / nth;
+        ptrdiff_t end = (ith + 1) * np / nth;
+        ptrdiff_t i;
+        int ranks[1000];
+        for(i = start; i < end; i ++) {
+            int used = pm_ghosts_probe(pm, pgd, i, ranks, 1000);
+            int k;
+            for(k = 0; k < used; k ++) {
+                pm_ghost_list_append(list, i, ranks[k]);
+                count[ranks[k]] ++;
+            }
+        }
+    }
 
-    int ighost;
-    int offset; 
+    int r, t;
+    for(r = 0; r < pm->NTask; r ++) {
+        pgd->Nsend[r] = 0;
+        for(t = 0; t < Nthreads; t ++) {
+            pgd->Nsend[r] += Ncount[(size_t) t * pm->NTask + r];
+        }
+    }
+
+    size_t Nsend = cumsum(pgd->Osend, pgd->Nsend, pm->NTask);
+
+    /* turn the counts to the offsets of the first ghost of each thread */
+    for(r = 0; r < pm->NTask; r ++) {
+        int offset = pgd->Osend[r];
+        for(t = 0; t < Nthreads; t ++) {
+            int n = Ncount[(size_t) t * pm->NTask + r];
+            Ncount[(size_t) t * pm->NTask + r] = offset;
+            offset += n;
+        }
+    }
 
-#pragma omp atomic capture
-    offset = pgd->Nsend[pgd->rank] ++;
+    pgd->ighost_to_ipar = fastpm_memory_alloc(pm->mem, "Ghost2Par", Nsend * sizeof(ptrdiff_t), FASTPM_MEMORY_HEAP);
+    pgd->ighost_by_ipar = fastpm_memory_alloc(pm->mem, "GhostByPar", Nsend * sizeof(ptrdiff_t), FASTPM_MEMORY_HEAP);
 
-    ighost = pgd->Osend[pgd->rank] + offset;
+    /* the lists of the threads are in the order of the particles */
+    size_t * base = malloc(sizeof(size_t) * (Nthreads + 1));
+    base[0] = 0;
+    for(t = 0; t < Nthreads; t ++) {
+        base[t + 1] = base[t] + lists[t].n;
+    }
 
-    fastpm_packing_plan_pack(plan, pgd->source, pgd->ipar, 
-                (char*) pgd->send_buffer + ighost * plan->elsize);
+#pragma omp parallel for
+    for(t = 0; t < Nthreads; t ++) {
+        PMGhostList * list = &lists[t];
+        int * offset = &Ncount[(size_t) t * pm->NTask];
+        ptrdiff_t * byipar = pgd->ighost_by_ipar + base[t];
+        size_t k;
+        for(k = 0; k < list->n; k ++) {
+            ptrdiff_t ighost = offset[list->rank[k]]++;
+            pgd->ighost_to_ipar[ighost] = list->ipar[k];
+            /* the ghosts of a particle in the send order; there are only a few. */
+            size_t j = k;
+            while(j > 0 && list->ipar[j - 1] == list->ipar[k] && byipar[j - 1] > ighost) {
+                byipar[j] = byipar[j - 1];
+                j --;
+            }
+            byipar[j] = ighost;
+        }
+    }
+    free(base);
 
-    pgd->ighost_to_ipar[ighost] = pgd->ipar;
+    for(t = 0; t < Nthreads; t ++) {
+        free(lists[t].ipar);
+        free(lists[t].rank);
+    }
+    free(lists);
+    free(Ncount);
+    return Nsend;
 }
 
 /* create ghosts that can hold 'attributes';
@@ -149,6 +361,14 @@ pm_ghosts_create_full(PM * pm, FastPMStore * p,
     }
 
     pgd->ighost_to_ipar = NULL;
+    pgd->ighost_by_ipar = NULL;
+
+    int window[2][2];
+    for(d = 0; d < 2; d ++) {
+        window[d][0] = floor(below[d]);
+        window[d][1] = ceil(above[d]);
+    }
+    pgd->graph = pm_ghosts_graph(pm, window);
 
     pgd->Nsend = calloc(pm->NTask, sizeof(int));
     pgd->Osend = calloc(pm->NTask, sizeof(int));
@@ -158,13 +378,35 @@ pm_ghosts_create_full(PM * pm, FastPMStore * p,
     size_t Nsend;
     size_t Nrecv;
 
-    memset(pgd->Nsend, 0, sizeof(pgd->Nsend[0]) * pm->NTask);
+    Nsend = pm_ghosts_build_plan(pm, pgd);
 
-    pm_iter_ghosts(pm, pgd, count_ghosts, NULL);
-
-    Nsend = cumsum(pgd->Osend, pgd->Nsend, pm->NTask);
+    if(pgd->graph) {
+        /* a particle outside of the region of its rank may have ghosts beyond the neighbours. */
+        size_t Nsend_graph = 0;
+        int k;
+        for(k = 0; k < pgd->graph->degree; k ++) {
+            Nsend_graph += pgd->Nsend[pgd->graph->ranks[k]];
+        }
+        if(MPIU_Any(pm->Comm2D, Nsend_graph != Nsend)) {
+            fastpm_info("Ghosts beyond the neighbouring ranks; exchanging with all ranks.\n");
+            pgd->graph = NULL;
+        }
+    }
 
-    MPI_Alltoall(pgd->Nsend, 1, MPI_INT, pgd->Nrecv, 1, MPI_INT, pm->Comm2D);
+    if(pgd->graph) {
+        int * counts = malloc(sizeof(int) * (2 * pgd->graph->degree + 1));
+        int k;
+        for(k = 0; k < pgd->graph->degree; k ++) {
+            counts[k] = pgd->Nsend[pgd->graph->ranks[k]];
+        }
+        MPI_Neighbor_alltoall(counts, 1, MPI_INT, counts + pgd->graph->degree, 1, MPI_INT, pgd->graph->comm);
+        for(k = 0; k < pgd->graph->degree; k ++) {
+            pgd->Nrecv[pgd->graph->ranks[k]] = counts[k + pgd->graph->degree];
+        }
+        free(counts);
+    } else {
+        MPI_Alltoall(pgd->Nsend, 1, MPI_INT, pgd->Nrecv, 1, MPI_INT, pm->Comm2D);
+    }
 
     Nrecv = cumsum(pgd->Orecv, pgd->Nrecv, pm->NTask);
 
@@ -177,8 +419,6 @@ pm_ghosts_create_full(PM * pm, FastPMStore * p,
     fastpm_info("Receiving ghosts: min = %g max = %g mean = %g std = %g\n",
         nmin, nmax, nmean, nstd);
 
-    pgd->ighost_to_ipar = fastpm_memory_alloc(pm->mem, "Ghost2Par", Nsend * sizeof(int), FASTPM_MEMORY_HEAP);
-
     pgd->p = malloc(sizeof(pgd->p[0]));
     fastpm_store_init(pgd->p, pgd->source->name, Nrecv, attributes, FASTPM_MEMORY_HEAP);
     memcpy(&pgd->p->meta, &pgd->source->meta, sizeof(pgd->source->meta));
@@ -204,7 +444,6 @@ void
 pm_ghosts_send(PMGhostData * pgd, FastPMColumnTags attributes)
 {
     PM * pm = pgd->pm;
-    ptrdiff_t i;
     size_t Nsend;
     size_t Nrecv;
 
@@ -217,10 +456,8 @@ pm_ghosts_send(PMGhostData * pgd, FastPMColumnTags attributes)
     pgd->send_buffer = fastpm_memory_alloc(pm->mem, "SendBuf", Nsend * plan->elsize, FASTPM_MEMORY_STACK);
     pgd->recv_buffer = fastpm_memory_alloc(pm->mem, "RecvBuf", Nrecv * plan->elsize, FASTPM_MEMORY_STACK);
 
-    /* build buffer */
-    memset(pgd->Nsend, 0, sizeof(pgd->Nsend[0]) * pm->NTask);
-
-    pm_iter_ghosts(pm, pgd, build_ghost_buffer, plan);
+    /* build buffer by replaying the ghost plan */
+    fastpm_packing_plan_pack_many(plan, pgd->source, pgd->ighost_to_ipar, 0, Nsend, pgd->send_buffer);
 
     /* exchange */
 
@@ -229,25 +466,20 @@ pm_ghosts_send(PMGhostData * pgd, FastPMColumnTags attributes)
     MPI_Datatype GHOST_TYPE;
     MPI_Type_contiguous(plan->elsize, MPI_BYTE, &GHOST_TYPE);
     MPI_Type_commit(&GHOST_TYPE);
-    MPI_Alltoallv_sparse(pgd->send_buffer, pgd->Nsend, pgd->Osend, GHOST_TYPE,
-                  pgd->recv_buffer, pgd->Nrecv, pgd->Orecv, GHOST_TYPE,
-                    pm->Comm2D);
+    pm_ghosts_exchange(pgd, pgd->send_buffer, pgd->Nsend, pgd->Osend,
+                  pgd->recv_buffer, pgd->Nrecv, pgd->Orecv, GHOST_TYPE);
     MPI_Type_free(&GHOST_TYPE);
 
-#pragma omp parallel for
-    for(i = 0; i < Nrecv; i ++) {
-        fastpm_packing_plan_unpack(plan,
-                pgd->p, i,
-                (char*) pgd->recv_buffer + i * plan->elsize);
-    }
+    fastpm_packing_plan_unpack_many(plan, pgd->p, 0, Nrecv, pgd->recv_buffer);
     fastpm_memory_free(pm->mem, pgd->recv_buffer);
     fastpm_memory_free(pm->mem, pgd->send_buffer);
 }
 
-void
-pm_ghosts_reduce(PMGhostData * pgd, FastPMColumnTags attribute,
+static void
+pm_ghosts_reduce_any(PMGhostData * pgd, FastPMColumnTags attribute,
     reduce_func reduce,
-    void * userdata
+    void * userdata,
+    int parallel
 )
 {
 
@@ -275,33 +507,71 @@ pm_ghosts_reduce(PMGhostData * pgd, FastPMColumnTags attribute,
     MPI_Datatype GHOST_TYPE;
     MPI_Type_contiguous(elsize, MPI_BYTE, &GHOST_TYPE);
     MPI_Type_commit(&GHOST_TYPE);
-    MPI_Alltoallv_sparse(pgd->recv_buffer, pgd->Nrecv, pgd->Orecv, GHOST_TYPE,
-                  pgd->send_buffer, pgd->Nsend, pgd->Osend, GHOST_TYPE,
-                    pm->Comm2D);
+    pm_ghosts_exchange(pgd, pgd->recv_buffer, pgd->Nrecv, pgd->Orecv,
+                  pgd->send_buffer, pgd->Nsend, pgd->Osend, GHOST_TYPE);
     MPI_Type_free(&GHOST_TYPE);
 
     FastPMStore q[1];
     fastpm_store_init(q, pgd->p->name, Nsend, attribute, FASTPM_MEMORY_HEAP);
 
     /* now reduce the attributes. */
-    int ighost;
+    ptrdiff_t ighost;
 
-    /* this loop is not parallel because multiple ghosts can be for the same ipar,
-     * in which case we have a race condition.
-     * we can fix this by carefully working with ipar (it should / could be made sorted)
-     * but unlikly worth the effort.
-     * */
+#pragma omp parallel for
     for(ighost = 0; ighost < Nsend; ighost ++) {
         pgd->p->_column_info[ci].unpack(q, ighost, ci,
             (char*) pgd->send_buffer + ighost * elsize);
     }
 
-    for(ighost = 0; ighost < Nsend; ighost ++) {
-        reduce(q, ighost, pgd->source, pgd->ighost_to_ipar[ighost],
-                ci, userdata);
+    /* walk the ghosts grouped by particle; all ghosts of a particle are reduced by
+     * the same thread, in the send order, so there is no race and the result does
+     * not depend on the number of threads. */
+#pragma omp parallel if(parallel)
+    {
+#ifdef _OPENMP
+        int nth = omp_get_num_threads();
+        int ith = omp_get_thread_num();
+#else
+        int nth = 1;
+        int ith = 0;
+#endif
+        ptrdiff_t * byipar = pgd->ighost_by_ipar;
+        ptrdiff_t * ipar = pgd->ighost_to_ipar;
+        size_t start = ith * Nsend / nth;
+        size_t end = (ith + 1) * Nsend / nth;
+        /* move the boundaries past the ghosts of the particle at the boundary */
+        while(start > 0 && start < Nsend && ipar[byipar[start]] == ipar[byipar[start - 1]]) start ++;
+        while(end > 0 && end < Nsend && ipar[byipar[end]] == ipar[byipar[end - 1]]) end ++;
+
+        size_t k;
+        for(k = start; k < end; k ++) {
+            ighost = byipar[k];
+            reduce(q, ighost, pgd->source, ipar[ighost], ci, userdata);
+        }
     }
 
     fastpm_store_destroy(q);
     fastpm_memory_free(pm->mem, pgd->send_buffer);
     fastpm_memory_free(pm->mem, pgd->recv_buffer);
 }
+
+/* reduce the ghosts to the particles; reduce shall only modify the particle idest,
+ * and is called from several threads. */
+void
+pm_ghosts_reduce(PMGhostData * pgd, FastPMColumnTags attribute,
+    reduce_func reduce,
+    void * userdata
+)
+{
+    pm_ghosts_reduce_any(pgd, attribute, reduce, userdata, 1);
+}
+
+/* reduce the ghosts to the particles one by one, for a reduce with side effects. */
+void
+pm_ghosts_reduce_serial(PMGhostData * pgd, FastPMColumnTags attribute,
+    reduce_func reduce,
+    void * userdata
+)
+{
+    pm_ghosts_reduce_any(pgd, attribute, reduce, userdata, 0);
+}
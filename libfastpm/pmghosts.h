@@ -22,11 +22,14 @@ typedef struct PMGhostData {
     void * send_buffer;
     void * recv_buffer;
 
-    /* iterator status */
-    ptrdiff_t ipar;
-    int * ighost_to_ipar;
-    int rank;
-    int * reason; /* relative offset causing the ghost */
+    /* ghost plan: the source particle of each ghost in the send order,
+     * computed once by pm_ghosts_create and replayed by send / reduce. */
+    ptrdiff_t * ighost_to_ipar;
+    /* the ghosts grouped by source particle, for pm_ghosts_reduce */
+    ptrdiff_t * ighost_by_ipar;
+
+    /* the neighbour graph the ghosts travel on; NULL to exchange over all ranks of Comm2D. */
+    struct PMGhostGraph * graph;
 } PMGhostData;
 
 PMGhostData * 
@@ -43,6 +46,8 @@ pm_ghosts_send(PMGhostData * pgd, FastPMColumnTags attributes);
 
 void pm_ghosts_reduce(PMGhostData * pgd, FastPMColumnTags attribute, reduce_func reduce, void * userdata);
 
+void pm_ghosts_reduce_serial(PMGhostData * pgd, FastPMColumnTags attribute, reduce_func reduce, void * userdata);
+
 void pm_ghosts_free(PMGhostData * pgd);
 
 void
@@ -0,0 +1,133 @@
+#include <string.h>
+#include <mpi.h>
+
+#include <fastpm/libfastpm.h>
+#include <fastpm/logging.h>
+#include "pmpfft.h"
+#include "pmhalo.h"
+
+size_t
+pm_halo_plane_size(PM * pm, int dir)
+{
+    return pm->IRegion.size[1 - dir] * pm->Nmesh[2];
+}
+
+/* pointer to the first element of local plane i along dir, and the stride between rows */
+static FastPMFloat *
+_plane(PM * pm, FastPMFloat * real, int dir, ptrdiff_t i, ptrdiff_t * rowstride)
+{
+    *rowstride = pm->IRegion.strides[1 - dir];
+    return real + i * pm->IRegion.strides[dir];
+}
+
+/* global index of halo plane slot of a rank starting at start with size size */
+static ptrdiff_t
+_slot_to_plane(PM * pm, int dir, int width, ptrdiff_t start, ptrdiff_t size, int slot)
+{
+    ptrdiff_t g;
+    if(slot < width) {
+        g = start - width + slot;
+    } else {
+        g = start + size + slot - width;
+    }
+    while(g < 0) g += pm->Nmesh[dir];
+    while(g >= pm->Nmesh[dir]) g -= pm->Nmesh[dir];
+    return g;
+}
+
+/* Fill the halo planes along dir.
+ *
+ * The exchange is within the ranks along dir. Every rank knows the edges of all
+ * ranks, so both sides agree on which planes to send without a negotiation.
+ * This also works if a neighbour holds less than width planes, or if the halo
+ * wraps around the box.
+ * */
+void
+pm_halo_fetch_planes(PM * pm, FastPMFloat * real, int dir, int width, FastPMFloat * halo)
+{
+    MPI_Comm comm = pm->Comm1D[dir];
+
+    int ThisTask, NTask;
+    MPI_Comm_rank(comm, &ThisTask);
+    MPI_Comm_size(comm, &NTask);
+
+    ptrdiff_t * edges = pm->Grid.edges_int[dir];
+    ptrdiff_t start = pm->IRegion.start[dir];
+    ptrdiff_t size = pm->IRegion.size[dir];
+    size_t planesize = pm_halo_plane_size(pm, dir);
+
+    int * Nsend = calloc(NTask, sizeof(int));
+    int * Osend = calloc(NTask, sizeof(int));
+    int * Nrecv = calloc(NTask, sizeof(int));
+    int * Orecv = calloc(NTask, sizeof(int));
+
+    int r, slot;
+    for(r = 0; r < NTask; r ++) {
+        ptrdiff_t rsize = edges[r + 1] - edges[r];
+        if(rsize == 0) continue;
+        for(slot = 0; slot < 2 * width; slot ++) {
+            ptrdiff_t g = _slot_to_plane(pm, dir, width, edges[r], rsize, slot);
+            if(pm->Grid.MeshtoCart[dir][g] == ThisTask) Nsend[r] ++;
+        }
+    }
+    if(size > 0) {
+        for(slot = 0; slot < 2 * width; slot ++) {
+            ptrdiff_t g = _slot_to_plane(pm, dir, width, start, size, slot);
+            Nrecv[pm->Grid.MeshtoCart[dir][g]] ++;
+        }
+    }
+
+    size_t Nsendtotal = cumsum(Osend, Nsend, NTask);
+    size_t Nrecvtotal = cumsum(Orecv, Nrecv, NTask);
+
+    FastPMFloat * sendbuf = fastpm_memory_alloc(pm->mem, "HaloSend", sizeof(FastPMFloat) * planesize * Nsendtotal, FASTPM_MEMORY_STACK);
+    FastPMFloat * recvbuf = fastpm_memory_alloc(pm->mem, "HaloRecv", sizeof(FastPMFloat) * planesize * Nrecvtotal, FASTPM_MEMORY_STACK);
+
+    /* pack in the order of (rank, slot) */
+    size_t isend = 0;
+    for(r = 0; r < NTask; r ++) {
+        ptrdiff_t rsize = edges[r + 1] - edges[r];
+        if(rsize == 0) continue;
+        for(slot = 0; slot < 2 * width; slot ++) {
+            ptrdiff_t g = _slot_to_plane(pm, dir, width, edges[r], rsize, slot);
+            if(pm->Grid.MeshtoCart[dir][g] != ThisTask) continue;
+            ptrdiff_t rowstride;
+            FastPMFloat * plane = _plane(pm, real, dir, g - start, &rowstride);
+            FastPMFloat * buf = sendbuf + isend * planesize;
+            ptrdiff_t a;
+#pragma omp parallel for
+            for(a = 0; a < pm->IRegion.size[1 - dir]; a ++) {
+                memcpy(&buf[a * pm->Nmesh[2]], &plane[a * rowstride], sizeof(FastPMFloat) * pm->Nmesh[2]);
+            }
+            isend ++;
+        }
+    }
+
+    MPI_Datatype PLANE_TYPE;
+    MPI_Type_contiguous(planesize * sizeof(FastPMFloat), MPI_BYTE, &PLANE_TYPE);
+    MPI_Type_commit(&PLANE_TYPE);
+    MPI_Alltoallv_sparse(sendbuf, Nsend, Osend, PLANE_TYPE,
+                         recvbuf, Nrecv, Orecv, PLANE_TYPE, comm);
+    MPI_Type_free(&PLANE_TYPE);
+
+    /* the planes from a rank arrive in the order of slots */
+    if(size > 0) {
+        memset(Nrecv, 0, sizeof(int) * NTask);
+        for(slot = 0; slot < 2 * width; slot ++) {
+            ptrdiff_t g = _slot_to_plane(pm, dir, width, start, size, slot);
+            int o = pm->Grid.MeshtoCart[dir][g];
+            memcpy(halo + slot * planesize,
+                   recvbuf + (Orecv[o] + Nrecv[o]) * planesize,
+                   sizeof(FastPMFloat) * planesize);
+            Nrecv[o] ++;
+        }
+    }
+
+    fastpm_memory_free(pm->mem, recvbuf);
+    fastpm_memory_free(pm->mem, sendbuf);
+
+    free(Orecv);
+    free(Nrecv);
+    free(Osend);
+    free(Nsend);
+}
@@ -0,0 +1,11 @@
+/* Halo planes of a real field along a decomposed direction (0 or 1).
+ *
+ * The halo holds 2 * width planes; planes [0, width) are below the local region,
+ * planes [width, 2 * width) are above the local region, both in increasing order.
+ * Each plane is stored without padding, as [IRegion.size[1 - dir]][Nmesh[2]].
+ * */
+size_t
+pm_halo_plane_size(PM * pm, int dir);
+
+void
+pm_halo_fetch_planes(PM * pm, FastPMFloat * real, int dir, int width, FastPMFloat * halo);
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <limits.h>
 #include <mpi.h>
 
 #include <fftw3.h>
@@ -8,6 +9,7 @@
 #include <fastpm/libfastpm.h>
 #include <fastpm/logging.h>
 #include <fastpm/transfer.h>
+#include <fastpm/string.h>
 
 #include "pmpfft.h"
 static MPI_Datatype MPI_PTRDIFF = (MPI_Datatype) 0;
@@ -25,6 +27,14 @@ static MPI_Datatype MPI_PTRDIFF = (MPI_Datatype) 0;
     #define _pfft_cleanup pfft_cleanup
     #define destroy_plan pfft_destroy_plan
     #define destroy_plan_fftw fftw_destroy_plan
+    #define plan_many_dft_r2c pfft_plan_many_dft_r2c
+    #define plan_many_dft_c2r pfft_plan_many_dft_c2r
+    #define plan_many_dft_r2c_fftw fftw_mpi_plan_many_dft_r2c
+    #define plan_many_dft_c2r_fftw fftw_mpi_plan_many_dft_c2r
+    #define import_wisdom_from_filename fftw_import_wisdom_from_filename
+    #define export_wisdom_to_filename fftw_export_wisdom_to_filename
+    #define mpi_gather_wisdom fftw_mpi_gather_wisdom
+    #define mpi_broadcast_wisdom fftw_mpi_broadcast_wisdom
 
 #elif FASTPM_FFT_PRECISION == 32
     #define plan_dft_r2c pfftf_plan_dft_r2c
@@ -39,14 +49,37 @@ static MPI_Datatype MPI_PTRDIFF = (MPI_Datatype) 0;
     #define _pfft_cleanup pfftf_cleanup
     #define destroy_plan pfftf_destroy_plan
     #define destroy_plan_fftw fftwf_destroy_plan
+    #define plan_many_dft_r2c pfftf_plan_many_dft_r2c
+    #define plan_many_dft_c2r pfftf_plan_many_dft_c2r
+    #define plan_many_dft_r2c_fftw fftwf_mpi_plan_many_dft_r2c
+    #define plan_many_dft_c2r_fftw fftwf_mpi_plan_many_dft_c2r
+    #define import_wisdom_from_filename fftwf_import_wisdom_from_filename
+    #define export_wisdom_to_filename fftwf_export_wisdom_to_filename
+    #define mpi_gather_wisdom fftwf_mpi_gather_wisdom
+    #define mpi_broadcast_wisdom fftwf_mpi_broadcast_wisdom
 #endif
 
+/* transforms in single precision of a double precision mesh, for PMInit.precision = 32 */
+#if FASTPM_FFT_PRECISION == 64
+    #define HAS_SINGLE_TRANSFORMS
+#endif
+
+/* 1 if the transforms of pm are in a lower precision than FastPMFloat */
+static int
+_pm_narrow(PM * pm)
+{
+    return pm->init.precision != 0 && pm->init.precision < FASTPM_FFT_PRECISION;
+}
+
 void
 pm_module_init() 
 {
     if(MPI_PTRDIFF) return;
         
     _pfft_init();
+#ifdef HAS_SINGLE_TRANSFORMS
+    pfftf_init();
+#endif
 
     if(sizeof(ptrdiff_t) == 8) {
         MPI_PTRDIFF = MPI_LONG;
@@ -59,11 +92,231 @@ void
 pm_module_cleanup() 
 {
     if(!MPI_PTRDIFF) return;
+#ifdef HAS_SINGLE_TRANSFORMS
+    pfftf_cleanup();
+#endif
     _pfft_cleanup();
 
     MPI_PTRDIFF = (MPI_Datatype) 0;
 }
 
+/* planner flags of the configured planning effort. The PFFT plans are made of
+ * FFTW plans, so the FFTW wisdom covers both. */
+static unsigned
+_fftw_planner_flags()
+{
+    switch(_libfastpm_get_fft_planning()) {
+        case FASTPM_FFT_MEASURE:
+            return FFTW_MEASURE;
+        case FASTPM_FFT_PATIENT:
+            return FFTW_PATIENT;
+        default:
+            return FFTW_ESTIMATE;
+    }
+}
+
+static unsigned
+_pfft_planner_flags()
+{
+    switch(_libfastpm_get_fft_planning()) {
+        case FASTPM_FFT_MEASURE:
+            return PFFT_MEASURE;
+        case FASTPM_FFT_PATIENT:
+            return PFFT_PATIENT;
+        default:
+            return PFFT_ESTIMATE;
+    }
+}
+
+/* Plans of nbatch fields with single precision transforms. The mesh is narrowed
+ * to floats in place before the transform and widened after, so the floats sit in
+ * the first half of the FastPMFloat buffer; the local sizes of the transforms do not
+ * depend on the precision. */
+static void *
+_pm_plan_single(PM * pm, int nbatch, int forward, FastPMFloat * in, FastPMFloat * out)
+{
+#ifdef HAS_SINGLE_TRANSFORMS
+    if(pm->init.use_fftw) {
+        if(forward) {
+            return fftwf_mpi_plan_many_dft_r2c(
+                    3, pm->Nmesh, nbatch,
+                    FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK,
+                    (void*) in, (void*) out,
+                    pm->Comm2D,
+                    (pm->init.transposed?FFTW_MPI_TRANSPOSED_OUT:0)
+                    | _fftw_planner_flags()
+                    | FFTW_DESTROY_INPUT
+                    );
+        } else {
+            return fftwf_mpi_plan_many_dft_c2r(
+                    3, pm->Nmesh, nbatch,
+                    FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK,
+                    (void*) in, (void*) out,
+                    pm->Comm2D,
+                    (pm->init.transposed?FFTW_MPI_TRANSPOSED_IN:0)
+                    | _fftw_planner_flags()
+                    | FFTW_DESTROY_INPUT
+                    );
+        }
+    } else {
+        if(forward) {
+            return pfftf_plan_many_dft_r2c(
+                    3, pm->Nmesh, pm->Nmesh, pm->Nmesh, nbatch,
+                    PFFT_DEFAULT_BLOCKS, PFFT_DEFAULT_BLOCKS,
+                    (void*) in, (void*) out,
+                    pm->Comm2D,
+                    PFFT_FORWARD,
+                    (pm->init.transposed?PFFT_TRANSPOSED_OUT:0)
+                    | PFFT_PADDED_R2C
+                    | _pfft_planner_flags()
+                    | PFFT_TUNE
+                    | PFFT_DESTROY_INPUT
+                    );
+        } else {
+            return pfftf_plan_many_dft_c2r(
+                    3, pm->Nmesh, pm->Nmesh, pm->Nmesh, nbatch,
+                    PFFT_DEFAULT_BLOCKS, PFFT_DEFAULT_BLOCKS,
+                    (void*) in, (void*) out,
+                    pm->Comm2D,
+                    PFFT_BACKWARD,
+                    (pm->init.transposed?PFFT_TRANSPOSED_IN:0)
+                    | PFFT_PADDED_C2R
+                    | _pfft_planner_flags()
+                    | PFFT_TUNE
+                    | PFFT_DESTROY_INPUT
+                    );
+        }
+    }
+#else
+    fastpm_raise(-1, "Single precision transforms need FASTPM_FFT_PRECISION = 64.\n");
+    return NULL;
+#endif
+}
+
+static void
+_pm_execute_single(PM * pm, void * plan, int forward, FastPMFloat * in, FastPMFloat * out)
+{
+#ifdef HAS_SINGLE_TRANSFORMS
+    if(pm->init.use_fftw) {
+        if(forward) fftwf_mpi_execute_dft_r2c(plan, (void*) in, (void*) out);
+        else fftwf_mpi_execute_dft_c2r(plan, (void*) in, (void*) out);
+    } else {
+        if(forward) pfftf_execute_dft_r2c(plan, (void*) in, (void*) out);
+        else pfftf_execute_dft_c2r(plan, (void*) in, (void*) out);
+    }
+#endif
+}
+
+static void
+_pm_destroy_plan(PM * pm, void * plan)
+{
+#ifdef HAS_SINGLE_TRANSFORMS
+    if(_pm_narrow(pm)) {
+        if(pm->init.use_fftw) fftwf_destroy_plan(plan);
+        else pfftf_destroy_plan(plan);
+        return;
+    }
+#endif
+    if(pm->init.use_fftw) destroy_plan_fftw(plan);
+    else destroy_plan(plan);
+}
+
+/* Convert n FastPMFloat to floats in place. The rounds [s, 2s) overwrite only
+ * values converted by the earlier rounds, so each round can run in parallel. */
+static void
+_pm_narrow_inplace(FastPMFloat * x, ptrdiff_t n)
+{
+    float * y = (float *) x;
+    if(n == 0) return;
+    y[0] = x[0];
+    ptrdiff_t s;
+    for(s = 1; s < n; s *= 2) {
+        ptrdiff_t e = (2 * s < n) ? 2 * s : n;
+        ptrdiff_t i;
+#pragma omp parallel for
+        for(i = s; i < e; i ++) {
+            y[i] = x[i];
+        }
+    }
+}
+
+/* Convert n floats back to FastPMFloat in place, times factor; the rounds run backwards. */
+static void
+_pm_widen_inplace(FastPMFloat * x, ptrdiff_t n, double factor)
+{
+    float * y = (float *) x;
+    if(n == 0) return;
+    ptrdiff_t s = 1;
+    while(2 * s < n) s *= 2;
+    for(; s >= 1; s /= 2) {
+        ptrdiff_t e = (2 * s < n) ? 2 * s : n;
+        ptrdiff_t i;
+#pragma omp parallel for
+        for(i = s; i < e; i ++) {
+            x[i] = y[i] * factor;
+        }
+    }
+    x[0] = y[0] * factor;
+}
+
+/* Rank 0 reads the wisdom and broadcasts it to comm; returns 0 if the file
+ * cannot be read, e.g. in the first run. */
+int
+pm_module_import_wisdom(const char * filename, MPI_Comm comm)
+{
+    int ThisTask;
+    MPI_Comm_rank(comm, &ThisTask);
+
+    int ok = 0;
+    if(ThisTask == 0) {
+        ok = import_wisdom_from_filename(filename);
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, comm);
+    if(ok) {
+        mpi_broadcast_wisdom(comm);
+    }
+#ifdef HAS_SINGLE_TRANSFORMS
+    /* the single precision transforms keep their wisdom in filename.single */
+    char * fname = fastpm_strdup_printf("%s.single", filename);
+    int okf = 0;
+    if(ThisTask == 0) {
+        okf = fftwf_import_wisdom_from_filename(fname);
+    }
+    MPI_Bcast(&okf, 1, MPI_INT, 0, comm);
+    if(okf) {
+        fftwf_mpi_broadcast_wisdom(comm);
+    }
+    free(fname);
+#endif
+    return ok;
+}
+
+/* Gathers the wisdom of all ranks in comm; rank 0 writes it. Returns 0 if the
+ * file cannot be written. */
+int
+pm_module_export_wisdom(const char * filename, MPI_Comm comm)
+{
+    int ThisTask;
+    MPI_Comm_rank(comm, &ThisTask);
+
+    mpi_gather_wisdom(comm);
+
+    int ok = 0;
+    if(ThisTask == 0) {
+        ok = export_wisdom_to_filename(filename);
+    }
+#ifdef HAS_SINGLE_TRANSFORMS
+    fftwf_mpi_gather_wisdom(comm);
+    if(ThisTask == 0 && ok) {
+        char * fname = fastpm_strdup_printf("%s.single", filename);
+        ok = fftwf_export_wisdom_to_filename(fname);
+        free(fname);
+    }
+#endif
+    MPI_Bcast(&ok, 1, MPI_INT, 0, comm);
+    return ok;
+}
+
 static size_t fftw_local_size_dft_r2c(int nrnk, ptrdiff_t * n, MPI_Comm comm,
                         int flags, 
                         ptrdiff_t * isize, ptrdiff_t * istart,
@@ -110,6 +363,10 @@ void pm_init(PM * pm, PMInit * init, MPI_Comm comm) {
     pm->init = *init;
     pm->mem = _libfastpm_get_gmem();
 
+    memset(pm->r2c_batch, 0, sizeof(pm->r2c_batch));
+    memset(pm->c2r_batch, 0, sizeof(pm->c2r_batch));
+    memset(pm->ghost_graph, 0, sizeof(pm->ghost_graph));
+
     /* initialize the domain */
     MPI_Comm_rank(comm, &pm->ThisTask);
     MPI_Comm_size(comm, &pm->NTask);
@@ -210,7 +467,6 @@ void pm_init(PM * pm, PMInit * init, MPI_Comm comm) {
     }
 
     for(d = 0; d < 2; d ++) {
-        MPI_Comm projected;
         int remain_dims[2] = {0, 0};
         remain_dims[d] = 1; 
 
@@ -226,11 +482,10 @@ void pm_init(PM * pm, PMInit * init, MPI_Comm comm) {
          * if the rank does not contain any blocks. Using the offsets
          * will cause non-increasing edges.*/
 
-        MPI_Cart_sub(pm->Comm2D, remain_dims, &projected);
+        MPI_Cart_sub(pm->Comm2D, remain_dims, &pm->Comm1D[d]);
         MPI_Allgather(&pm->IRegion.size[d], 1, MPI_PTRDIFF, 
-            pm->Grid.edges_int[d], 1, MPI_PTRDIFF, projected);
+            pm->Grid.edges_int[d], 1, MPI_PTRDIFF, pm->Comm1D[d]);
 
-        MPI_Comm_free(&projected);
         int j;
         ptrdiff_t sum = 0;
         for(j = 0; j <= pm->Nproc[d]; j ++) {
@@ -262,19 +517,31 @@ void pm_init(PM * pm, PMInit * init, MPI_Comm comm) {
     FastPMFloat * canvas = pm_alloc(pm);
     FastPMFloat * workspace = pm_alloc(pm);
 
-    if(pm->init.use_fftw) {
+    if(pm->init.precision != 0 && pm->init.precision != 32 && pm->init.precision != 64) {
+        fastpm_raise(-1, "FFT precision must be 32 or 64, got %d.\n", pm->init.precision);
+    }
+    if(pm->init.precision > FASTPM_FFT_PRECISION) {
+        fastpm_raise(-1, "FFT precision %d is higher than that of the mesh, %d.\n",
+            pm->init.precision, FASTPM_FFT_PRECISION);
+    }
+
+    if(_pm_narrow(pm)) {
+        fastpm_info("Transforms of the %td^3 mesh in single precision.\n", pm->Nmesh[0]);
+        pm->r2c = _pm_plan_single(pm, 1, 1, workspace, canvas);
+        pm->c2r = _pm_plan_single(pm, 1, 0, canvas, canvas);
+    } else if(pm->init.use_fftw) {
         pm->r2c = plan_dft_r2c_fftw(
                 3, pm->Nmesh, (void*) workspace, (void*) canvas, 
                 pm->Comm2D, 
                 (pm->init.transposed?FFTW_MPI_TRANSPOSED_OUT:0)
-                | FFTW_ESTIMATE 
+                | _fftw_planner_flags()
                 | FFTW_DESTROY_INPUT
                 );
         pm->c2r = plan_dft_c2r_fftw(
                 3, pm->Nmesh, (void*) canvas, (void*) canvas, 
                 pm->Comm2D, 
                 (pm->init.transposed?FFTW_MPI_TRANSPOSED_IN:0)
-                | FFTW_ESTIMATE 
+                | _fftw_planner_flags()
                 | FFTW_DESTROY_INPUT
                 );
     } else {
@@ -284,9 +551,8 @@ void pm_init(PM * pm, PMInit * init, MPI_Comm comm) {
                 PFFT_FORWARD, 
                 (pm->init.transposed?PFFT_TRANSPOSED_OUT:0)
                 | PFFT_PADDED_R2C 
-                | PFFT_ESTIMATE 
+                | _pfft_planner_flags()
                 | PFFT_TUNE
-                //| PFFT_MEASURE
                 | PFFT_DESTROY_INPUT
                 );
         pm->c2r = plan_dft_c2r(
@@ -295,8 +561,7 @@ void pm_init(PM * pm, PMInit * init, MPI_Comm comm) {
                 PFFT_BACKWARD, 
                 (pm->init.transposed?PFFT_TRANSPOSED_IN:0)
                 | PFFT_PADDED_C2R 
-                | PFFT_ESTIMATE 
-                //| PFFT_MEASURE
+                | _pfft_planner_flags()
                 | PFFT_TUNE
                 | PFFT_DESTROY_INPUT
                 );
@@ -322,12 +587,19 @@ void
 pm_destroy(PM * pm) 
 {
     int d;
-    if(pm->init.use_fftw) {
-        destroy_plan_fftw(pm->r2c);
-        destroy_plan_fftw(pm->c2r);
-    } else {
-        destroy_plan(pm->r2c);
-        destroy_plan(pm->c2r);
+    _pm_destroy_plan(pm, pm->r2c);
+    _pm_destroy_plan(pm, pm->c2r);
+    int n;
+    for(n = 0; n <= PM_MAX_BATCH; n ++) {
+        if(pm->r2c_batch[n]) _pm_destroy_plan(pm, pm->r2c_batch[n]);
+        if(pm->c2r_batch[n]) _pm_destroy_plan(pm, pm->c2r_batch[n]);
+    }
+    for(n = 0; n < PM_MAX_GHOST_GRAPH; n ++) {
+        if(pm->ghost_graph[n]) {
+            MPI_Comm_free(&pm->ghost_graph[n]->comm);
+            free(pm->ghost_graph[n]->ranks);
+            free(pm->ghost_graph[n]);
+        }
     }
     for(d = 0; d < 3; d++) {
         free(pm->MeshtoK[d]);
@@ -337,6 +609,7 @@ pm_destroy(PM * pm)
         free(pm->Grid.MeshtoCart[d]);
         free(pm->Grid.edges_int[d]);
         free(pm->Grid.edges_float[d]);
+        MPI_Comm_free(&pm->Comm1D[d]);
     }
     MPI_Comm_free(&pm->Comm2D);
 }
@@ -373,6 +646,14 @@ void pm_r2c(PM * pm, FastPMFloat * from, FastPMFloat * to) {
     /* A gaussian of variance 1 becomes a complex gausian of variance 1/2 * (1 / Norm) in real and imag */
 
     /* workspace to canvas*/
+    if(_pm_narrow(pm)) {
+        /* from is destroyed by the transform anyways */
+        _pm_narrow_inplace(from, pm->allocsize);
+        _pm_execute_single(pm, pm->r2c, 1, from, to);
+        _pm_widen_inplace(to, pm->allocsize, 1 / pm->Norm);
+        VALGRIND_MAKE_MEM_DEFINED(to, sizeof(to[0]) * pm->allocsize);
+        return;
+    }
     if(pm->init.use_fftw) {
         execute_dft_r2c_fftw(pm->r2c, from, (void*)to);
     } else {
@@ -390,7 +671,11 @@ void pm_r2c(PM * pm, FastPMFloat * from, FastPMFloat * to) {
 void pm_c2r(PM * pm, FastPMFloat * inplace) {
     /* r2c and c2r round trip is unitary */
     VALGRIND_CHECK_MEM_IS_DEFINED(inplace, sizeof(inplace[0]) * pm->allocsize);
-    if(pm->init.use_fftw) {
+    if(_pm_narrow(pm)) {
+        _pm_narrow_inplace(inplace, pm->allocsize);
+        _pm_execute_single(pm, pm->c2r, 0, inplace, inplace);
+        _pm_widen_inplace(inplace, pm->allocsize, 1.0);
+    } else if(pm->init.use_fftw) {
         execute_dft_c2r_fftw(pm->c2r, (void*) inplace, inplace);
     } else {
         execute_dft_c2r(pm->c2r, (void*) inplace, inplace);
@@ -398,6 +683,198 @@ void pm_c2r(PM * pm, FastPMFloat * inplace) {
     VALGRIND_MAKE_MEM_DEFINED(inplace, sizeof(inplace[0]) * pm->allocsize);
 }
 
+FastPMFloat *
+pm_batch_alloc(PM * pm, int nbatch)
+{
+    /* the local size of a batched transform is nbatch times the local size of a single transform. */
+    void * p = fastpm_memory_alloc(pm->mem, "PMBatch", sizeof(FastPMFloat) * pm->allocsize * nbatch, FASTPM_MEMORY_HEAP);
+    memset(p, 0, sizeof(FastPMFloat) * pm->allocsize * nbatch);
+    return p;
+}
+
+void
+pm_batch_free(PM * pm, FastPMFloat * batch)
+{
+    fastpm_memory_free(pm->mem, batch);
+}
+
+void
+pm_batch_put(PM * pm, FastPMFloat * batch, int nbatch, int ibatch, FastPMFloat * field, int is_complex)
+{
+    ptrdiff_t i;
+    if(is_complex) {
+#pragma omp parallel for
+        for(i = 0; i < pm->allocsize / 2; i ++) {
+            batch[(i * nbatch + ibatch) * 2 + 0] = field[2 * i + 0];
+            batch[(i * nbatch + ibatch) * 2 + 1] = field[2 * i + 1];
+        }
+    } else {
+#pragma omp parallel for
+        for(i = 0; i < pm->allocsize; i ++) {
+            batch[i * nbatch + ibatch] = field[i];
+        }
+    }
+}
+
+void
+pm_batch_take(PM * pm, FastPMFloat * batch, int nbatch, int ibatch, FastPMFloat * field, int is_complex)
+{
+    ptrdiff_t i;
+    if(is_complex) {
+#pragma omp parallel for
+        for(i = 0; i < pm->allocsize / 2; i ++) {
+            field[2 * i + 0] = batch[(i * nbatch + ibatch) * 2 + 0];
+            field[2 * i + 1] = batch[(i * nbatch + ibatch) * 2 + 1];
+        }
+    } else {
+#pragma omp parallel for
+        for(i = 0; i < pm->allocsize; i ++) {
+            field[i] = batch[i * nbatch + ibatch];
+        }
+    }
+}
+
+/* Batched plans are created on first use, because most PMs never batch.
+ * Creating a plan is collective; all ranks batch the same number of fields
+ * in the same order. */
+static void *
+pm_get_batch_plan(PM * pm, int nbatch, int forward)
+{
+    if(nbatch < 1 || nbatch > PM_MAX_BATCH) {
+        fastpm_raise(-1, "Batch of %d fields is not supported; maximum is %d.\n", nbatch, PM_MAX_BATCH);
+    }
+    void ** plans = forward ? pm->r2c_batch : pm->c2r_batch;
+    if(plans[nbatch]) return plans[nbatch];
+
+    /* PFFT_TUNE and measured planning run trial transforms; do not plan on the data. */
+    FastPMFloat * workspace = pm_batch_alloc(pm, nbatch);
+
+    if(_pm_narrow(pm)) {
+        plans[nbatch] = _pm_plan_single(pm, nbatch, forward, workspace, workspace);
+    } else if(pm->init.use_fftw) {
+        if(forward) {
+            plans[nbatch] = plan_many_dft_r2c_fftw(
+                    3, pm->Nmesh, nbatch,
+                    FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK,
+                    (void*) workspace, (void*) workspace,
+                    pm->Comm2D,
+                    (pm->init.transposed?FFTW_MPI_TRANSPOSED_OUT:0)
+                    | _fftw_planner_flags()
+                    | FFTW_DESTROY_INPUT
+                    );
+        } else {
+            plans[nbatch] = plan_many_dft_c2r_fftw(
+                    3, pm->Nmesh, nbatch,
+                    FFTW_MPI_DEFAULT_BLOCK, FFTW_MPI_DEFAULT_BLOCK,
+                    (void*) workspace, (void*) workspace,
+                    pm->Comm2D,
+                    (pm->init.transposed?FFTW_MPI_TRANSPOSED_IN:0)
+                    | _fftw_planner_flags()
+                    | FFTW_DESTROY_INPUT
+                    );
+        }
+    } else {
+        if(forward) {
+            plans[nbatch] = plan_many_dft_r2c(
+                    3, pm->Nmesh, pm->Nmesh, pm->Nmesh, nbatch,
+                    PFFT_DEFAULT_BLOCKS, PFFT_DEFAULT_BLOCKS,
+                    (void*) workspace, (void*) workspace,
+                    pm->Comm2D,
+                    PFFT_FORWARD,
+                    (pm->init.transposed?PFFT_TRANSPOSED_OUT:0)
+                    | PFFT_PADDED_R2C
+                    | _pfft_planner_flags()
+                    | PFFT_TUNE
+                    | PFFT_DESTROY_INPUT
+                    );
+        } else {
+            plans[nbatch] = plan_many_dft_c2r(
+                    3, pm->Nmesh, pm->Nmesh, pm->Nmesh, nbatch,
+                    PFFT_DEFAULT_BLOCKS, PFFT_DEFAULT_BLOCKS,
+                    (void*) workspace, (void*) workspace,
+                    pm->Comm2D,
+                    PFFT_BACKWARD,
+                    (pm->init.transposed?PFFT_TRANSPOSED_IN:0)
+                    | PFFT_PADDED_C2R
+                    | _pfft_planner_flags()
+                    | PFFT_TUNE
+                    | PFFT_DESTROY_INPUT
+                    );
+        }
+    }
+
+    pm_batch_free(pm, workspace);
+    return plans[nbatch];
+}
+
+void
+pm_r2c_batch(PM * pm, FastPMFloat * batch, int nbatch)
+{
+    void * plan = pm_get_batch_plan(pm, nbatch, 1);
+    ptrdiff_t n = pm->allocsize * nbatch;
+
+    VALGRIND_CHECK_MEM_IS_DEFINED(batch, sizeof(batch[0]) * n);
+    if(_pm_narrow(pm)) {
+        _pm_narrow_inplace(batch, n);
+        _pm_execute_single(pm, plan, 1, batch, batch);
+        _pm_widen_inplace(batch, n, 1 / pm->Norm);
+        VALGRIND_MAKE_MEM_DEFINED(batch, sizeof(batch[0]) * n);
+        return;
+    }
+    if(pm->init.use_fftw) {
+        execute_dft_r2c_fftw(plan, batch, (void*) batch);
+    } else {
+        execute_dft_r2c(plan, batch, (void*) batch);
+    }
+    ptrdiff_t i;
+#pragma omp parallel for
+    for(i = 0; i < n; i ++) {
+        batch[i] *= 1 / pm->Norm;
+    }
+    VALGRIND_MAKE_MEM_DEFINED(batch, sizeof(batch[0]) * n);
+}
+
+void
+pm_c2r_batch(PM * pm, FastPMFloat * batch, int nbatch)
+{
+    void * plan = pm_get_batch_plan(pm, nbatch, 0);
+    ptrdiff_t n = pm->allocsize * nbatch;
+
+    VALGRIND_CHECK_MEM_IS_DEFINED(batch, sizeof(batch[0]) * n);
+    if(_pm_narrow(pm)) {
+        _pm_narrow_inplace(batch, n);
+        _pm_execute_single(pm, plan, 0, batch, batch);
+        _pm_widen_inplace(batch, n, 1.0);
+    } else if(pm->init.use_fftw) {
+        execute_dft_c2r_fftw(plan, (void*) batch, batch);
+    } else {
+        execute_dft_c2r(plan, (void*) batch, batch);
+    }
+    VALGRIND_MAKE_MEM_DEFINED(batch, sizeof(batch[0]) * n);
+}
+
+void
+pm_c2r_many(PM * pm, FastPMFloat * fields[], int nbatch)
+{
+    int i;
+    if(!pm->init.batch || nbatch == 1) {
+        for(i = 0; i < nbatch; i ++) {
+            pm_c2r(pm, fields[i]);
+        }
+        return;
+    }
+
+    FastPMFloat * batch = pm_batch_alloc(pm, nbatch);
+    for(i = 0; i < nbatch; i ++) {
+        pm_batch_put(pm, batch, nbatch, i, fields[i], 1);
+    }
+    pm_c2r_batch(pm, batch, nbatch);
+    for(i = 0; i < nbatch; i ++) {
+        pm_batch_take(pm, batch, nbatch, i, fields[i], 0);
+    }
+    pm_batch_free(pm, batch);
+}
+
 #define unravel(ind, i, d0, d1, d2, strides) \
 i[d0] = ind / strides[d0]; ind %= strides[d0]; \
 i[d1] = ind / strides[d1]; ind %= strides[d1]; \
@@ -487,6 +964,354 @@ int pm_inc_i_index(PM * pm, ptrdiff_t i[3]) {
     return rt;
 }
 
+static int
+_alltoallv_flat_64(void *sendbuf, size_t *sendcnts, size_t *sdispls,
+        MPI_Datatype sendtype, void *recvbuf, size_t *recvcnts,
+        size_t *rdispls, MPI_Datatype recvtype, MPI_Comm comm);
+
+/* The ranks of a communicator grouped by shared memory node; cached on the communicator. */
+typedef struct {
+    MPI_Comm node;      /* the ranks on the node of this rank, ordered as in the communicator */
+    MPI_Comm leaders;   /* the first rank of every node; MPI_COMM_NULL on the other ranks */
+    int Nnode;
+    int * NodeOf;       /* [NTask] the node of a rank; nodes are numbered by the rank of their leader */
+    int * NodeStart;    /* [Nnode + 1] offset of the first rank of a node in NodeMembers */
+    int * NodeMembers;  /* [NTask] the ranks of each node, in the order of the node communicator */
+} PMNodeTopology;
+
+static int NODE_TOPOLOGY_KEYVAL = MPI_KEYVAL_INVALID;
+
+static int
+_node_topology_delete(MPI_Comm comm, int keyval, void * attr, void * extra)
+{
+    PMNodeTopology * topo = attr;
+    if(topo->leaders != MPI_COMM_NULL) MPI_Comm_free(&topo->leaders);
+    MPI_Comm_free(&topo->node);
+    free(topo->NodeMembers);
+    free(topo->NodeStart);
+    free(topo->NodeOf);
+    free(topo);
+    return MPI_SUCCESS;
+}
+
+static PMNodeTopology *
+_node_topology(MPI_Comm comm)
+{
+    if(NODE_TOPOLOGY_KEYVAL == MPI_KEYVAL_INVALID) {
+        MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, _node_topology_delete, &NODE_TOPOLOGY_KEYVAL, NULL);
+    }
+    PMNodeTopology * topo;
+    int found;
+    MPI_Comm_get_attr(comm, NODE_TOPOLOGY_KEYVAL, &topo, &found);
+    if(found) return topo;
+
+    int ThisTask, NTask;
+    MPI_Comm_rank(comm, &ThisTask);
+    MPI_Comm_size(comm, &NTask);
+
+    topo = malloc(sizeof(PMNodeTopology));
+    int RanksPerNode = _libfastpm_get_ranks_per_node();
+    if(RanksPerNode > 0) {
+        MPI_Comm_split(comm, ThisTask / RanksPerNode, ThisTask, &topo->node);
+    } else {
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, ThisTask, MPI_INFO_NULL, &topo->node);
+    }
+
+    int NodeRank;
+    MPI_Comm_rank(topo->node, &NodeRank);
+    MPI_Comm_split(comm, NodeRank == 0 ? 0 : MPI_UNDEFINED, ThisTask, &topo->leaders);
+
+    int inode = 0;
+    if(topo->leaders != MPI_COMM_NULL) {
+        MPI_Comm_rank(topo->leaders, &inode);
+    }
+    MPI_Bcast(&inode, 1, MPI_INT, 0, topo->node);
+
+    topo->NodeOf = malloc(sizeof(int) * NTask);
+    MPI_Allgather(&inode, 1, MPI_INT, topo->NodeOf, 1, MPI_INT, comm);
+
+    int r, m;
+    topo->Nnode = 0;
+    for(r = 0; r < NTask; r ++) {
+        if(topo->NodeOf[r] + 1 > topo->Nnode) topo->Nnode = topo->NodeOf[r] + 1;
+    }
+    topo->NodeStart = calloc(topo->Nnode + 1, sizeof(int));
+    topo->NodeMembers = malloc(sizeof(int) * NTask);
+    for(r = 0; r < NTask; r ++) {
+        topo->NodeStart[topo->NodeOf[r] + 1] ++;
+    }
+    for(m = 0; m < topo->Nnode; m ++) {
+        topo->NodeStart[m + 1] += topo->NodeStart[m];
+    }
+    int * fill = calloc(topo->Nnode, sizeof(int));
+    for(r = 0; r < NTask; r ++) {
+        m = topo->NodeOf[r];
+        topo->NodeMembers[topo->NodeStart[m] + fill[m]++] = r;
+    }
+    free(fill);
+
+    MPI_Comm_set_attr(comm, NODE_TOPOLOGY_KEYVAL, topo);
+    if(topo->Nnode > 1 && topo->Nnode < NTask)
+        fastpm_info("Node-aware Alltoallv on %d nodes of %d ranks\n", topo->Nnode, NTask);
+    return topo;
+}
+
+static size_t
+_type_extent(MPI_Datatype type)
+{
+    MPI_Aint lb, extent;
+    MPI_Type_get_extent(type, &lb, &extent);
+    return extent;
+}
+
+/* The topology if the exchange shall go through the node leaders, NULL otherwise.
+ * That is when asked for, and there are several nodes with several ranks on some. */
+static PMNodeTopology *
+_node_aware_topology(MPI_Comm comm, MPI_Datatype sendtype, MPI_Datatype recvtype)
+{
+    if(!_libfastpm_get_node_aware_exchange()) return NULL;
+
+    int NTask;
+    MPI_Comm_size(comm, &NTask);
+
+    int size;
+    MPI_Type_size(sendtype, &size);
+    /* the elements are moved as bytes; they shall have no holes. */
+    if(size != _type_extent(sendtype) || size != _type_extent(recvtype)) return NULL;
+
+    PMNodeTopology * topo = _node_topology(comm);
+    if(topo->Nnode == 1 || topo->Nnode == NTask) return NULL;
+    return topo;
+}
+
+/* point to point messages of bytes, in pieces of at most INT_MAX bytes. */
+static int
+_npieces(size_t n)
+{
+    return (n + INT_MAX - 1) / INT_MAX;
+}
+
+static void
+_isend_bytes(char * buf, size_t n, int dest, MPI_Comm comm, MPI_Request * requests, int * nreq)
+{
+    size_t offset;
+    for(offset = 0; offset < n; offset += INT_MAX) {
+        size_t len = n - offset > INT_MAX ? INT_MAX : n - offset;
+        MPI_Isend(buf + offset, len, MPI_BYTE, dest, 101937, comm, &requests[(*nreq)++]);
+    }
+}
+
+static void
+_irecv_bytes(char * buf, size_t n, int source, MPI_Comm comm, MPI_Request * requests, int * nreq)
+{
+    size_t offset;
+    for(offset = 0; offset < n; offset += INT_MAX) {
+        size_t len = n - offset > INT_MAX ? INT_MAX : n - offset;
+        MPI_Irecv(buf + offset, len, MPI_BYTE, source, 101937, comm, &requests[(*nreq)++]);
+    }
+}
+
+/* Alltoallv in three stages: the ranks of a node send all their data to the node
+ * leader; the leaders exchange the data of their nodes; every leader hands the data
+ * to the ranks of its node. There is one message per pair of nodes instead of one
+ * per pair of ranks, at the cost of the leaders holding twice the data of their node.
+ *
+ * A rank sends its data ordered by (destination node, destination rank);
+ * a leader sends the data for a node ordered by (source rank, destination rank),
+ * and hands the data to a rank ordered by (source node, source rank).
+ * */
+static int
+_alltoallv_node_aware(void *sendbuf, size_t *sendcnts, size_t *sdispls,
+        void *recvbuf, size_t *recvcnts, size_t *rdispls,
+        size_t elsize, MPI_Comm comm, PMNodeTopology * topo)
+{
+    int ThisTask, NTask, NodeRank, NodeSize;
+    MPI_Comm_rank(comm, &ThisTask);
+    MPI_Comm_size(comm, &NTask);
+    MPI_Comm_rank(topo->node, &NodeRank);
+    MPI_Comm_size(topo->node, &NodeSize);
+
+    const int Nnode = topo->Nnode;
+    const int * members = topo->NodeMembers;
+    const int * start = topo->NodeStart;
+
+    int m, k, s, l;
+
+    /* pack the send data by destination node */
+    size_t nsend = 0;
+    for(k = 0; k < NTask; k ++) nsend += sendcnts[members[k]] * elsize;
+
+    /* the staging buffers come from the memory pool; packed, gathered and in
+     * are on the stack, received, out and to are on the heap, such that
+     * each pool is released in order. */
+    FastPMMemory * mem = _libfastpm_get_gmem();
+    char * packed = fastpm_memory_alloc(mem, "NodePacked", nsend + 1, FASTPM_MEMORY_STACK);
+    size_t offset = 0;
+    for(k = 0; k < NTask; k ++) {
+        int d = members[k];
+        memcpy(packed + offset, ((char*) sendbuf) + sdispls[d] * elsize, sendcnts[d] * elsize);
+        offset += sendcnts[d] * elsize;
+    }
+
+    size_t nrecv = 0;
+    for(k = 0; k < NTask; k ++) nrecv += recvcnts[k] * elsize;
+    char * received = fastpm_memory_alloc(mem, "NodeReceived", nrecv + 1, FASTPM_MEMORY_HEAP);
+
+    /* counts of the node, [NodeSize][NTask], on the leader */
+    size_t * C = NULL;
+    if(NodeRank == 0) C = malloc(sizeof(size_t) * NodeSize * NTask);
+    MPI_Gather(sendcnts, NTask, MPI_LONG, C, NTask, MPI_LONG, 0, topo->node);
+
+    if(NodeRank != 0) {
+        MPI_Request * requests = malloc(sizeof(MPI_Request) * (_npieces(nsend) + _npieces(nrecv) + 1));
+        int nreq = 0;
+        _irecv_bytes(received, nrecv, 0, topo->node, requests, &nreq);
+        _isend_bytes(packed, nsend, 0, topo->node, requests, &nreq);
+        MPI_Waitall(nreq, requests, MPI_STATUSES_IGNORE);
+        free(requests);
+    } else {
+        /* collect the packed data of the node */
+        size_t * sendsize = calloc(NodeSize, sizeof(size_t));
+        size_t * sendoffset = calloc(NodeSize + 1, sizeof(size_t));
+        int npieces = 0;
+        for(s = 0; s < NodeSize; s ++) {
+            for(k = 0; k < NTask; k ++) sendsize[s] += C[(size_t) s * NTask + k] * elsize;
+            sendoffset[s + 1] = sendoffset[s] + sendsize[s];
+            npieces += _npieces(sendsize[s]);
+        }
+        char * gathered = fastpm_memory_alloc(mem, "NodeGathered", sendoffset[NodeSize] + 1, FASTPM_MEMORY_STACK);
+        MPI_Request * requests = malloc(sizeof(MPI_Request) * (npieces + 1));
+        int nreq = 0;
+        for(s = 1; s < NodeSize; s ++) {
+            _irecv_bytes(gathered + sendoffset[s], sendsize[s], s, topo->node, requests, &nreq);
+        }
+        memcpy(gathered, packed, nsend);
+        MPI_Waitall(nreq, requests, MPI_STATUSES_IGNORE);
+        free(requests);
+
+        /* regroup by destination node, and the counts that go with the data */
+        size_t * outsize = calloc(Nnode, sizeof(size_t));
+        size_t * outoffset = calloc(Nnode, sizeof(size_t));
+        int * csendcnts = malloc(sizeof(int) * Nnode);
+        int * csenddispls = malloc(sizeof(int) * Nnode);
+        int * crecvcnts = malloc(sizeof(int) * Nnode);
+        int * crecvdispls = malloc(sizeof(int) * Nnode);
+        for(m = 0; m < Nnode; m ++) {
+            int msize = start[m + 1] - start[m];
+            csendcnts[m] = NodeSize * msize;
+            crecvcnts[m] = msize * NodeSize;
+        }
+        cumsum(csenddispls, csendcnts, Nnode);
+        size_t ncrecv = cumsum(crecvdispls, crecvcnts, Nnode);
+
+        size_t * csend = malloc(sizeof(size_t) * NodeSize * NTask + 1);
+        size_t * crecv = malloc(sizeof(size_t) * ncrecv + 1);
+        size_t * cursor = malloc(sizeof(size_t) * NodeSize);
+        for(s = 0; s < NodeSize; s ++) cursor[s] = sendoffset[s];
+
+        char * out = fastpm_memory_alloc(mem, "NodeOut", sendoffset[NodeSize] + 1, FASTPM_MEMORY_HEAP);
+        offset = 0;
+        for(m = 0; m < Nnode; m ++) {
+            outoffset[m] = offset;
+            for(s = 0; s < NodeSize; s ++) {
+                size_t n = 0;
+                for(k = start[m]; k < start[m + 1]; k ++) {
+                    size_t c = C[(size_t) s * NTask + members[k]];
+                    csend[csenddispls[m] + s * (start[m + 1] - start[m]) + k - start[m]] = c;
+                    n += c * elsize;
+                }
+                memcpy(out + offset, gathered + cursor[s], n);
+                cursor[s] += n;
+                offset += n;
+            }
+            outsize[m] = offset - outoffset[m];
+        }
+        fastpm_memory_free(mem, gathered);
+
+        MPI_Alltoallv(csend, csendcnts, csenddispls, MPI_LONG,
+                      crecv, crecvcnts, crecvdispls, MPI_LONG, topo->leaders);
+
+        size_t * insize = calloc(Nnode, sizeof(size_t));
+        size_t * inoffset = calloc(Nnode, sizeof(size_t));
+        size_t * tosize = calloc(NodeSize, sizeof(size_t));
+        offset = 0;
+        for(m = 0; m < Nnode; m ++) {
+            int msize = start[m + 1] - start[m];
+            inoffset[m] = offset;
+            for(k = 0; k < msize * NodeSize; k ++) {
+                insize[m] += crecv[crecvdispls[m] + k] * elsize;
+                tosize[k % NodeSize] += crecv[crecvdispls[m] + k] * elsize;
+            }
+            offset += insize[m];
+        }
+
+        char * in = fastpm_memory_alloc(mem, "NodeIn", offset + 1, FASTPM_MEMORY_STACK);
+        _alltoallv_flat_64(out, outsize, outoffset, MPI_BYTE,
+                           in, insize, inoffset, MPI_BYTE, topo->leaders);
+        fastpm_memory_free(mem, out);
+
+        /* regroup by destination rank */
+        size_t * tooffset = calloc(NodeSize + 1, sizeof(size_t));
+        for(l = 0; l < NodeSize; l ++) {
+            tooffset[l + 1] = tooffset[l] + tosize[l];
+            cursor[l] = tooffset[l];
+        }
+        char * to = fastpm_memory_alloc(mem, "NodeTo", tooffset[NodeSize] + 1, FASTPM_MEMORY_HEAP);
+        offset = 0;
+        for(m = 0; m < Nnode; m ++) {
+            int msize = start[m + 1] - start[m];
+            for(k = 0; k < msize * NodeSize; k ++) {
+                size_t n = crecv[crecvdispls[m] + k] * elsize;
+                memcpy(to + cursor[k % NodeSize], in + offset, n);
+                cursor[k % NodeSize] += n;
+                offset += n;
+            }
+        }
+        fastpm_memory_free(mem, in);
+
+        npieces = 0;
+        for(l = 1; l < NodeSize; l ++) npieces += _npieces(tosize[l]);
+        requests = malloc(sizeof(MPI_Request) * (npieces + 1));
+        nreq = 0;
+        for(l = 1; l < NodeSize; l ++) {
+            _isend_bytes(to + tooffset[l], tosize[l], l, topo->node, requests, &nreq);
+        }
+        memcpy(received, to, tosize[0]);
+        MPI_Waitall(nreq, requests, MPI_STATUSES_IGNORE);
+        free(requests);
+
+        fastpm_memory_free(mem, to);
+        free(tooffset);
+        free(tosize);
+        free(inoffset);
+        free(insize);
+        free(cursor);
+        free(crecv);
+        free(csend);
+        free(crecvdispls);
+        free(crecvcnts);
+        free(csenddispls);
+        free(csendcnts);
+        free(outoffset);
+        free(outsize);
+        free(sendoffset);
+        free(sendsize);
+        free(C);
+    }
+    fastpm_memory_free(mem, packed);
+
+    /* the data arrives ordered by source node, then source rank */
+    offset = 0;
+    for(k = 0; k < NTask; k ++) {
+        int r = members[k];
+        memcpy(((char*) recvbuf) + rdispls[r] * elsize, received + offset, recvcnts[r] * elsize);
+        offset += recvcnts[r] * elsize;
+    }
+    fastpm_memory_free(mem, received);
+
+    return 0;
+}
+
 int MPI_Alltoallv_sparse(void *sendbuf, int *sendcnts, int *sdispls,
         MPI_Datatype sendtype, void *recvbuf, int *recvcnts,
         int *rdispls, MPI_Datatype recvtype, MPI_Comm comm) {
@@ -496,6 +1321,23 @@ int MPI_Alltoallv_sparse(void *sendbuf, int *sendcnts, int *sdispls,
     MPI_Comm_rank(comm, &ThisTask);
     MPI_Comm_size(comm, &NTask);
 
+    PMNodeTopology * topo = _node_aware_topology(comm, sendtype, recvtype);
+    if(topo) {
+        size_t * counts = malloc(sizeof(size_t) * NTask * 4);
+        int i;
+        for(i = 0; i < NTask; i ++) {
+            counts[i] = sendcnts[i];
+            counts[i + NTask] = sdispls[i];
+            counts[i + 2 * NTask] = recvcnts[i];
+            counts[i + 3 * NTask] = rdispls[i];
+        }
+        _alltoallv_node_aware(sendbuf, counts, counts + NTask,
+                recvbuf, counts + 2 * NTask, counts + 3 * NTask,
+                _type_extent(sendtype), comm, topo);
+        free(counts);
+        return 0;
+    }
+
     {
         /* if the send is dense, use MPI_Alltoallv directly. */
         int i;
@@ -603,3 +1445,100 @@ int MPI_Alltoallv_sparse(void *sendbuf, int *sendcnts, int *sdispls,
     return 0;
 } 
 
+/* The messages are point to point in the same order as MPI_Alltoallv_sparse;
+ * a message of more than INT_MAX elements is split into pieces, which
+ * MPI delivers in order. */
+static int
+_alltoallv_flat_64(void *sendbuf, size_t *sendcnts, size_t *sdispls,
+        MPI_Datatype sendtype, void *recvbuf, size_t *recvcnts,
+        size_t *rdispls, MPI_Datatype recvtype, MPI_Comm comm) {
+
+    int ThisTask;
+    int NTask;
+    MPI_Comm_rank(comm, &ThisTask);
+    MPI_Comm_size(comm, &NTask);
+
+    int PTask;
+    int ngrp;
+
+    for(PTask = 0; NTask > (1 << PTask); PTask++);
+
+    ptrdiff_t lb;
+    ptrdiff_t send_elsize;
+    ptrdiff_t recv_elsize;
+
+    MPI_Type_get_extent(sendtype, &lb, &send_elsize);
+    MPI_Type_get_extent(recvtype, &lb, &recv_elsize);
+
+    const size_t maxcount = INT_MAX;
+
+    size_t n_requests_max = 0;
+    int i;
+    for(i = 0; i < NTask; i ++) {
+        n_requests_max += (sendcnts[i] + maxcount - 1) / maxcount;
+        n_requests_max += (recvcnts[i] + maxcount - 1) / maxcount;
+    }
+
+    MPI_Request * requests = malloc(sizeof(MPI_Request) * (n_requests_max + 1));
+    int n_requests = 0;
+
+    for(ngrp = 0; ngrp < (1 << PTask); ngrp++)
+    {
+        int target = ThisTask ^ ngrp;
+
+        if(target >= NTask) continue;
+        size_t offset;
+        for(offset = 0; offset < recvcnts[target]; offset += maxcount) {
+            size_t n = recvcnts[target] - offset;
+            if(n > maxcount) n = maxcount;
+            MPI_Irecv(
+                    ((char*) recvbuf) + recv_elsize * (rdispls[target] + offset),
+                    n, recvtype, target, 101935, comm, &requests[n_requests++]);
+        }
+    }
+
+    MPI_Barrier(comm);
+
+    for(ngrp = 0; ngrp < (1 << PTask); ngrp++)
+    {
+        int target = ThisTask ^ ngrp;
+        if(target >= NTask) continue;
+        size_t offset;
+        for(offset = 0; offset < sendcnts[target]; offset += maxcount) {
+            size_t n = sendcnts[target] - offset;
+            if(n > maxcount) n = maxcount;
+            MPI_Isend(
+                    ((char*) sendbuf) + send_elsize * (sdispls[target] + offset),
+                    n, sendtype, target, 101935, comm, &requests[n_requests++]);
+        }
+    }
+
+    MPI_Waitall(n_requests, requests, MPI_STATUSES_IGNORE);
+    free(requests);
+
+    for(ngrp = 0; ngrp < (1 << PTask); ngrp++) {
+        int target = ThisTask ^ ngrp;
+        if(target >= NTask) continue;
+        if(recvcnts[target] == 0) continue;
+
+        VALGRIND_MAKE_MEM_DEFINED(((char*) recvbuf) + recv_elsize * rdispls[target], recv_elsize * recvcnts[target]);
+    }
+
+    /* ensure the collective-ness */
+    MPI_Barrier(comm);
+
+    return 0;
+}
+
+int MPI_Alltoallv_sparse_64(void *sendbuf, size_t *sendcnts, size_t *sdispls,
+        MPI_Datatype sendtype, void *recvbuf, size_t *recvcnts,
+        size_t *rdispls, MPI_Datatype recvtype, MPI_Comm comm) {
+
+    PMNodeTopology * topo = _node_aware_topology(comm, sendtype, recvtype);
+    if(topo) {
+        return _alltoallv_node_aware(sendbuf, sendcnts, sdispls,
+                recvbuf, recvcnts, rdispls, _type_extent(sendtype), comm, topo);
+    }
+    return _alltoallv_flat_64(sendbuf, sendcnts, sdispls, sendtype,
+                recvbuf, recvcnts, rdispls, recvtype, comm);
+}
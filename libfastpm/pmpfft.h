@@ -32,8 +32,25 @@ typedef struct {
     int NprocY;
     int transposed;
     int use_fftw;
+    int batch;  /* use batched plans in pm_c2r_many; 0 for a plan per field */
+    int precision; /* of the transforms, 32 or 64, up to FASTPM_FFT_PRECISION; 0 for FASTPM_FFT_PRECISION */
 } PMInit;
 
+/* maximum number of fields in a batched transform */
+#define PM_MAX_BATCH 8
+
+
+/* maximum number of ghost windows with a cached neighbour graph */
+#define PM_MAX_GHOST_GRAPH 4
+
+/* the ranks that can exchange ghosts for a window of cells, as a distributed graph. */
+typedef struct PMGhostGraph {
+    int window[2][2];   /* cells below and above a cell, along x and y */
+    MPI_Comm comm;      /* the neighbour graph on Comm2D, with the same ranks */
+    int degree;
+    int * ranks;        /* [degree] the neighbours, as ranks of Comm2D */
+} PMGhostGraph;
+
 typedef struct {
     ptrdiff_t * edges_int[2];
     double * edges_float[2];
@@ -49,8 +66,16 @@ struct PM {
     void * r2c;   /* Forward r2c plan */
     void * c2r;   /* Bacward c2r plan */
 
+    /* batched plans, indexed by the number of fields; created on first use. */
+    void * r2c_batch[PM_MAX_BATCH + 1];
+    void * c2r_batch[PM_MAX_BATCH + 1];
+
+    /* neighbour graphs of the ghost exchange, by window; created on first use. */
+    PMGhostGraph * ghost_graph[PM_MAX_GHOST_GRAPH];
+
     int Nproc[2];
     MPI_Comm Comm2D;
+    MPI_Comm Comm1D[2]; /* the ranks along each decomposed direction, from Comm2D */
 
     ptrdiff_t Nmesh[3];
     double    BoxSize[3];
@@ -75,6 +100,12 @@ pm_module_init();
 void
 pm_module_cleanup();
 
+int
+pm_module_import_wisdom(const char * filename, MPI_Comm comm);
+
+int
+pm_module_export_wisdom(const char * filename, MPI_Comm comm);
+
 /* Initializing a PM object. */
 void 
 pm_init(PM * pm, PMInit * init, MPI_Comm comm);
@@ -96,6 +127,11 @@ int MPI_Alltoallv_sparse(void *sendbuf, int *sendcnts, int *sdispls,
         MPI_Datatype sendtype, void *recvbuf, int *recvcnts,
         int *rdispls, MPI_Datatype recvtype, MPI_Comm comm);
 
+/* Same as MPI_Alltoallv_sparse, but counts and displacements are 64-bit. */
+int MPI_Alltoallv_sparse_64(void *sendbuf, size_t *sendcnts, size_t *sdispls,
+        MPI_Datatype sendtype, void *recvbuf, size_t *recvcnts,
+        size_t *rdispls, MPI_Datatype recvtype, MPI_Comm comm);
+
 static inline size_t cumsum(int * out, int * in, size_t nitems) {
     size_t total = 0;
     int i;
@@ -110,3 +146,17 @@ static inline size_t cumsum(int * out, int * in, size_t nitems) {
     return total;
 }
 
+static inline size_t cumsum64(size_t * out, size_t * in, size_t nitems) {
+    size_t total = 0;
+    size_t i;
+    for(i = 0; i < nitems; i ++) {
+        total += in[i];
+        if (out == NULL) continue;
+        if(i >= 1)
+            out[i] = out[i - 1] + in[i - 1];
+        else
+            out[i] = 0;
+    }
+    return total;
+}
+
@@ -12,10 +12,11 @@
 #include "pmpfft.h"
 #include "pm2lpt.h"
 #include "pmghosts.h"
+#include "pmdomain.h"
 #include "vpm.h"
 
 static void
-fastpm_decompose(FastPMSolver * fastpm, PM * pm);
+fastpm_decompose(FastPMSolver * fastpm, PM * pm, int support);
 
 
 #define MAX(a, b) (a)>(b)?(a):(b)
@@ -66,6 +67,9 @@ void fastpm_solver_init(FastPMSolver * fastpm,
     }
 
     fastpm->event_handlers = NULL;
+    fastpm->domain = NULL;
+    fastpm->skinpm = NULL;
+    fastpm->ndecompose = 0;
 
     PMInit baseinit = {
             .Nmesh = config->nc,
@@ -73,6 +77,8 @@ void fastpm_solver_init(FastPMSolver * fastpm,
             .NprocY = config->NprocY, /* 0 for auto, 1 for slabs */
             .transposed = 1,
             .use_fftw = config->UseFFTW,
+            .batch = config->FFTBatch,
+            .precision = config->ForceFFTPrecision, /* the force meshes only; IC and LPT use the full precision */
         };
 
     fastpm->comm = comm;
@@ -82,8 +88,13 @@ void fastpm_solver_init(FastPMSolver * fastpm,
 
     if(config->FORCE_TYPE == FASTPM_FORCE_COLA) {
         /* Cola requires DX1 and DX2 to be permantly stored. */
-        config->ExtraAttributes |= COLUMN_DX1;
-        config->ExtraAttributes |= COLUMN_DX2;
+        if(config->CompactLPTDisplacement) {
+            config->ExtraAttributes |= COLUMN_DX1_FIXED;
+            config->ExtraAttributes |= COLUMN_DX2_FIXED;
+        } else {
+            config->ExtraAttributes |= COLUMN_DX1;
+            config->ExtraAttributes |= COLUMN_DX2;
+        }
     }
 
     memset(fastpm->has_species, 0, FASTPM_SOLVER_NSPECIES);
@@ -91,7 +102,8 @@ void fastpm_solver_init(FastPMSolver * fastpm,
     fastpm_store_init_evenly(fastpm->cdm,
           fastpm_species_get_name(FASTPM_SPECIES_CDM),
           pow(1.0 * config->nc, 3),
-          COLUMN_POS | COLUMN_VEL | COLUMN_ID | COLUMN_MASK | COLUMN_RAND | COLUMN_ACC | config->ExtraAttributes,
+          (config->CompactPosition ? COLUMN_POS_FIXED : COLUMN_POS)
+          | COLUMN_VEL | COLUMN_ID | COLUMN_MASK | COLUMN_RAND | COLUMN_ACC | config->ExtraAttributes,
           config->alloc_factor,
           comm);
 
@@ -106,6 +118,7 @@ void fastpm_solver_init(FastPMSolver * fastpm,
             .NprocY = config->NprocY, /* 0 for auto, 1 for slabs */
             .transposed = 0, /* use untransposed to make sure we see all kz on a rank; this speeds up IC */
             .use_fftw = config->UseFFTW,
+            .batch = config->FFTBatch,
         };
 
     fastpm->basepm = malloc(sizeof(PM));
@@ -126,6 +139,7 @@ void fastpm_solver_init(FastPMSolver * fastpm,
             .NprocY = config->NprocY, /* 0 for auto, 1 for slabs */
             .transposed = 0, /* use untransposed to make sure we see all kz on a rank; this speeds up IC */
             .use_fftw = config->UseFFTW,
+            .batch = config->FFTBatch,
         };
 
     fastpm->lptpm = malloc(sizeof(PM));
@@ -218,6 +232,9 @@ fastpm_solver_setup_lpt(FastPMSolver * fastpm,
     fastpm_emit_event(fastpm->event_handlers, FASTPM_EVENT_LPT,
                 FASTPM_EVENT_STAGE_AFTER, (FastPMEvent*) event, fastpm);
 
+    /* keep the compact displacements, if the store has them */
+    fastpm_store_encode_lpt_displacement(p, fastpm->comm);
+
     if(temp_dv1) {
         fastpm_memory_free(p->mem, p->dv1);
         p->dv1 = NULL;
@@ -235,9 +252,11 @@ fastpm_solver_setup_lpt(FastPMSolver * fastpm,
 static void
 fastpm_do_warmup(FastPMSolver * fastpm, double a0);
 static void
-fastpm_do_kick(FastPMSolver * fastpm, FastPMTransition * trans);
+fastpm_do_kick(FastPMSolver * fastpm, FastPMTransition * trans, FastPMTransition * next);
 static void
-fastpm_do_drift(FastPMSolver * fastpm, FastPMTransition * trans);
+fastpm_do_drift(FastPMSolver * fastpm, FastPMTransition * trans, FastPMTransition * next);
+static int
+fastpm_can_fuse(FastPMSolver * fastpm, FastPMTransition * trans, FastPMTransition * next);
 static void
 fastpm_do_force(FastPMSolver * fastpm, FastPMTransition * trans);
 
@@ -298,27 +317,41 @@ fastpm_solver_evolve(FastPMSolver * fastpm, double * time_step, int nstep)
     fastpm_tevo_generate_states(states, nstep-1, template, time_step);
 
     FastPMTransition transition[1];
+    FastPMTransition next[1];
 
     /* The last step is the 'terminal' step */
     int i;
     for(i = 1; states->table[i].force != -1; i ++) {
         fastpm_tevo_transition_init(transition, states, i - 1, i);
 
+        /* the following transition, if it is applied in the same pass over the particles */
+        int fused = 0;
+        if(states->table[i + 1].force != -1) {
+            fastpm_tevo_transition_init(next, states, i, i + 1);
+            fused = fastpm_can_fuse(fastpm, transition, next);
+        }
+
         FastPMTransitionEvent event[1];
         event->transition = transition;
+        FastPMTransitionEvent nextevent[1];
+        nextevent->transition = next;
 
         CLOCK(beforetransit);
         ENTER(beforetransit);
         fastpm_emit_event(fastpm->event_handlers, FASTPM_EVENT_TRANSITION,
                 FASTPM_EVENT_STAGE_BEFORE, (FastPMEvent*) event, fastpm);
+        if(fused) {
+            fastpm_emit_event(fastpm->event_handlers, FASTPM_EVENT_TRANSITION,
+                    FASTPM_EVENT_STAGE_BEFORE, (FastPMEvent*) nextevent, fastpm);
+        }
         LEAVE(beforetransit);
 
         switch(transition->action) {
             case FASTPM_ACTION_KICK:
-                fastpm_do_kick(fastpm, transition);
+                fastpm_do_kick(fastpm, transition, fused?next:NULL);
             break;
             case FASTPM_ACTION_DRIFT:
-                fastpm_do_drift(fastpm, transition);
+                fastpm_do_drift(fastpm, transition, fused?next:NULL);
             break;
             case FASTPM_ACTION_FORCE:
                 fastpm_do_force(fastpm, transition);
@@ -329,8 +362,15 @@ fastpm_solver_evolve(FastPMSolver * fastpm, double * time_step, int nstep)
         ENTER(aftertransit);
         fastpm_emit_event(fastpm->event_handlers, FASTPM_EVENT_TRANSITION,
                 FASTPM_EVENT_STAGE_AFTER, (FastPMEvent*) event, fastpm);
+        if(fused) {
+            fastpm_emit_event(fastpm->event_handlers, FASTPM_EVENT_TRANSITION,
+                    FASTPM_EVENT_STAGE_AFTER, (FastPMEvent*) nextevent, fastpm);
+        }
         LEAVE(aftertransit);
 
+        /* the next transition is done */
+        if(fused) i ++;
+
         if(i == 1) {
             /* Special treatment on the initial state because the
              * interpolation ranges are semi closed -- (, ] . we miss the initial step otherwise.
@@ -422,6 +462,7 @@ fastpm_do_force(FastPMSolver * fastpm, FastPMTransition * trans)
     int64_t N = p->np;
 
     fastpm_painter_init(painter, pm, fastpm->config->PAINTER_TYPE, fastpm->config->painter_support);
+    painter->use_atomic = fastpm->config->PaintAtomic;
 
     MPI_Allreduce(MPI_IN_PLACE, &N, 1, MPI_LONG, MPI_SUM, fastpm->comm);
 
@@ -446,7 +487,7 @@ fastpm_do_force(FastPMSolver * fastpm, FastPMTransition * trans)
     }
 
     ENTER(decompose);
-    fastpm_decompose(fastpm, pm);
+    fastpm_decompose(fastpm, pm, painter->support);
     LEAVE(decompose);
 
     fastpm_emit_event(fastpm->event_handlers, FASTPM_EVENT_FORCE, FASTPM_EVENT_STAGE_BEFORE, (FastPMEvent*) event, fastpm);
@@ -477,8 +518,26 @@ fastpm_do_force(FastPMSolver * fastpm, FastPMTransition * trans)
 
 }
 
+/* Two kicks in a row (the closing kick of a step and the opening kick of the next),
+ * or two drifts in a row (to and from the synchronization point) use the same reference
+ * time, and the factors add up; they can be applied in one pass over the particles.
+ * The second transition must not end on a synchronization point, where the
+ * interpolation needs the particles between the two. A kick is never followed by a
+ * drift without such an interpolation in between. */
+static int
+fastpm_can_fuse(FastPMSolver * fastpm, FastPMTransition * trans, FastPMTransition * next)
+{
+    if(!fastpm->config->FuseHalfSteps) return 0;
+    if(trans->action != next->action) return 0;
+    if(trans->action != FASTPM_ACTION_KICK && trans->action != FASTPM_ACTION_DRIFT) return 0;
+    if(next->end->x == next->end->v) return 0;
+    if(trans->a.r != next->a.r) return 0;
+    return 1;
+}
+
+/* next: a kick to apply in the same pass, or NULL */
 static void
-fastpm_do_kick(FastPMSolver * fastpm, FastPMTransition * trans)
+fastpm_do_kick(FastPMSolver * fastpm, FastPMTransition * trans, FastPMTransition * next)
 {
 
     CLOCK(kick);
@@ -499,6 +558,11 @@ fastpm_do_kick(FastPMSolver * fastpm, FastPMTransition * trans)
     }
 
     /* Do kick */
+    double af = trans->a.f;
+    if(next) {
+        af = next->a.f;
+        fastpm_kick_init(&kick, fastpm, trans->a.i, trans->a.r, af);
+    }
     ENTER(kick);
     int si;
     for(si = 0; si < FASTPM_SOLVER_NSPECIES; si++) {
@@ -511,13 +575,14 @@ fastpm_do_kick(FastPMSolver * fastpm, FastPMTransition * trans)
         if(kick.ac != p->meta.a_x) {
             fastpm_raise(-1, "kick is inconsitant with state.\n");
         }
-        fastpm_kick_store(&kick, p, p, trans->a.f);
+        fastpm_kick_store(&kick, p, p, af);
     }
     LEAVE(kick);
 }
 
+/* next: a drift to apply in the same pass, or NULL */
 static void
-fastpm_do_drift(FastPMSolver * fastpm, FastPMTransition * trans)
+fastpm_do_drift(FastPMSolver * fastpm, FastPMTransition * trans, FastPMTransition * next)
 {
     CLOCK(drift);
 
@@ -537,7 +602,15 @@ fastpm_do_drift(FastPMSolver * fastpm, FastPMTransition * trans)
     }
 
     /* Do drift */
+    double af = trans->a.f;
+    if(next) {
+        af = next->a.f;
+        fastpm_drift_init(&drift, fastpm, trans->a.i, trans->a.r, af);
+        /* each drift adds half of the PGD displacement */
+        drift.pgdc_weight = 1.0;
+    }
     ENTER(drift);
+    double dxmax = 0;
     int si;
     for(si = 0; si < FASTPM_SOLVER_NSPECIES; si++) {
         FastPMStore * p = fastpm_solver_get_species(fastpm, si);
@@ -549,9 +622,11 @@ fastpm_do_drift(FastPMSolver * fastpm, FastPMTransition * trans)
         if(drift.ac != p->meta.a_v) {
             fastpm_raise(-1, "drift is inconsitant with state.\n");
         }
-        fastpm_drift_store(&drift, p, p, trans->a.f);
-        LEAVE(drift);
+        double dx = fastpm_drift_store(&drift, p, p, af);
+        if(dx > dxmax) dxmax = dx;
     }
+    LEAVE(drift);
+    fastpm->skindrift += dxmax;
 }
 
 void
@@ -564,31 +639,146 @@ fastpm_solver_destroy(FastPMSolver * fastpm)
     fastpm_store_destroy(fastpm->cdm);
     vpm_free(fastpm->vpm_list);
 
+    if(fastpm->domain) {
+        pm_domain_destroy(fastpm->domain);
+        free(fastpm->domain);
+    }
+
     fastpm_cosmology_destroy(fastpm->cosmology);
     fastpm_destroy_event_handlers(&fastpm->event_handlers);
 }
 
+/* Mark the particles farther than skin from the edges of the local PM region.
+ * Only x and y are decomposed; z is tested against the box such that the
+ * interior particles never need to be wrapped. */
 static void
-fastpm_decompose(FastPMSolver * fastpm, PM * pm) {
+_fastpm_mark_interior(PM * pm, FastPMStore * p, double skin, FastPMParticleMaskType * interior)
+{
+    double lo[3], hi[3];
+    int d;
+    for(d = 0; d < 2; d ++) {
+        lo[d] = pm->IRegion.start[d] * pm->CellSize[d] + skin;
+        hi[d] = (pm->IRegion.start[d] + pm->IRegion.size[d]) * pm->CellSize[d] - skin;
+    }
+    lo[2] = skin;
+    hi[2] = pm->BoxSize[2] - skin;
+
+    ptrdiff_t i;
+#pragma omp parallel for
+    for(i = 0; i < p->np; i ++) {
+        double pos[3];
+        fastpm_store_get_position(p, i, pos);
+        int d;
+        interior[i] = 1;
+        for(d = 0; d < 3; d ++) {
+            if(pos[d] < lo[d] || pos[d] >= hi[d]) {
+                interior[i] = 0;
+                break;
+            }
+        }
+    }
+}
+
+static void
+fastpm_decompose(FastPMSolver * fastpm, PM * pm, int support) {
 
     int NTask;
     MPI_Comm_size(fastpm->comm, &NTask);
 
+    /* While no particle can have moved through the skin since the last full
+     * decomposition, only the particles in the skin are tested. */
+    int incremental = fastpm->config->DecomposeSkin > 0
+                   && !fastpm->config->BalancedDomain
+                   && fastpm->skinpm == pm
+                   && fastpm->skindrift < fastpm->skin;
+
+    if(incremental) {
+        fastpm_info("Decomposing the skin only; drifted %g of a skin of %g.\n", fastpm->skindrift, fastpm->skin);
+    }
+
+    FastPMStore * stores[FASTPM_SOLVER_NSPECIES];
+    ptrdiff_t start[FASTPM_SOLVER_NSPECIES];
+    int species[FASTPM_SOLVER_NSPECIES];
+    int nstores = 0;
+
     int si;
     for(si = 0; si < FASTPM_SOLVER_NSPECIES; si ++) {
         FastPMStore * p = fastpm_solver_get_species(fastpm, si);
         if(!p) continue;
 
-        /* apply periodic boundary and move particles to the correct rank */
-        fastpm_store_wrap(p, pm->BoxSize);
+        start[nstores] = incremental ? fastpm->ninterior[si] : 0;
+        species[nstores] = si;
 
-        if(0 != fastpm_store_decompose(p,
+        /* apply periodic boundary */
+        fastpm_store_wrap_from(p, start[nstores], pm->BoxSize);
+        stores[nstores++] = p;
+    }
+
+    /* the balanced domains follow the particles; the mesh domains only depend on pm. */
+    int keep = fastpm->domain
+            && !fastpm->config->BalancedDomain
+            && fastpm->domain->pm == pm
+            && fastpm->domain->margin == support + 1;
+
+    if(fastpm->domain && !keep) {
+        pm_domain_destroy(fastpm->domain);
+        free(fastpm->domain);
+        fastpm->domain = NULL;
+    }
+
+    if(fastpm->config->BalancedDomain) {
+        /* one more cell, as the kernel of a particle on an edge may start before its cell */
+        fastpm->domain = malloc(sizeof(PMDomain));
+        pm_domain_init(fastpm->domain, pm, stores, nstores, support + 1);
+    } else if(fastpm->config->MeshHalo && !fastpm->domain) {
+        fastpm->domain = malloc(sizeof(PMDomain));
+        pm_domain_init_mesh(fastpm->domain, pm, support + 1);
+    }
+
+    for(si = 0; si < nstores; si ++) {
+        FastPMStore * p = stores[si];
+
+        /* move particles to the correct rank */
+        int failed;
+        if(fastpm->config->BalancedDomain) {
+            failed = fastpm_store_decompose(p,
+                (fastpm_store_target_func) FastPMTargetDomain, fastpm->domain,
+                fastpm->comm);
+        } else {
+            failed = fastpm_store_decompose_from(p, start[si],
                 (fastpm_store_target_func) FastPMTargetPM, pm,
-                fastpm->comm))
+                fastpm->comm);
+        }
+        if(0 != failed)
         {
             fastpm_raise(-1, "Out of particle storage space\n");
         }
     }
+
+    if(fastpm->config->LocalSortInterval > 0 && !incremental) {
+        /* before marking the interior; the partition keeps the order. */
+        if(fastpm->ndecompose % fastpm->config->LocalSortInterval == 0) {
+            for(si = 0; si < nstores; si ++) {
+                fastpm_store_sort(stores[si], FastPMLocalSortByMorton, pm->BoxSize);
+            }
+        }
+        fastpm->ndecompose ++;
+    }
+
+    if(fastpm->config->DecomposeSkin > 0 && !fastpm->config->BalancedDomain && !incremental) {
+        /* move the interior particles to the front; the particles received
+         * later are appended to the skin. */
+        fastpm->skin = fastpm->config->DecomposeSkin * pm->CellSize[0];
+        for(si = 0; si < nstores; si ++) {
+            FastPMStore * p = stores[si];
+            FastPMParticleMaskType * interior = fastpm_memory_alloc(p->mem, "Interior", sizeof(interior[0]) * p->np, FASTPM_MEMORY_STACK);
+            _fastpm_mark_interior(pm, p, fastpm->skin, interior);
+            fastpm->ninterior[species[si]] = fastpm_store_partition(p, interior);
+            fastpm_memory_free(p->mem, interior);
+        }
+        fastpm->skinpm = pm;
+        fastpm->skindrift = 0;
+    }
 }
 
 /* Interpolate position and velocity for snapshot at a=aout,
@@ -609,6 +799,9 @@ fastpm_set_snapshot(FastPMSolver * fastpm,
                 FastPMKickFactor * kick,
                 double aout) {
 
+    /* the snapshot shares the columns and may be reordered; e.g. by FOF. */
+    fastpm->skinpm = NULL;
+
     int si;
     for (si = 0; si < FASTPM_SOLVER_NSPECIES; si ++) {
         FastPMStore * p, *po;
@@ -654,6 +847,7 @@ fastpm_set_species_snapshot(FastPMSolver * fastpm,
     FastPMCosmology * c = fastpm->cosmology;
     PM * pm = fastpm->basepm;
     int np = p->np;
+    ptrdiff_t i;
 
     memcpy(po, p, sizeof(FastPMStore));
 
@@ -664,6 +858,30 @@ fastpm_set_species_snapshot(FastPMSolver * fastpm,
     /* Fake the attributes */
     po->attributes = p->attributes;
 
+    if(p->x == NULL) {
+        /* the snapshot of a compact store has the positions in a temporary double column;
+         * the compact positions stay in p and follow the reordering of po. */
+        po->x = fastpm_memory_alloc(p->mem, "SnapshotX", sizeof(po->x[0]) * p->np_upper, FASTPM_MEMORY_FLOATING);
+        po->attributes |= COLUMN_POS;
+        if(!drift) {
+            for(i = 0; i < np; i ++) {
+                double pos[3];
+                fastpm_store_get_position(p, i, pos);
+                fastpm_store_set_position(po, i, pos);
+            }
+        }
+    }
+    /* likewise for the compact LPT displacements. */
+    if(p->dx1 == NULL && p->dx1fix != NULL) {
+        po->dx1 = fastpm_memory_alloc(p->mem, "SnapshotDX1", sizeof(po->dx1[0]) * p->np_upper, FASTPM_MEMORY_FLOATING);
+        po->attributes |= COLUMN_DX1;
+    }
+    if(p->dx2 == NULL && p->dx2fix != NULL) {
+        po->dx2 = fastpm_memory_alloc(p->mem, "SnapshotDX2", sizeof(po->dx2[0]) * p->np_upper, FASTPM_MEMORY_FLOATING);
+        po->attributes |= COLUMN_DX2;
+    }
+    fastpm_store_decode_lpt_displacement(po);
+
     if(drift) {
         /* update position; before kick to use the old velocity */
         fastpm_drift_store(drift, p, po, aout);
@@ -673,7 +891,6 @@ fastpm_set_species_snapshot(FastPMSolver * fastpm,
         /* update velocity */
         fastpm_kick_store(kick, p, po, aout);
     }
-    ptrdiff_t i;
 
     /* convert units */
 
@@ -744,13 +961,42 @@ fastpm_unset_species_snapshot(FastPMSolver * fastpm,
         /* revert velocity */
         fastpm_kick_store(kick, po, po, p->meta.a_v);
     }
-    if(drift) {
+    if(po->x != p->x) {
+        /* a compact store; the compact positions are still at p->meta.a_x if drifted,
+         * otherwise take the positions (e.g. read from a snapshot). */
+        if(drift) {
+            po->meta.a_x = p->meta.a_x;
+        } else {
+            for(i = 0; i < np; i ++) {
+                double pos[3];
+                fastpm_store_get_position(po, i, pos);
+                fastpm_store_set_position(p, i, pos);
+            }
+        }
+    } else if(drift) {
         /* revert position */
         fastpm_drift_store(drift, po, po, p->meta.a_x);
     }
+    if(!drift) {
+        /* take the LPT displacements (e.g. read from a snapshot) into the compact columns */
+        fastpm_store_encode_lpt_displacement(po, fastpm->comm);
+    }
     /* steal back columns */
     fastpm_store_steal(po, p, p->attributes);
 
+    if(po->dx2 != p->dx2) {
+        fastpm_memory_free(p->mem, po->dx2);
+        po->dx2 = NULL;
+    }
+    if(po->dx1 != p->dx1) {
+        fastpm_memory_free(p->mem, po->dx1);
+        po->dx1 = NULL;
+    }
+    if(po->x != p->x) {
+        fastpm_memory_free(p->mem, po->x);
+        po->x = NULL;
+    }
+
     fastpm_store_wrap(p, pm->BoxSize);
 
     /* Stop faking the attributes */
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <limits.h>
 
 #include <mpi.h>
 #include <pfft.h>
@@ -8,6 +9,10 @@
 #include <fastpm/logging.h>
 #include "pmpfft.h"
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #define HAS(a, b) ((a & b) != 0)
 
 static void
@@ -90,6 +95,89 @@ from_double_f4 (FastPMStore * p, ptrdiff_t index, int ci, int memb, const double
     ptr[memb] = value;
 }
 
+/* The compact position is a fixed-point fraction of meta._x_box;
+ * the integer overflow wraps the position into the box. */
+static inline double
+_xfix_to_double(uint32_t u, double box)
+{
+    return u * (box / 4294967296.0);
+}
+
+static inline uint32_t
+_xfix_from_double(double x, double box)
+{
+    /* round to the nearest; the conversion from signed to unsigned is modular. */
+    return (uint32_t) (int64_t) floor(x * (4294967296.0 / box) + 0.5);
+}
+
+static double
+to_double_xfix (FastPMStore * p, ptrdiff_t index, int ci, int memb)
+{
+    size_t nmemb = p->_column_info[ci].nmemb ;
+    if(memb > nmemb) {
+        fastpm_raise(-1, "memb %d greater than nmemb %d", memb, nmemb);
+    }
+    size_t elsize = p->_column_info[ci].elsize;
+
+    uint32_t * ptr = (uint32_t*) (p->columns[ci] + index * elsize);
+
+    return _xfix_to_double(ptr[memb], p->meta._x_box[memb]);
+}
+
+static void
+from_double_xfix (FastPMStore * p, ptrdiff_t index, int ci, int memb, const double value)
+{
+    size_t nmemb = p->_column_info[ci].nmemb ;
+    if(memb > nmemb) {
+        fastpm_raise(-1, "memb %d greater than nmemb %d", memb, nmemb);
+    }
+    size_t elsize = p->_column_info[ci].elsize;
+
+    uint32_t * ptr = (uint32_t*) (p->columns[ci] + index * elsize);
+
+    ptr[memb] = _xfix_from_double(value, p->meta._x_box[memb]);
+}
+
+/* The compact LPT displacement is a 16-bit multiple of meta._dx_scale. */
+static inline int16_t
+_dxfix_from_double(double dx, double scale)
+{
+    double u = floor(dx / scale + 0.5);
+    if(u > INT16_MAX) u = INT16_MAX;
+    if(u < -INT16_MAX) u = -INT16_MAX;
+    return u;
+}
+
+static double
+to_double_dxfix (FastPMStore * p, ptrdiff_t index, int ci, int memb)
+{
+    size_t nmemb = p->_column_info[ci].nmemb ;
+    if(memb > nmemb) {
+        fastpm_raise(-1, "memb %d greater than nmemb %d", memb, nmemb);
+    }
+    size_t elsize = p->_column_info[ci].elsize;
+    int k = p->_column_info[ci].attribute == COLUMN_DX2_FIXED;
+
+    int16_t * ptr = (int16_t*) (p->columns[ci] + index * elsize);
+
+    return ptr[memb] * p->meta._dx_scale[k];
+}
+
+static void
+from_double_dxfix (FastPMStore * p, ptrdiff_t index, int ci, int memb, const double value)
+{
+    size_t nmemb = p->_column_info[ci].nmemb ;
+    if(memb > nmemb) {
+        fastpm_raise(-1, "memb %d greater than nmemb %d", memb, nmemb);
+    }
+    size_t elsize = p->_column_info[ci].elsize;
+    int k = p->_column_info[ci].attribute == COLUMN_DX2_FIXED;
+
+    int16_t * ptr = (int16_t*) (p->columns[ci] + index * elsize);
+
+    ptr[memb] = _dxfix_from_double(value, p->meta._dx_scale[k]);
+}
+
 const char *
 fastpm_species_get_name(enum FastPMSpecies species)
 {
@@ -105,9 +193,36 @@ fastpm_species_get_name(enum FastPMSpecies species)
 }
 void fastpm_store_get_position(FastPMStore * p, ptrdiff_t index, double pos[3])
 {
-    pos[0] = p->x[index][0];
-    pos[1] = p->x[index][1];
-    pos[2] = p->x[index][2];
+    if(p->x) {
+        pos[0] = p->x[index][0];
+        pos[1] = p->x[index][1];
+        pos[2] = p->x[index][2];
+    } else {
+        pos[0] = _xfix_to_double(p->xfix[index][0], p->meta._x_box[0]);
+        pos[1] = _xfix_to_double(p->xfix[index][1], p->meta._x_box[1]);
+        pos[2] = _xfix_to_double(p->xfix[index][2], p->meta._x_box[2]);
+    }
+}
+
+void fastpm_store_set_position(FastPMStore * p, ptrdiff_t index, const double pos[3])
+{
+    if(p->x) {
+        p->x[index][0] = pos[0];
+        p->x[index][1] = pos[1];
+        p->x[index][2] = pos[2];
+    } else {
+        p->xfix[index][0] = _xfix_from_double(pos[0], p->meta._x_box[0]);
+        p->xfix[index][1] = _xfix_from_double(pos[1], p->meta._x_box[1]);
+        p->xfix[index][2] = _xfix_from_double(pos[2], p->meta._x_box[2]);
+    }
+}
+
+/* the column holding the positions: COLUMN_POS, or COLUMN_POS_FIXED for a compact store */
+FastPMColumnTags
+fastpm_store_get_position_attribute(FastPMStore * p)
+{
+    if(p->x == NULL && p->xfix != NULL) return COLUMN_POS_FIXED;
+    return COLUMN_POS;
 }
 
 void fastpm_store_get_lagrangian_position(FastPMStore * p, ptrdiff_t index, double pos[3])
@@ -117,6 +232,82 @@ void fastpm_store_get_lagrangian_position(FastPMStore * p, ptrdiff_t index, doub
     pos[2] = p->q[index][2];
 }
 
+/* dx1 and dx2 of a particle, from either the float or the compact columns; zero if neither exists. */
+void fastpm_store_get_lpt_displacement(FastPMStore * p, ptrdiff_t index, float dx1[3], float dx2[3])
+{
+    int d;
+    for(d = 0; d < 3; d ++) {
+        if(p->dx1) {
+            dx1[d] = p->dx1[index][d];
+        } else if(p->dx1fix) {
+            dx1[d] = p->dx1fix[index][d] * p->meta._dx_scale[0];
+        } else {
+            dx1[d] = 0;
+        }
+        if(p->dx2) {
+            dx2[d] = p->dx2[index][d];
+        } else if(p->dx2fix) {
+            dx2[d] = p->dx2fix[index][d] * p->meta._dx_scale[1];
+        } else {
+            dx2[d] = 0;
+        }
+    }
+}
+
+/* Encode dx1 and dx2 into dx1fix and dx2fix, where both columns of a pair exist.
+ *
+ * The unit is shared by all ranks, such that the largest displacement fits into 16 bits;
+ * the error of a displacement is at most half of the unit.
+ * */
+void
+fastpm_store_encode_lpt_displacement(FastPMStore * p, MPI_Comm comm)
+{
+    float * src[2] = {(float*) p->dx1, (float*) p->dx2};
+    int16_t * dest[2] = {(int16_t*) p->dx1fix, (int16_t*) p->dx2fix};
+
+    int k;
+    for(k = 0; k < 2; k ++) {
+        if(!src[k] || !dest[k]) continue;
+
+        double dxmax = 0;
+        ptrdiff_t i;
+#pragma omp parallel for reduction(max: dxmax)
+        for(i = 0; i < 3 * p->np; i ++) {
+            double dx = fabs(src[k][i]);
+            if(dx > dxmax) dxmax = dx;
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &dxmax, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+        double scale = (dxmax > 0) ? dxmax / INT16_MAX : 1;
+        p->meta._dx_scale[k] = scale;
+
+#pragma omp parallel for
+        for(i = 0; i < 3 * p->np; i ++) {
+            dest[k][i] = _dxfix_from_double(src[k][i], scale);
+        }
+        fastpm_info("%s: dx%d is stored in units of %g; max = %g\n", p->name, k + 1, scale, dxmax);
+    }
+}
+
+/* Decode dx1fix and dx2fix into dx1 and dx2, where both columns of a pair exist. */
+void
+fastpm_store_decode_lpt_displacement(FastPMStore * p)
+{
+    float * dest[2] = {(float*) p->dx1, (float*) p->dx2};
+    int16_t * src[2] = {(int16_t*) p->dx1fix, (int16_t*) p->dx2fix};
+
+    int k;
+    for(k = 0; k < 2; k ++) {
+        if(!src[k] || !dest[k]) continue;
+        double scale = p->meta._dx_scale[k];
+        ptrdiff_t i;
+#pragma omp parallel for
+        for(i = 0; i < 3 * p->np; i ++) {
+            dest[k][i] = src[k][i] * scale;
+        }
+    }
+}
+
 double fastpm_store_get_mass(FastPMStore * p, ptrdiff_t index)
 {
     /* total mass is the sum of the base and the extra */
@@ -208,6 +399,9 @@ fastpm_store_init_details(FastPMStore * p,
     DEFINE_COLUMN(mass, COLUMN_MASS, "f4", 1);
     DEFINE_COLUMN(rand, COLUMN_RAND, "f4", 1);
     DEFINE_COLUMN(rmom, COLUMN_RMOM, "f4", 1);
+    DEFINE_COLUMN(xfix, COLUMN_POS_FIXED, "u4", 3);
+    DEFINE_COLUMN(dx1fix, COLUMN_DX1_FIXED, "i2", 3);
+    DEFINE_COLUMN(dx2fix, COLUMN_DX2_FIXED, "i2", 3);
 
     COLUMN_INFO(x).to_double = to_double_f8;
     COLUMN_INFO(v).to_double = to_double_f4;
@@ -218,6 +412,9 @@ fastpm_store_init_details(FastPMStore * p,
     COLUMN_INFO(acc).to_double = to_double_f4;
     COLUMN_INFO(mass).to_double = to_double_f4;
     COLUMN_INFO(rmom).to_double = to_double_f4;
+    COLUMN_INFO(xfix).to_double = to_double_xfix;
+    COLUMN_INFO(dx1fix).to_double = to_double_dxfix;
+    COLUMN_INFO(dx2fix).to_double = to_double_dxfix;
 
     COLUMN_INFO(rho).from_double = from_double_f4;
     COLUMN_INFO(acc).from_double = from_double_f4;
@@ -227,6 +424,9 @@ fastpm_store_init_details(FastPMStore * p,
     COLUMN_INFO(dv1).from_double = from_double_f4;
     COLUMN_INFO(potential).from_double = from_double_f4;
     COLUMN_INFO(tidal).from_double = from_double_f4;
+    COLUMN_INFO(xfix).from_double = from_double_xfix;
+    COLUMN_INFO(dx1fix).from_double = from_double_dxfix;
+    COLUMN_INFO(dx2fix).from_double = from_double_dxfix;
 
     ptrdiff_t size = 0;
     ptrdiff_t offset = 0;
@@ -254,6 +454,54 @@ fastpm_store_init_details(FastPMStore * p,
     };
 }
 
+/* Grow the storage of a store to hold np_upper particles, keeping the particles.
+ *
+ * The columns move with the memory block of the store; see fastpm_memory_realloc.
+ * Returns 0 on success, and -1 if the store does not own its columns (e.g. after
+ * fastpm_store_steal) or if the memory bound does not allow the growth.
+ * */
+int
+fastpm_store_grow(FastPMStore * p, size_t np_upper)
+{
+    if(np_upper <= p->np_upper) return 0;
+
+    ptrdiff_t oldoffset[32];
+    ptrdiff_t newoffset[32];
+    ptrdiff_t oldsize = 0;
+    ptrdiff_t newsize = 0;
+    int ci;
+    for(ci = 0; ci < 32; ci ++) {
+        if(!p->columns[ci]) continue;
+        size_t elsize = p->_column_info[ci].elsize;
+        /* the columns shall be laid out by fastpm_store_init */
+        if(p->columns[ci] != (char*) p->_base + oldsize) return -1;
+        oldoffset[ci] = oldsize;
+        newoffset[ci] = newsize;
+        oldsize += _alignsize(elsize * p->np_upper);
+        newsize += _alignsize(elsize * np_upper);
+    }
+
+    /* in place on the top of its pool the store only takes the difference; a store
+     * under other blocks is copied and keeps its old block until they are freed. */
+    if(fastpm_memory_realloc_cost(p->mem, p->_base, newsize) >= p->mem->free_bytes) return -1;
+
+    fastpm_ilog(INFO, "Growing storage of %s from %td to %td particles\n", p->name, p->np_upper, np_upper);
+
+    char * base = fastpm_memory_realloc(p->mem, "FastPMStore", p->_base, newsize);
+
+    /* the columns only move up; start from the last one */
+    for(ci = 31; ci >= 0; ci --) {
+        if(!p->columns[ci]) continue;
+        size_t elsize = p->_column_info[ci].elsize;
+        memmove(base + newoffset[ci], base + oldoffset[ci], elsize * p->np);
+        memset(base + newoffset[ci] + elsize * p->np, 0, elsize * (np_upper - p->np));
+        p->columns[ci] = base + newoffset[ci];
+    }
+    p->_base = base;
+    p->np_upper = np_upper;
+    return 0;
+}
+
 void
 fastpm_store_set_name(FastPMStore * p, const char * name)
 {
@@ -357,6 +605,134 @@ fastpm_packing_plan_unpack_ci(FastPMPackingPlan * plan, int ci,
         ((char*) packed) + offset);
 }
 
+/* records per block of the bulk packing; a block of a few columns stays in the cache. */
+#define PACKING_BLOCK 1024
+
+/* Copy n elements of elsize bytes between a column and the records of recsize bytes.
+ * The common element sizes are spelled out such that the copies are inlined. */
+static void
+_packing_gather(char * packed, size_t recsize, const char * column, size_t elsize,
+        const ptrdiff_t * index, ptrdiff_t start, size_t n)
+{
+    size_t j;
+#define GATHER(size) \
+    if(index) { \
+        for(j = 0; j < n; j ++) memcpy(packed + j * recsize, column + index[j] * (size), (size)); \
+    } else { \
+        for(j = 0; j < n; j ++) memcpy(packed + j * recsize, column + (start + j) * (size), (size)); \
+    } \
+    break;
+    switch(elsize) {
+        case 1: GATHER(1)
+        case 2: GATHER(2)
+        case 4: GATHER(4)
+        case 6: GATHER(6)
+        case 8: GATHER(8)
+        case 12: GATHER(12)
+        case 16: GATHER(16)
+        case 24: GATHER(24)
+        default: GATHER(elsize)
+    }
+#undef GATHER
+}
+
+static void
+_packing_scatter(char * column, size_t elsize, const char * packed, size_t recsize,
+        ptrdiff_t start, size_t n)
+{
+    size_t j;
+    column += start * elsize;
+#define SCATTER(size) \
+    for(j = 0; j < n; j ++) memcpy(column + j * (size), packed + j * recsize, (size)); \
+    break;
+    switch(elsize) {
+        case 1: SCATTER(1)
+        case 2: SCATTER(2)
+        case 4: SCATTER(4)
+        case 6: SCATTER(6)
+        case 8: SCATTER(8)
+        case 12: SCATTER(12)
+        case 16: SCATTER(16)
+        case 24: SCATTER(24)
+        default: SCATTER(elsize)
+    }
+#undef SCATTER
+}
+
+/* Pack n particles to consecutive records; the particles are index[0 .. n) or,
+ * if index is NULL, start .. start + n. The records are the same as those of
+ * fastpm_packing_plan_pack, but built column by column over blocks of particles. */
+void
+fastpm_packing_plan_pack_many(FastPMPackingPlan * plan,
+            FastPMStore * p, const ptrdiff_t * index, ptrdiff_t start, size_t n, void * packed)
+{
+    size_t recsize = plan->elsize;
+    size_t used = 0;
+    if(plan->Ncolumns > 0) {
+        int ci = plan->_ci[plan->Ncolumns - 1];
+        used = plan->_offsets[ci] + plan->_column_info[ci].elsize;
+    }
+    ptrdiff_t nblocks = (n + PACKING_BLOCK - 1) / PACKING_BLOCK;
+    ptrdiff_t b;
+#pragma omp parallel for
+    for(b = 0; b < nblocks; b ++) {
+        size_t j0 = b * PACKING_BLOCK;
+        size_t nb = j0 + PACKING_BLOCK > n ? n - j0 : PACKING_BLOCK;
+        char * rec = ((char*) packed) + j0 * recsize;
+        const ptrdiff_t * ind = index ? index + j0 : NULL;
+        size_t j;
+        int t;
+        for(t = 0; t < plan->Ncolumns; t ++) {
+            int ci = plan->_ci[t];
+            ptrdiff_t offset = plan->_offsets[ci];
+            if(plan->_column_info[ci].pack != pack_any) {
+                for(j = 0; j < nb; j ++) {
+                    plan->_column_info[ci].pack(p, ind ? ind[j] : start + j0 + j, ci, rec + j * recsize + offset);
+                }
+                continue;
+            }
+            _packing_gather(rec + offset, recsize, p->columns[ci], plan->_column_info[ci].elsize,
+                    ind, start + j0, nb);
+        }
+        /* the padding goes to the wire; keep it defined. */
+        if(used < recsize) {
+            for(j = 0; j < nb; j ++) {
+                memset(rec + j * recsize + used, 0, recsize - used);
+            }
+        }
+    }
+}
+
+/* Unpack n consecutive records to the particles start .. start + n. */
+void
+fastpm_packing_plan_unpack_many(FastPMPackingPlan * plan,
+            FastPMStore * p, ptrdiff_t start, size_t n, void * packed)
+{
+    size_t recsize = plan->elsize;
+    ptrdiff_t nblocks = (n + PACKING_BLOCK - 1) / PACKING_BLOCK;
+    ptrdiff_t b;
+#pragma omp parallel for
+    for(b = 0; b < nblocks; b ++) {
+        size_t j0 = b * PACKING_BLOCK;
+        size_t nb = j0 + PACKING_BLOCK > n ? n - j0 : PACKING_BLOCK;
+        char * rec = ((char*) packed) + j0 * recsize;
+        int t;
+        for(t = 0; t < plan->Ncolumns; t ++) {
+            int ci = plan->_ci[t];
+            ptrdiff_t offset = plan->_offsets[ci];
+            if(plan->_column_info[ci].unpack != unpack_any) {
+                size_t j;
+                for(j = 0; j < nb; j ++) {
+                    plan->_column_info[ci].unpack(p, start + j0 + j, ci, rec + j * recsize + offset);
+                }
+                continue;
+            }
+            _packing_scatter(p->columns[ci], plan->_column_info[ci].elsize, rec + offset, recsize,
+                    start + j0, nb);
+        }
+    }
+}
+
 
 int
 fastpm_store_find_column_id(FastPMStore * p, FastPMColumnTags attribute)
@@ -377,78 +753,357 @@ fastpm_store_destroy(FastPMStore * p)
     fastpm_memory_free(p->mem, p->_base);
 }
 
-static void permute(void * data, int np, size_t elsize, int * ind) {
-    void * tmp = malloc(elsize * np);
-    if(!tmp) {
-        fastpm_raise(-1, "No memory for permuting\n");
+/* dest[c][i] = src[c][ind[i]] for the columns c; in blocks of particles, such that
+ * a block of ind and the rows it points to are reused by all columns. */
+static void
+_permute_gather(char * dest[], char * src[], size_t elsize[], int ncol, ptrdiff_t np, ptrdiff_t * ind)
+{
+    const ptrdiff_t blocksize = 4096;
+    ptrdiff_t nblocks = (np + blocksize - 1) / blocksize;
+    ptrdiff_t b;
+#pragma omp parallel for
+    for(b = 0; b < nblocks; b ++) {
+        ptrdiff_t start = b * blocksize;
+        ptrdiff_t end = start + blocksize;
+        if(end > np) end = np;
+        int c;
+        for(c = 0; c < ncol; c ++) {
+            size_t el = elsize[c];
+            ptrdiff_t i;
+            for(i = start; i < end; i ++) {
+                memcpy(dest[c] + i * el, src[c] + ind[i] * el, el);
+            }
+        }
+    }
+}
+
+static void
+_permute_copy(char * dest, char * src, size_t size)
+{
+#ifdef _OPENMP
+    int Nchunks = omp_get_max_threads();
+#else
+    int Nchunks = 1;
+#endif
+    int c;
+#pragma omp parallel for
+    for(c = 0; c < Nchunks; c ++) {
+        size_t start = c * size / Nchunks;
+        size_t end = (c + 1) * size / Nchunks;
+        memcpy(dest + start, src + start, end - start);
     }
-    int i;
+}
+
+/* returns 1 if every index in [0, np) appears once in ind; uses np bits of seen. */
+static int
+_is_permutation(ptrdiff_t * ind, ptrdiff_t np, unsigned char * seen)
+{
+    int bad = 0;
+    memset(seen, 0, np / 8 + 1);
+    ptrdiff_t i;
+#pragma omp parallel for reduction(+: bad)
     for(i = 0; i < np; i ++) {
-        memcpy(((char*) tmp) + i * elsize, ((char*) data) + ind[i] * elsize, elsize);
+        ptrdiff_t j = ind[i];
+        if(j < 0 || j >= np) {
+            bad ++;
+            continue;
+        }
+        unsigned char bit = 1 << (j & 7);
+        unsigned char old;
+#pragma omp atomic capture
+        { old = seen[j >> 3]; seen[j >> 3] |= bit; }
+        if(old & bit) bad ++;
     }
-    memcpy(data, tmp, np * elsize);
-    free(tmp);
+    return bad == 0;
 }
 
-void fastpm_store_permute(FastPMStore * p, int * ind)
+/* Follow the cycles of the permutation in place, moving all columns of a particle together.
+ * leader has np bits, all set (as left by _is_permutation). A serial pass walks every
+ * cycle once and keeps only the bit of its smallest index; the cycles are then moved
+ * in parallel, each by the thread that owns its leader. */
+static void
+_permute_cycles(char * col[], size_t elsize[], int ncol, ptrdiff_t np, ptrdiff_t * ind, unsigned char * leader)
 {
+    size_t rowsize = 0;
+    int c;
+    for(c = 0; c < ncol; c ++) rowsize += elsize[c];
+
+    {
+        ptrdiff_t i, j;
+        for(i = 0; i < np; i ++) {
+            if(!(leader[i >> 3] & (1 << (i & 7)))) continue;
+            if(ind[i] == i) {
+                leader[i >> 3] &= ~(1 << (i & 7));
+                continue;
+            }
+            for(j = ind[i]; j != i; j = ind[j]) {
+                leader[j >> 3] &= ~(1 << (j & 7));
+            }
+        }
+    }
+
+#pragma omp parallel private(c)
+    {
+        char * row = malloc(rowsize);
+        ptrdiff_t i;
+#pragma omp for schedule(dynamic, 4096)
+        for(i = 0; i < np; i ++) {
+            ptrdiff_t j;
+            if(!(leader[i >> 3] & (1 << (i & 7)))) continue;
+
+            char * r = row;
+            for(c = 0; c < ncol; c ++) {
+                memcpy(r, col[c] + i * elsize[c], elsize[c]);
+                r += elsize[c];
+            }
+            ptrdiff_t k = i;
+            for(j = ind[k]; j != i; k = j, j = ind[j]) {
+                for(c = 0; c < ncol; c ++) {
+                    memcpy(col[c] + k * elsize[c], col[c] + j * elsize[c], elsize[c]);
+                }
+            }
+            r = row;
+            for(c = 0; c < ncol; c ++) {
+                memcpy(col[c] + k * elsize[c], r, elsize[c]);
+                r += elsize[c];
+            }
+        }
+        free(row);
+    }
+}
+
+/* Reorder the particles such that particle i becomes the old particle ind[i].
+ *
+ * ind may repeat particles (e.g. to replicate halo attributes), as long as
+ * it is within [0, np). The columns are gathered through scratch from the memory
+ * pool: all at once if there is room, otherwise one column at a time. Without
+ * room for a column, a permutation is applied in place by following its cycles;
+ * other orderings are gathered through malloc.
+ * */
+void fastpm_store_permute(FastPMStore * p, ptrdiff_t * ind)
+{
+    ptrdiff_t np = p->np;
+    char * col[32];
+    size_t elsize[32];
+    int ncol = 0;
+    size_t total = 0;
+    size_t largest = 0;
     int c;
     for(c = 0; c < 32; c ++) {
         if(!p->columns[c]) continue;
-        permute(p->columns[c], p->np, p->_column_info[c].elsize, ind);
+        col[ncol] = p->columns[c];
+        elsize[ncol] = p->_column_info[c].elsize;
+        total += elsize[ncol] * np;
+        if(elsize[ncol] * np > largest) largest = elsize[ncol] * np;
+        ncol ++;
+    }
+    if(np == 0 || ncol == 0) return;
+
+    /* leave some room for the alignment of the blocks */
+    size_t room = p->mem->free_bytes > 64 * p->mem->alignment ? p->mem->free_bytes - 64 * p->mem->alignment : 0;
+
+    if(total <= room) {
+        char * buf = fastpm_memory_alloc(p->mem, "PermuteBuf", total, FASTPM_MEMORY_STACK);
+        char * dest[32];
+        size_t offset = 0;
+        for(c = 0; c < ncol; c ++) {
+            dest[c] = buf + offset;
+            offset += elsize[c] * np;
+        }
+        _permute_gather(dest, col, elsize, ncol, np, ind);
+        for(c = 0; c < ncol; c ++) {
+            _permute_copy(col[c], dest[c], elsize[c] * np);
+        }
+        fastpm_memory_free(p->mem, buf);
+        return;
+    }
+
+    if(largest <= room) {
+        char * buf = fastpm_memory_alloc(p->mem, "PermuteBuf", largest, FASTPM_MEMORY_STACK);
+        for(c = 0; c < ncol; c ++) {
+            _permute_gather(&buf, &col[c], &elsize[c], 1, np, ind);
+            _permute_copy(col[c], buf, elsize[c] * np);
+        }
+        fastpm_memory_free(p->mem, buf);
+        return;
+    }
+
+    unsigned char * seen = malloc(np / 8 + 1);
+    if(_is_permutation(ind, np, seen)) {
+        _permute_cycles(col, elsize, ncol, np, ind, seen);
+        free(seen);
+        return;
+    }
+    free(seen);
+
+    for(c = 0; c < ncol; c ++) {
+        char * buf = malloc(elsize[c] * np);
+        if(!buf) {
+            fastpm_raise(-1, "No memory for permuting\n");
+        }
+        _permute_gather(&buf, &col[c], &elsize[c], 1, np, ind);
+        _permute_copy(col[c], buf, elsize[c] * np);
+        free(buf);
     }
 }
 
+/* Sort n keys with a stable, parallel LSD radix sort on bytes; ind follows the keys.
+ * A byte that is the same for all keys is skipped. */
+static void
+_fastpm_store_radix_sort(FastPMMemory * mem, uint64_t * key, ptrdiff_t * ind, ptrdiff_t n)
+{
+#ifdef _OPENMP
+    int Nchunks = omp_get_max_threads();
+#else
+    int Nchunks = 1;
+#endif
+    uint64_t * key2 = fastpm_memory_alloc(mem, "RadixKey", sizeof(key[0]) * n, FASTPM_MEMORY_STACK);
+    ptrdiff_t * ind2 = fastpm_memory_alloc(mem, "RadixInd", sizeof(ind[0]) * n, FASTPM_MEMORY_STACK);
+    /* number of keys per chunk and digit; later the offset to scatter to */
+    size_t * count = malloc(sizeof(size_t) * Nchunks * 256);
+
+    uint64_t * kin = key, * kout = key2;
+    ptrdiff_t * iin = ind, * iout = ind2;
+
+    int shift;
+    for(shift = 0; shift < 64; shift += 8) {
+        int c;
+        memset(count, 0, sizeof(size_t) * Nchunks * 256);
+#pragma omp parallel for
+        for(c = 0; c < Nchunks; c ++) {
+            size_t * chunkcount = count + (size_t) c * 256;
+            ptrdiff_t i;
+            for(i = c * n / Nchunks; i < (c + 1) * n / Nchunks; i ++) {
+                chunkcount[(kin[i] >> shift) & 0xff] ++;
+            }
+        }
+
+        int b;
+        int trivial = 0;
+        size_t offset = 0;
+        for(b = 0; b < 256; b ++) {
+            size_t nb = 0;
+            for(c = 0; c < Nchunks; c ++) {
+                size_t t = count[(size_t) c * 256 + b];
+                count[(size_t) c * 256 + b] = offset;
+                offset += t;
+                nb += t;
+            }
+            if(nb == n) trivial = 1;
+        }
+        if(trivial) continue;
+
+#pragma omp parallel for
+        for(c = 0; c < Nchunks; c ++) {
+            size_t * chunkoffset = count + (size_t) c * 256;
+            ptrdiff_t i;
+            for(i = c * n / Nchunks; i < (c + 1) * n / Nchunks; i ++) {
+                size_t j = chunkoffset[(kin[i] >> shift) & 0xff] ++;
+                kout[j] = kin[i];
+                iout[j] = iin[i];
+            }
+        }
+        uint64_t * ktmp = kin; kin = kout; kout = ktmp;
+        ptrdiff_t * itmp = iin; iin = iout; iout = itmp;
+    }
+    if(kin != key) {
+        memcpy(key, kin, sizeof(key[0]) * n);
+        memcpy(ind, iin, sizeof(ind[0]) * n);
+    }
 
-static FastPMStore *  _fastpm_store_sort_store;
-static int (*_fastpm_store_sort_cmp_func)(const int i1, const int i2, FastPMStore * p);
+    free(count);
+    fastpm_memory_free(mem, ind2);
+    fastpm_memory_free(mem, key2);
+}
 
-int _sort_by_id_cmpfunc(const void * p1, const void * p2)
+/* spread the lower 21 bits of v to every third bit */
+static uint64_t
+_morton_spread(uint64_t v)
 {
-    const int * i1 = (const int*) p1;
-    const int * i2 = (const int*) p2;
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffffULL;
+    v = (v | v << 16) & 0x1f0000ff0000ffULL;
+    v = (v | v << 8)  & 0x100f00f00f00f00fULL;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ULL;
+    v = (v | v << 2)  & 0x1249249249249249ULL;
+    return v;
+}
 
-    return _fastpm_store_sort_cmp_func(*i1, *i2, _fastpm_store_sort_store);
+uint64_t
+FastPMLocalSortByID(FastPMStore * p, ptrdiff_t i, void * userdata)
+{
+    return p->id[i];
 }
 
-int
-FastPMLocalSortByID(const int i1,
-                    const int i2,
-                    FastPMStore * p)
+/* in FOF: first every undecided halo; then the real halo with particles */
+uint64_t
+FastPMLocalSortByMinID(FastPMStore * p, ptrdiff_t i, void * userdata)
 {
-    int v1 = (p->id[i1] < p->id[i2]);
-    int v2 = (p->id[i1] > p->id[i2]);
+    return p->minid[i];
+}
 
-    return v2 - v1;
+/* Position along a Morton curve with 2**21 steps per side of the box;
+ * userdata is double BoxSize[3]. Particles close in space become close in memory,
+ * which improves the cache reuse when painting and reading out. */
+uint64_t
+FastPMLocalSortByMorton(FastPMStore * p, ptrdiff_t i, void * userdata)
+{
+    double * BoxSize = userdata;
+    double pos[3];
+    uint64_t u[3];
+    int d;
+    fastpm_store_get_position(p, i, pos);
+    for(d = 0; d < 3; d ++) {
+        double f = pos[d] / BoxSize[d];
+        f -= floor(f);
+        u[d] = f * (1 << 21);
+        if(u[d] >= (1 << 21)) u[d] = (1 << 21) - 1;
+    }
+    return (_morton_spread(u[0]) << 2) | (_morton_spread(u[1]) << 1) | _morton_spread(u[2]);
 }
 
-/* sort a store locally with in the MPI rank. 
+/* Sort a store locally within the MPI rank by the keys from key_func.
  *
- * cmp_func is called with three arguments.
+ * The sort is stable; key_func is called once per particle, from multiple threads.
  * */
 void
-fastpm_store_sort(FastPMStore * p,
-        int (*cmp_func)(const int i1, const int i2, FastPMStore * p))
+fastpm_store_sort(FastPMStore * p, fastpm_store_sort_key_func key_func, void * userdata)
 {
-    int * arg = fastpm_memory_alloc(p->mem, "Temp", sizeof(int) * p->np, FASTPM_MEMORY_HEAP);
-    int i;
-    for(i = 0; i < p->np; i ++) {
-        arg[i] = i;
+    ptrdiff_t np = p->np;
+    uint64_t * key = fastpm_memory_alloc(p->mem, "SortKey", sizeof(key[0]) * np, FASTPM_MEMORY_STACK);
+    ptrdiff_t * ind = fastpm_memory_alloc(p->mem, "SortInd", sizeof(ind[0]) * np, FASTPM_MEMORY_STACK);
+
+    ptrdiff_t i;
+#pragma omp parallel for
+    for(i = 0; i < np; i ++) {
+        key[i] = key_func(p, i, userdata);
+        ind[i] = i;
     }
-    /* FIXME: copy some version of qsort_r */
-    _fastpm_store_sort_store = p;
-    _fastpm_store_sort_cmp_func = cmp_func;
-    qsort(arg, p->np, sizeof(arg[0]), _sort_by_id_cmpfunc);
-    fastpm_store_permute(p, arg);
-    fastpm_memory_free(p->mem, arg);
+
+    _fastpm_store_radix_sort(p->mem, key, ind, np);
+
+    fastpm_store_permute(p, ind);
+
+    fastpm_memory_free(p->mem, ind);
+    fastpm_memory_free(p->mem, key);
 }
 
 void 
 fastpm_store_wrap(FastPMStore * p, double BoxSize[3])
 {
-    int i;
+    fastpm_store_wrap_from(p, 0, BoxSize);
+}
+
+/* wrap the particles from start into the box. */
+void
+fastpm_store_wrap_from(FastPMStore * p, ptrdiff_t start, double BoxSize[3])
+{
+    /* compact positions are always in the box */
+    if(p->x == NULL) return;
+
+    ptrdiff_t i;
     int d;
-    for(i = 0; i < p->np; i ++) {
+    for(i = start; i < p->np; i ++) {
         for(d = 0; d < 3; d ++) {
             double n = abs(p->x[i][d] / BoxSize[d]);
 
@@ -482,15 +1137,413 @@ FastPMTargetPM (FastPMStore * p, ptrdiff_t i, PM * pm)
     return pm_pos_to_rank(pm, pos);
 }
 
+static void
+_fastpm_store_send_chunk(FastPMPackingPlan * plan, FastPMStore * p,
+    ptrdiff_t * index, size_t n, char * buf,
+    int partner, MPI_Datatype PTYPE, MPI_Comm comm, MPI_Request * request)
+{
+    fastpm_packing_plan_pack_many(plan, p, index, 0, n, buf);
+    MPI_Isend(buf, n, PTYPE, partner, 101936, comm, request);
+}
+
+/* Exchange the particles with one partner rank in chunks of chunksize.
+ *
+ * Two chunks are in flight each way. A chunk is packed right before it is sent,
+ * and unpacked to the store at dest as soon as it arrives; buffer holds the four
+ * chunks.
+ * */
+static void
+_fastpm_store_exchange_chunks(FastPMPackingPlan * plan, FastPMStore * p,
+    ptrdiff_t * index, size_t nsend,
+    ptrdiff_t dest, size_t nrecv,
+    char * buffer, size_t chunksize,
+    int partner, MPI_Datatype PTYPE, MPI_Comm comm)
+{
+    size_t elsize = plan->elsize;
+    size_t Nsendchunks = (nsend + chunksize - 1) / chunksize;
+    size_t Nrecvchunks = (nrecv + chunksize - 1) / chunksize;
+
+    /* slots 0, 1 are for receiving, slots 2, 3 are for sending. */
+    MPI_Request requests[4] = {MPI_REQUEST_NULL, MPI_REQUEST_NULL, MPI_REQUEST_NULL, MPI_REQUEST_NULL};
+    size_t chunk[4];
+    size_t nextsend = 0;
+    size_t nextrecv = 0;
+
+#define SLOT(s) (buffer + (s) * chunksize * elsize)
+#define CHUNKLEN(k, n) (((k) + 1) * chunksize > (n) ? (n) - (k) * chunksize : chunksize)
+
+    int s;
+    for(s = 0; s < 2 && nextrecv < Nrecvchunks; s ++) {
+        chunk[s] = nextrecv ++;
+        MPI_Irecv(SLOT(s), CHUNKLEN(chunk[s], nrecv), PTYPE, partner, 101936, comm, &requests[s]);
+    }
+    for(s = 2; s < 4 && nextsend < Nsendchunks; s ++) {
+        chunk[s] = nextsend ++;
+        _fastpm_store_send_chunk(plan, p, index + chunk[s] * chunksize, CHUNKLEN(chunk[s], nsend),
+                SLOT(s), partner, PTYPE, comm, &requests[s]);
+    }
+
+    while(1) {
+        MPI_Waitany(4, requests, &s, MPI_STATUS_IGNORE);
+        if(s == MPI_UNDEFINED) break;
+
+        if(s < 2) {
+            size_t n = CHUNKLEN(chunk[s], nrecv);
+            ptrdiff_t start = dest + chunk[s] * chunksize;
+            char * buf = SLOT(s);
+            fastpm_packing_plan_unpack_many(plan, p, start, n, buf);
+            if(nextrecv == Nrecvchunks) continue;
+            chunk[s] = nextrecv ++;
+            MPI_Irecv(buf, CHUNKLEN(chunk[s], nrecv), PTYPE, partner, 101936, comm, &requests[s]);
+        } else {
+            if(nextsend == Nsendchunks) continue;
+            chunk[s] = nextsend ++;
+            _fastpm_store_send_chunk(plan, p, index + chunk[s] * chunksize, CHUNKLEN(chunk[s], nsend),
+                    SLOT(s), partner, PTYPE, comm, &requests[s]);
+        }
+    }
+#undef CHUNKLEN
+#undef SLOT
+}
+
+/* Move particles to the ranks given by target_func, with a bounded buffer.
+ *
+ * The particles are exchanged pair by pair, in chunks that fit into budget bytes.
+ * The particles received are unpacked at the end of the store, and the particles
+ * sent are compacted away after each pass. A rank only accepts as many particles
+ * in a pass as there is free space at the end of its store, in proportion to what
+ * each rank wants to send; the rest go in later passes, after the compaction
+ * has made room. If no rank has any room, the full ranks grow by a chunk.
+ *
+ * Besides the budget, the exchange uses 4 bytes per slot of the store for the
+ * targets and 8 bytes per particle sent in a pass for the send index.
+ *
+ * Returns 0 on success, -1 if the stores cannot hold the particles, and 1 if
+ * the exchange cannot go on in chunks; the particles left are to be moved at once.
+ * */
+static int
+_fastpm_store_decompose_chunked(FastPMStore * p, ptrdiff_t start,
+    fastpm_store_target_func target_func,
+    void * data, MPI_Comm comm, size_t budget)
+{
+    FastPMPackingPlan plan[1];
+
+    fastpm_packing_plan_init(plan, p, p->attributes);
+
+    size_t elsize = plan->elsize;
+
+    size_t chunksize = budget / (4 * elsize);
+    if(chunksize == 0) chunksize = 1;
+    if(chunksize > INT_MAX) chunksize = INT_MAX;
+
+    int NTask, ThisTask;
+
+    MPI_Comm_rank(comm, &ThisTask);
+    MPI_Comm_size(comm, &NTask);
+
+    /* one chunk of particles per thread. The chunks are contiguous and taken in
+     * order, so the particles sent, their order and the final layout of the store
+     * do not depend on the number of chunks; only the per-chunk offsets do. */
+#ifdef _OPENMP
+    int Nchunks = omp_get_max_threads();
+#else
+    int Nchunks = 1;
+#endif
+
+    size_t * sendcount = malloc(sizeof(size_t) * NTask);
+    size_t * sendoffset = malloc(sizeof(size_t) * NTask);
+    size_t * recvcount = malloc(sizeof(size_t) * NTask);
+    size_t * grant = malloc(sizeof(size_t) * NTask);
+    /* number of particles to send per chunk and rank; later the offset to pack to */
+    size_t * count = malloc(sizeof(size_t) * Nchunks * NTask);
+    /* number of particles to send in this pass per chunk and rank */
+    size_t * quota = malloc(sizeof(size_t) * Nchunks * NTask);
+
+    /* -1 for staying, -2 for sent in this pass */
+    /* on the stack, such that the store can still grow in place on the heap;
+     * target on the top, such that it grows in place with the store. */
+    char * buffer = fastpm_memory_alloc(p->mem, "ExchangeBuf", 4 * chunksize * elsize, FASTPM_MEMORY_STACK);
+    int * target = fastpm_memory_alloc(p->mem, "Target", sizeof(int) * p->np_upper, FASTPM_MEMORY_STACK);
+
+    MPI_Datatype PTYPE;
+    MPI_Type_contiguous(elsize, MPI_BYTE, &PTYPE);
+    MPI_Type_commit(&PTYPE);
+
+    int c;
+    int r;
+
+    {
+        ptrdiff_t np = p->np;
+#pragma omp parallel for
+        for(c = 0; c < Nchunks; c ++) {
+            ptrdiff_t i;
+            for(i = start + c * (np - start) / Nchunks; i < start + (c + 1) * (np - start) / Nchunks; i ++) {
+                target[i] = target_func(p, i, data);
+                if(ThisTask == target[i]) target[i] = -1;
+            }
+        }
+    }
+
+    int iter = 0;
+    int retval = 0;
+    while(1) {
+        ptrdiff_t np = p->np;
+
+        memset(count, 0, sizeof(size_t) * Nchunks * NTask);
+#pragma omp parallel for
+        for(c = 0; c < Nchunks; c ++) {
+            size_t * chunkcount = count + (size_t) c * NTask;
+            ptrdiff_t i;
+            for(i = start + c * (np - start) / Nchunks; i < start + (c + 1) * (np - start) / Nchunks; i ++) {
+                if(target[i] < 0) continue;
+                chunkcount[target[i]] ++;
+            }
+        }
+        for(r = 0; r < NTask; r ++) {
+            sendcount[r] = 0;
+            for(c = 0; c < Nchunks; c ++) {
+                sendcount[r] += count[(size_t) c * NTask + r];
+            }
+        }
+
+        size_t Nsend_all = cumsum64(sendoffset, sendcount, NTask);
+
+        if(!MPIU_Any(comm, Nsend_all > 0)) break;
+
+        MPI_Alltoall(sendcount, 1, MPI_LONG,
+                     recvcount, 1, MPI_LONG,
+                     comm);
+
+        size_t Nrecv_all = 0;
+        for(r = 0; r < NTask; r ++) {
+            Nrecv_all += recvcount[r];
+        }
+
+        volatile size_t neededsize = p->np + Nrecv_all - Nsend_all;
+
+        if(neededsize > p->np_upper && 0 == fastpm_store_grow(p, neededsize + neededsize / 8)) {
+            target = fastpm_memory_realloc(p->mem, "Target", target, sizeof(int) * p->np_upper);
+        }
+
+        if(neededsize > p->np_upper) {
+            fastpm_ilog(INFO, "Need %td particles on rank %d; %td allocated\n", neededsize, ThisTask, p->np_upper);
+        }
+
+        if(MPIU_Any(comm, neededsize > p->np_upper)) {
+            retval = -1;
+            break;
+        }
+
+        /* accept what fits at the end of the store; the senders learn how many they may send. */
+        size_t space = p->np_upper - p->np;
+        size_t space_left = space;
+        for(r = 0; r < NTask; r ++) {
+            if(Nrecv_all <= space) {
+                grant[r] = recvcount[r];
+            } else {
+                grant[r] = recvcount[r] * space / Nrecv_all;
+            }
+            space_left -= grant[r];
+        }
+        /* the proportional split rounds down; hand the rest out in rank order
+         * such that a small sender is not starved with a zero grant. */
+        for(r = 0; r < NTask && space_left > 0; r ++) {
+            size_t extra = recvcount[r] - grant[r];
+            if(extra > space_left) extra = space_left;
+            grant[r] += extra;
+            space_left -= extra;
+        }
+
+        MPI_Alltoall(grant, 1, MPI_LONG,
+                     sendcount, 1, MPI_LONG,
+                     comm);
+
+        size_t Nsend = cumsum64(sendoffset, sendcount, NTask);
+        size_t Nrecv = 0;
+        for(r = 0; r < NTask; r ++) {
+            Nrecv += grant[r];
+        }
+
+        if(!MPIU_Any(comm, Nsend > 0)) {
+            /* no rank has room for any incoming particle, e.g. a swap between full
+             * ranks: no pass would free any room. The full ranks grow by a chunk;
+             * if none can, the rest is moved at once by the caller. */
+            int grown = 0;
+            if(space == 0 && Nrecv_all > 0) {
+                size_t extra = Nrecv_all < chunksize ? Nrecv_all : chunksize;
+                if(0 == fastpm_store_grow(p, p->np_upper + extra)) {
+                    target = fastpm_memory_realloc(p->mem, "Target", target, sizeof(int) * p->np_upper);
+                    grown = 1;
+                }
+            }
+            if(MPIU_Any(comm, grown)) continue;
+            retval = 1;
+            break;
+        }
+
+        /* the first particles to a rank go first; count becomes the offset into the index */
+        for(r = 0; r < NTask; r ++) {
+            size_t left = sendcount[r];
+            size_t offset = sendoffset[r];
+            for(c = 0; c < Nchunks; c ++) {
+                size_t n = count[(size_t) c * NTask + r];
+                if(n > left) n = left;
+                left -= n;
+                quota[(size_t) c * NTask + r] = n;
+                count[(size_t) c * NTask + r] = offset;
+                offset += n;
+            }
+        }
+
+        ptrdiff_t * index = fastpm_memory_alloc(p->mem, "SendIndex", sizeof(ptrdiff_t) * Nsend, FASTPM_MEMORY_HEAP);
+
+#pragma omp parallel for
+        for(c = 0; c < Nchunks; c ++) {
+            size_t * offset = count + (size_t) c * NTask;
+            size_t * left = quota + (size_t) c * NTask;
+            ptrdiff_t i;
+            for(i = start + c * (np - start) / Nchunks; i < start + (c + 1) * (np - start) / Nchunks; i ++) {
+                int t = target[i];
+                if(t < 0 || left[t] == 0) continue;
+                left[t] --;
+                index[offset[t]++] = i;
+                target[i] = -2;
+            }
+        }
+
+        {
+            double nmin, nmax, nmean, nstd;
+
+            MPIU_stats(comm, elsize * Nsend, "<>-s", &nmin, &nmax, &nmean, &nstd);
+            fastpm_info("Send size : min=%g max=%g mean=%g, std=%g bytes", nmin, nmax, nmean, nstd);
+            MPIU_stats(comm, elsize * Nrecv, "<>-s", &nmin, &nmax, &nmean, &nstd);
+            fastpm_info("Recv size : min=%g max=%g mean=%g, std=%g bytes", nmin, nmax, nmean, nstd);
+        }
+
+        /* pairwise, in the same order as MPI_Alltoallv_sparse. */
+        int PTask;
+        for(PTask = 0; NTask > (1 << PTask); PTask++)
+            continue;
+
+        ptrdiff_t dest = np;
+        int ngrp;
+        for(ngrp = 1; ngrp < (1 << PTask); ngrp ++) {
+            int partner = ThisTask ^ ngrp;
+            if(partner >= NTask) continue;
+            if(sendcount[partner] == 0 && grant[partner] == 0) continue;
+
+            _fastpm_store_exchange_chunks(plan, p,
+                    index + sendoffset[partner], sendcount[partner],
+                    dest, grant[partner],
+                    buffer, chunksize, partner, PTYPE, comm);
+
+            dest += grant[partner];
+        }
+
+        fastpm_memory_free(p->mem, index);
+
+        VALGRIND_CHECK_MEM_IS_DEFINED(p->x + np, sizeof(p->x[0]) * Nrecv);
+
+        ptrdiff_t i;
+#pragma omp parallel for
+        for(i = np; i < np + Nrecv; i ++) {
+            target[i] = -1;
+        }
+
+        /* compact away the particles sent, in order; the columns are independent. */
+        int ci;
+#pragma omp parallel for
+        for(ci = 0; ci < 32; ci ++) {
+            if(!p->columns[ci]) continue;
+            size_t colsize = p->_column_info[ci].elsize;
+            char * column = p->columns[ci];
+            ptrdiff_t i, j = start;
+            for(i = start; i < np + Nrecv; i ++) {
+                if(target[i] == -2) continue;
+                if(i != j) {
+                    memcpy(column + j * colsize, column + i * colsize, colsize);
+                }
+                j ++;
+            }
+        }
+        /* and the targets of the particles left, for the next pass */
+        ptrdiff_t j = start;
+        for(i = start; i < np + Nrecv; i ++) {
+            if(target[i] == -2) continue;
+            target[j++] = target[i];
+        }
+
+        p->np += Nrecv - Nsend;
+
+        size_t Nsendsum;
+        size_t Nsendallsum;
+        MPI_Allreduce(&Nsend, &Nsendsum, 1, MPI_LONG, MPI_SUM, comm);
+        MPI_Allreduce(&Nsend_all, &Nsendallsum, 1, MPI_LONG, MPI_SUM, comm);
+        fastpm_info("Decomposition iter %d, exchange of %td particles in chunks of %td; need %td", iter, Nsendsum, chunksize, Nsendallsum);
+
+        iter ++;
+    }
+
+    MPI_Type_free(&PTYPE);
+
+    fastpm_memory_free(p->mem, target);
+    fastpm_memory_free(p->mem, buffer);
+
+    free(quota);
+    free(count);
+    free(grant);
+    free(recvcount);
+    free(sendoffset);
+    free(sendcount);
+
+    return retval;
+}
+
+/* Move particles to the ranks given by target_func.
+ *
+ * The particles are split into one contiguous chunk per thread. The chunks
+ * are taken in order, thus the result (the particles sent, their order and
+ * the layout of the store) does not depend on the number of threads, though
+ * the chunking does. The targets are computed in parallel; the particles
+ * to send are packed directly from the columns into the send order, and
+ * the particles that stay are then compacted column by column. The store
+ * is never permuted. Counts and offsets are 64-bit.
+ * */
 int
 fastpm_store_decompose(FastPMStore * p,
     fastpm_store_target_func target_func,
     void * data, MPI_Comm comm)
+{
+    return fastpm_store_decompose_from(p, 0, target_func, data, comm);
+}
+
+/* Like fastpm_store_decompose, but the particles before start are known to stay.
+ * Only the particles from start are tested and moved; those before start are
+ * not touched. */
+int
+fastpm_store_decompose_from(FastPMStore * p, ptrdiff_t start,
+    fastpm_store_target_func target_func,
+    void * data, MPI_Comm comm)
 {
     if(fastpm_store_get_np_total(p, comm) == 0) return 0 ;
 
+    if(start < 0 || start > p->np) {
+        fastpm_raise(-1, "Decomposition starting at %td is out of bounds; np = %td.\n", start, p->np);
+    }
+
     VALGRIND_CHECK_MEM_IS_DEFINED(p->x, sizeof(p->x[0]) * p->np);
 
+    if(p->np > p->np_upper) {
+        fastpm_raise(-1, "Particle buffer overrun detected np = %td > np_upper %td.\n", p->np, p->np_upper);
+    }
+
+    size_t budget = _libfastpm_get_exchange_budget();
+    if(budget > 0) {
+        int retval = _fastpm_store_decompose_chunked(p, start, target_func, data, comm, budget);
+        if(retval != 1) return retval;
+        fastpm_info("No rank has room for a chunk of particles; moving the rest at once.\n");
+    }
+
     FastPMPackingPlan plan[1];
 
     fastpm_packing_plan_init(plan, p, p->attributes);
@@ -504,88 +1557,118 @@ fastpm_store_decompose(FastPMStore * p,
     MPI_Comm_rank(comm, &ThisTask);
     MPI_Comm_size(comm, &NTask);
 
-    if(p->np > p->np_upper) {
-        fastpm_raise(-1, "Particle buffer overrun detected np = %td > np_upper %td.\n", p->np, p->np_upper);
-    }
-
-    /* do a bincount; offset by -1 because -1 is for self */
-    int * count = calloc(NTask + 1, sizeof(int));
-    int * offsets = calloc(NTask + 1, sizeof(int));
-    int * sendcount = count + 1;
-    int * recvcount = malloc(sizeof(int) * (NTask));
-    int * recvoffset = malloc(sizeof(int) * (NTask));
-    int * sendoffset = malloc(sizeof(int) * (NTask));
+    /* one chunk of particles per thread. The chunks are contiguous and taken in
+     * order, so the particles sent, their order and the final layout of the store
+     * do not depend on the number of chunks; only the per-chunk offsets do. */
+#ifdef _OPENMP
+    int Nchunks = omp_get_max_threads();
+#else
+    int Nchunks = 1;
+#endif
+
+    size_t * sendcount = malloc(sizeof(size_t) * NTask);
+    size_t * sendoffset = malloc(sizeof(size_t) * NTask);
+    size_t * recvcount = malloc(sizeof(size_t) * NTask);
+    size_t * recvoffset = malloc(sizeof(size_t) * NTask);
+    /* number of particles to send per chunk and rank; later the offset to pack to */
+    size_t * count = malloc(sizeof(size_t) * Nchunks * NTask);
+    /* number of particles to send per chunk, before throttling */
+    size_t * nsend = malloc(sizeof(size_t) * Nchunks);
 
     int incomplete = 1;
     int iter = 0;
     /* terminate based on incomplete for throttling*/
     while(1) {
         incomplete = 0;
-        int * target = fastpm_memory_alloc(p->mem, "Target", sizeof(int) * p->np, FASTPM_MEMORY_HEAP);
+        /* on the stack, such that the store can still grow in place on the heap */
+        int * target = fastpm_memory_alloc(p->mem, "Target", sizeof(int) * p->np, FASTPM_MEMORY_STACK);
 
-        size_t Nsend_all = 0;
-        ptrdiff_t i;
-        for(i = 0; i < p->np; i ++) {
-            target[i] = target_func(p, i, data);
-            if(ThisTask == target[i]) {
-                target[i] = -1;
-            } else {
-                Nsend_all++;
-                /* Throttling: never send more than this many particles. */
-                if(Nsend_all >= Nsend_limit) {
-                    incomplete = 1;
+        ptrdiff_t np = p->np;
+        int c;
+
+        memset(count, 0, sizeof(size_t) * Nchunks * NTask);
+
+#pragma omp parallel for
+        for(c = 0; c < Nchunks; c ++) {
+            ptrdiff_t i;
+            nsend[c] = 0;
+            for(i = start + c * (np - start) / Nchunks; i < start + (c + 1) * (np - start) / Nchunks; i ++) {
+                target[i] = target_func(p, i, data);
+                if(ThisTask == target[i]) {
                     target[i] = -1;
                 } else {
+                    nsend[c] ++;
                 }
             }
         }
 
-        for(i = 0; i < NTask + 1; i ++) {
-            count[i] = 0;
-            offsets[i] = 0;
-        }
-        for(i = 0; i < NTask; i ++) {
-            sendoffset[i] = 0;
-            recvoffset[i] = 0;
+        size_t Nsend_all = 0;
+        for(c = 0; c < Nchunks; c ++) {
+            Nsend_all += nsend[c];
         }
 
-        for(i = 0; i < p->np; i ++) {
-            sendcount[target[i]] ++;
+#pragma omp parallel for reduction(|: incomplete)
+        for(c = 0; c < Nchunks; c ++) {
+            /* Throttling: never send more than this many particles; the first particles go first. */
+            size_t isend = 0;
+            int c1;
+            for(c1 = 0; c1 < c; c1 ++) {
+                isend += nsend[c1];
+            }
+            size_t * chunkcount = count + (size_t) c * NTask;
+            ptrdiff_t i;
+            for(i = start + c * (np - start) / Nchunks; i < start + (c + 1) * (np - start) / Nchunks; i ++) {
+                if(target[i] < 0) continue;
+                isend ++;
+                if(isend >= Nsend_limit) {
+                    incomplete = 1;
+                    target[i] = -1;
+                } else {
+                    chunkcount[target[i]] ++;
+                }
+            }
         }
-        cumsum(offsets, count, NTask + 1);
 
-        int * arg = fastpm_memory_alloc(p->mem, "PermArg", sizeof(int) * p->np, FASTPM_MEMORY_HEAP);
-        for(i = 0; i < p->np; i ++) {
-            int offset = offsets[target[i] + 1] ++;
-            arg[offset] = i;
+        /* per chunk offsets into the send buffer; the particles to a rank are in the order of the store */
+        int r;
+        for(r = 0; r < NTask; r ++) {
+            sendcount[r] = 0;
+            for(c = 0; c < Nchunks; c ++) {
+                sendcount[r] += count[(size_t) c * NTask + r];
+            }
+        }
+        size_t Nsend = cumsum64(sendoffset, sendcount, NTask);
+        for(r = 0; r < NTask; r ++) {
+            size_t offset = sendoffset[r];
+            for(c = 0; c < Nchunks; c ++) {
+                size_t n = count[(size_t) c * NTask + r];
+                count[(size_t) c * NTask + r] = offset;
+                offset += n;
+            }
         }
 
-        fastpm_store_permute(p, arg);
-
-        VALGRIND_CHECK_MEM_IS_DEFINED(p->x, sizeof(p->x[0]) * p->np);
-
-        fastpm_memory_free(p->mem, arg);
-        fastpm_memory_free(p->mem, target);
-
-        MPI_Alltoall(sendcount, 1, MPI_INT, 
-                     recvcount, 1, MPI_INT, 
+        MPI_Alltoall(sendcount, 1, MPI_LONG, 
+                     recvcount, 1, MPI_LONG, 
                      comm);
 
-        size_t Nsend = cumsum(sendoffset, sendcount, NTask);
-        size_t Nrecv = cumsum(recvoffset, recvcount, NTask);
+        size_t Nrecv = cumsum64(recvoffset, recvcount, NTask);
 
         volatile size_t neededsize = p->np + Nrecv - Nsend;
 
+        if(neededsize > p->np_upper) {
+            /* grow with some head room; the store is unchanged if that fails */
+            fastpm_store_grow(p, neededsize + neededsize / 8);
+        }
+
         if(neededsize > p->np_upper) {
             fastpm_ilog(INFO, "Need %td particles on rank %d; %td allocated\n", neededsize, ThisTask, p->np_upper);
         }
 
         if(MPIU_Any(comm, neededsize > p->np_upper)) {
+            fastpm_memory_free(p->mem, target);
             goto fail_oom;
         }
 
-        p->np -= Nsend;
-
         void * send_buffer = fastpm_memory_alloc(p->mem, "SendBuf", elsize * Nsend, FASTPM_MEMORY_HEAP);
         void * recv_buffer = fastpm_memory_alloc(p->mem, "RecvBuf", elsize * Nrecv, FASTPM_MEMORY_HEAP);
 
@@ -598,13 +1681,38 @@ fastpm_store_decompose(FastPMStore * p,
             fastpm_info("Recv buffer size : min=%g max=%g mean=%g, std=%g bytes", nmin, nmax, nmean, nstd);
         }
 
-        int ipar = 0;
-        int j;
-        for(i = 0; i < NTask; i ++) {
-            for(j = sendoffset[i]; j < sendoffset[i] + sendcount[i]; j ++, ipar++) {
-                fastpm_packing_plan_pack(plan, p, j + p->np, (char*) send_buffer + ipar * elsize);
+        /* the particle of each slot in the send buffer; then the buffer is packed column by column. */
+        ptrdiff_t * sendindex = fastpm_memory_alloc(p->mem, "SendIndex", sizeof(ptrdiff_t) * Nsend, FASTPM_MEMORY_HEAP);
+#pragma omp parallel for
+        for(c = 0; c < Nchunks; c ++) {
+            size_t * offset = count + (size_t) c * NTask;
+            ptrdiff_t i;
+            for(i = start + c * (np - start) / Nchunks; i < start + (c + 1) * (np - start) / Nchunks; i ++) {
+                if(target[i] < 0) continue;
+                sendindex[offset[target[i]]++] = i;
             }
         }
+        fastpm_packing_plan_pack_many(plan, p, sendindex, 0, Nsend, send_buffer);
+        fastpm_memory_free(p->mem, sendindex);
+
+        /* compact the particles that stay, in order; the columns are independent. */
+        int ci;
+#pragma omp parallel for
+        for(ci = 0; ci < 32; ci ++) {
+            if(!p->columns[ci]) continue;
+            size_t colsize = p->_column_info[ci].elsize;
+            char * column = p->columns[ci];
+            ptrdiff_t i, j = start;
+            for(i = start; i < np; i ++) {
+                if(target[i] >= 0) continue;
+                if(i != j) {
+                    memcpy(column + j * colsize, column + i * colsize, colsize);
+                }
+                j ++;
+            }
+        }
+
+        p->np -= Nsend;
 
         size_t Nsendsum;
         size_t Nsendallsum;
@@ -616,43 +1724,42 @@ fastpm_store_decompose(FastPMStore * p,
         MPI_Type_contiguous(elsize, MPI_BYTE, &PTYPE);
         MPI_Type_commit(&PTYPE);
 
-        MPI_Alltoallv_sparse(
+        MPI_Alltoallv_sparse_64(
                 send_buffer, sendcount, sendoffset, PTYPE,
                 recv_buffer, recvcount, recvoffset, PTYPE,
                 comm);
 
         MPI_Type_free(&PTYPE);
 
-        ipar = 0;
-        for(i = 0; i < NTask; i ++) {
-            for(j = recvoffset[i]; j < recvoffset[i] + recvcount[i]; j++, ipar ++) {
-                fastpm_packing_plan_unpack(plan, p, j + p->np, (char*) recv_buffer + ipar * elsize);
-            }
-        }
-
+        fastpm_packing_plan_unpack_many(plan, p, p->np, Nrecv, recv_buffer);
 
         fastpm_memory_free(p->mem, recv_buffer);
         fastpm_memory_free(p->mem, send_buffer);
+        fastpm_memory_free(p->mem, target);
+
+        VALGRIND_CHECK_MEM_IS_DEFINED(p->x, sizeof(p->x[0]) * (p->np + Nrecv));
 
         p->np += Nrecv;
         iter++;
         if(MPIU_Any(comm, incomplete)) continue;
         else break;
     }
-    free(recvcount);
+    free(nsend);
+    free(count);
     free(recvoffset);
+    free(recvcount);
     free(sendoffset);
-    free(offsets);
-    free(count);
+    free(sendcount);
 
     return 0;
 
     fail_oom:
-        free(recvcount);
+        free(nsend);
+        free(count);
         free(recvoffset);
+        free(recvcount);
         free(sendoffset);
-        free(offsets);
-        free(count);
+        free(sendcount);
     return -1;
 }
 
@@ -746,6 +1853,7 @@ fastpm_store_fill(FastPMStore * p, PM * pm, double * shift, ptrdiff_t * Nc)
             p->meta._q_shift[d] = 0;
 
         p->meta._q_scale[d] = pm->BoxSize[d] / Nc[d];
+        p->meta._x_box[d] = pm->BoxSize[d];
     }
 
     p->meta._q_size = Nc[0] * Nc[1] * Nc[2];
@@ -781,12 +1889,14 @@ fastpm_store_fill(FastPMStore * p, PM * pm, double * shift, ptrdiff_t * Nc)
             if(p->rand) p->rand[ptr] = 0.;
             if(p->rmom) p->rmom[ptr] = 0.;
 
-            fastpm_store_get_q_from_id(p, id, &p->x[ptr][0]);
+            double q[3];
+            fastpm_store_get_q_from_id(p, id, q);
+            fastpm_store_set_position(p, ptr, q);
 
             if(p->q) {
                 /* set q if it is allocated. */
                 for(d = 0; d < 3; d ++) {
-                    p->q[ptr][d] = p->x[ptr][d];
+                    p->q[ptr][d] = q[d];
                 }
             }
             ptr ++;
@@ -926,7 +2036,7 @@ _fastpm_store_copy(FastPMStore * p, ptrdiff_t start, FastPMStore * po, ptrdiff_t
     if(ncopy + start > p->np) {
         fastpm_raise(-1, "Copy out of bounds from source FastPMStore: asking for %td but has %td\n", ncopy + start, p->np);
     }
-    if(ncopy + offset > po->np_upper) {
+    if(ncopy + offset > po->np_upper && 0 != fastpm_store_grow(po, ncopy + offset)) {
         fastpm_raise(-1, "Not enough storage in target FastPMStore: asking for %td but has %td\n", ncopy + offset, po->np_upper);
     }
 
@@ -1033,4 +2143,54 @@ fastpm_store_subsample(FastPMStore * p, FastPMParticleMaskType * mask, FastPMSto
     return j;
 }
 
+/*
+ * Stably move the particles with mask == True before those with mask == False.
+ *
+ * Returns the number of particles with mask == True.
+ * */
+size_t
+fastpm_store_partition(FastPMStore * p, FastPMParticleMaskType * mask)
+{
+    ptrdiff_t i;
+    size_t ntrue = 0;
+    size_t maxsize = 0;
+
+#pragma omp parallel for reduction(+: ntrue)
+    for(i = 0; i < p->np; i ++) {
+        if(mask[i]) ntrue ++;
+    }
+
+    int c;
+    for(c = 0; c < 32; c ++) {
+        if(!p->columns[c]) continue;
+        if(p->_column_info[c].elsize > maxsize)
+            maxsize = p->_column_info[c].elsize;
+    }
+
+    char * tmp = fastpm_memory_alloc(p->mem, "PartitionTmp", maxsize * (p->np - ntrue), FASTPM_MEMORY_STACK);
+
+    for(c = 0; c < 32; c ++) {
+        if(!p->columns[c]) continue;
+
+        size_t elsize = p->_column_info[c].elsize;
+        char * column = p->columns[c];
+        ptrdiff_t j = 0, k = 0;
+        for(i = 0; i < p->np; i ++) {
+            if(mask[i]) {
+                if(i != j) {
+                    memcpy(column + j * elsize, column + i * elsize, elsize);
+                }
+                j ++;
+            } else {
+                memcpy(tmp + k * elsize, column + i * elsize, elsize);
+                k ++;
+            }
+        }
+        memcpy(column + j * elsize, tmp, k * elsize);
+    }
+
+    fastpm_memory_free(p->mem, tmp);
+    return ntrue;
+}
+
 
@@ -1,5 +1,6 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fastpm/libfastpm.h>
 #include <fastpm/logging.h>
 #include "pmpfft.h"
@@ -356,3 +357,214 @@ fastpm_apply_get_mode_transfer(PM * pm, FastPMFloat * from, ptrdiff_t * mode)
     return result;
 }
 
+
+/*
+ * Fused transfer: a list of diagonal transfer operations applied in one
+ * sweep over the complex mesh.
+ *
+ * All of the operations multiply each mode by a factor, so they commute.
+ * Factors that separate in the three axes are folded into one table per axis
+ * when the operation is added; the others are evaluated per mode from
+ * the k tables of the iterator. Differentiations contribute a factor of i each.
+ * */
+void
+fastpm_fused_transfer_init(FastPMFusedTransfer * tr, PM * pm)
+{
+    memset(tr, 0, sizeof(tr[0]));
+    tr->pm = pm;
+    tr->scale = 1.0;
+}
+
+void
+fastpm_fused_transfer_destroy(FastPMFusedTransfer * tr)
+{
+    int d;
+    for(d = 0; d < 3; d ++) {
+        free(tr->fac[d]);
+        tr->fac[d] = NULL;
+    }
+}
+
+static double *
+_fused_transfer_fac(FastPMFusedTransfer * tr, int d)
+{
+    PM * pm = tr->pm;
+    if(tr->fac[d] == NULL) {
+        int i;
+        tr->fac[d] = malloc(sizeof(double) * pm->Nmesh[d]);
+        for(i = 0; i < pm->Nmesh[d]; i ++) {
+            tr->fac[d][i] = 1.0;
+        }
+    }
+    return tr->fac[d];
+}
+
+static void
+_fused_transfer_add_op(FastPMFusedTransfer * tr, int type, int order, double kth2, fastpm_fkfunc func, void * data)
+{
+    if(tr->nops == FASTPM_FUSED_TRANSFER_MAX_OPS) {
+        fastpm_raise(-1, "Too many operations in a fused transfer.\n");
+    }
+    tr->ops[tr->nops].type = type;
+    tr->ops[tr->nops].order = order;
+    tr->ops[tr->nops].kth2 = kth2;
+    tr->ops[tr->nops].func = func;
+    tr->ops[tr->nops].data = data;
+    tr->nops ++;
+}
+
+void
+fastpm_fused_transfer_add_multiply(FastPMFusedTransfer * tr, double value)
+{
+    tr->scale *= value;
+}
+
+void
+fastpm_fused_transfer_add_smoothing(FastPMFusedTransfer * tr, double sml)
+{
+    PM * pm = tr->pm;
+    int d, i;
+    for(d = 0; d < 3; d ++) {
+        double * fac = _fused_transfer_fac(tr, d);
+        for(i = 0; i < pm->Nmesh[d]; i ++) {
+            double k = pm->MeshtoK[d][i];
+            fac[i] *= exp(- 0.5 * k * k * sml * sml);
+        }
+    }
+}
+
+void
+fastpm_fused_transfer_add_decic(FastPMFusedTransfer * tr)
+{
+    PM * pm = tr->pm;
+    int d, i;
+    for(d = 0; d < 3; d ++) {
+        double * fac = _fused_transfer_fac(tr, d);
+        for(i = 0; i < pm->Nmesh[d]; i ++) {
+            double w = pm->MeshtoK[d][i] * pm->CellSize[d];
+            double cic = sinc_unnormed(0.5 * w);
+            /* Watchout: this does divide by sinc, not sinc 2, */
+            fac[i] *= 1.0 / pow(cic, 2);
+        }
+    }
+}
+
+void
+fastpm_fused_transfer_add_grad(FastPMFusedTransfer * tr, int dir, int order)
+{
+    PM * pm = tr->pm;
+    double * fac = _fused_transfer_fac(tr, dir);
+    int i;
+    for(i = 0; i < pm->Nmesh[dir]; i ++) {
+        double k = pm->MeshtoK[dir][i];
+        if(order == 1) {
+            /* 4 point central diff, same as k_finite */
+            double w = k * pm->CellSize[dir];
+            k = 1 / pm->CellSize[dir] * (1 / 6.0 * (8 * sin (w) - sin (2 * w)));
+        }
+        fac[i] *= k;
+    }
+    tr->nimag ++;
+}
+
+void
+fastpm_fused_transfer_add_diff(FastPMFusedTransfer * tr, int dir)
+{
+    fastpm_fused_transfer_add_grad(tr, dir, 1);
+}
+
+void
+fastpm_fused_transfer_add_laplace(FastPMFusedTransfer * tr, int order)
+{
+    _fused_transfer_add_op(tr, FASTPM_FUSED_LAPLACE, order, 0, NULL, NULL);
+}
+
+void
+fastpm_fused_transfer_add_lowpass(FastPMFusedTransfer * tr, double kth)
+{
+    _fused_transfer_add_op(tr, FASTPM_FUSED_LOWPASS, 0, kth * kth, NULL, NULL);
+}
+
+void
+fastpm_fused_transfer_add_any(FastPMFusedTransfer * tr, fastpm_fkfunc func, void * data)
+{
+    _fused_transfer_add_op(tr, FASTPM_FUSED_ANY, 0, 0, func, data);
+}
+
+void
+fastpm_fused_transfer_apply(FastPMFusedTransfer * tr, FastPMFloat * from, FastPMFloat * to)
+{
+    PM * pm = tr->pm;
+    ptrdiff_t * Nmesh = pm_nmesh(pm);
+    /* i ** nimag */
+    const int nimag = tr->nimag % 4;
+
+#pragma omp parallel
+    {
+        PMKIter kiter;
+        pm_kiter_init(pm, &kiter);
+        float ** kklist [3] = {kiter.kk, kiter.kk_finite, kiter.kk_finite2};
+        for(;
+            !pm_kiter_stop(&kiter);
+            pm_kiter_next(&kiter)) {
+            ptrdiff_t ind = kiter.ind;
+            double fac = tr->scale;
+            int d;
+            for(d = 0; d < 3; d++) {
+                if(tr->fac[d]) fac *= tr->fac[d][kiter.iabs[d]];
+            }
+            int j;
+            for(j = 0; j < tr->nops; j ++) {
+                double kk = 0;
+                for(d = 0; d < 3; d++) {
+                    kk += kklist[tr->ops[j].order][d][kiter.iabs[d]];
+                }
+                switch(tr->ops[j].type) {
+                    case FASTPM_FUSED_LAPLACE:
+                        /* 1 / k2 */
+                        if(LIKELY(kk != 0)) {
+                            fac *= 1 / kk;
+                        } else {
+                            fac = 0;
+                        }
+                    break;
+                    case FASTPM_FUSED_LOWPASS:
+                        if(kk >= tr->ops[j].kth2) fac = 0;
+                    break;
+                    case FASTPM_FUSED_ANY:
+                        fac *= tr->ops[j].func(sqrt(kk), tr->ops[j].data);
+                    break;
+                }
+            }
+            if(tr->nimag > 0 &&
+                kiter.iabs[0] == (Nmesh[0] - kiter.iabs[0]) % Nmesh[0] &&
+                kiter.iabs[1] == (Nmesh[1] - kiter.iabs[1]) % Nmesh[1] &&
+                kiter.iabs[2] == (Nmesh[2] - kiter.iabs[2]) % Nmesh[2]
+            ) {
+                /* We are at the nyquist and the diff operator shall be zero;
+                 * otherwise the force is not real! */
+                fac = 0;
+            }
+            FastPMFloat re = from[ind + 0] * fac;
+            FastPMFloat im = from[ind + 1] * fac;
+            switch(nimag) {
+                case 0:
+                    to[ind + 0] = re;
+                    to[ind + 1] = im;
+                break;
+                case 1:
+                    to[ind + 0] = - im;
+                    to[ind + 1] = re;
+                break;
+                case 2:
+                    to[ind + 0] = - re;
+                    to[ind + 1] = - im;
+                break;
+                case 3:
+                    to[ind + 0] = im;
+                    to[ind + 1] = - re;
+                break;
+            }
+        }
+    }
+}
@@ -112,14 +112,11 @@ fastpm_sort_snapshot(FastPMStore * p, MPI_Comm comm, FastPMSnapshotSorter sorter
 
     char * send_buffer = malloc(elsize * p->np);
     char * recv_buffer = malloc(elsize * localsize);
-    ptrdiff_t i;
 
     FastPMStore ptmp[1];
     fastpm_store_init(ptmp, "TMP", 1, p->attributes, FASTPM_MEMORY_HEAP);
 
-    for(i = 0; i < p->np; i ++) {
-        fastpm_packing_plan_pack(plan, p, i, send_buffer + i * plan->elsize);
-    }
+    fastpm_packing_plan_pack_many(plan, p, NULL, 0, p->np, send_buffer);
 
     struct sort_data data[1];
     data->p = ptmp;
@@ -127,9 +124,7 @@ fastpm_sort_snapshot(FastPMStore * p, MPI_Comm comm, FastPMSnapshotSorter sorter
 
     mpsort_mpi_newarray(send_buffer, p->np, recv_buffer, localsize, elsize, sorter, 8, data, comm);
 
-    for(i = 0; i < localsize; i ++) {
-        fastpm_packing_plan_unpack(plan, p, i, recv_buffer + i * plan->elsize);
-    }
+    fastpm_packing_plan_unpack_many(plan, p, 0, localsize, recv_buffer);
     p->np = localsize;
     fastpm_store_destroy(ptmp);
     free(recv_buffer);
@@ -1144,7 +1139,7 @@ fastpm_snapshot_paint_hpmap(FastPMStore * p,
         map->aemit[i] = (slice_id + 0.5) / nslice;
     }
 
-    fastpm_store_sort(map, FastPMLocalSortByID);
+    fastpm_store_sort(map, FastPMLocalSortByID, NULL);
     combine_pixels(map);
 
     fastpm_info("Locally combined, np = %d", map->np);
@@ -158,6 +158,7 @@ main(int argc, char * argv[])
 
     fastpm_store_destroy(halos);
     fastpm_rfof_destroy(&rfof);
+    fastpm_cosmology_destroy(cosmology);
     free_lua_parameters(lua);
     free_cli_parameters(cli);
 
@@ -153,6 +153,17 @@ int main(int argc, char ** argv) {
     }
 
     libfastpm_set_memory_bound(prr->cli->MemoryPerRank * 1024 * 1024);
+    libfastpm_set_exchange_budget(CONF(prr->lua, exchange_buffer_size) * 1024 * 1024);
+    libfastpm_set_node_aware_exchange(CONF(prr->lua, node_aware_exchange));
+    libfastpm_set_ranks_per_node(CONF(prr->lua, ranks_per_node));
+    libfastpm_set_fft_planning(CONF(prr->lua, fft_planning));
+    if(CONF(prr->lua, fft_wisdom)) {
+        if(libfastpm_import_fft_wisdom(CONF(prr->lua, fft_wisdom), comm)) {
+            fastpm_info("Imported FFT wisdom from '%s'.\n", CONF(prr->lua, fft_wisdom));
+        } else {
+            fastpm_info("No FFT wisdom imported from '%s'; plans will be made from scratch.\n", CONF(prr->lua, fft_wisdom));
+        }
+    }
     fastpm_memory_set_handlers(_libfastpm_get_gmem(), NULL, _memory_peak_handler, &comm);
 
     /* convert parameter files pm_nc_factor into VPMInit */
@@ -196,10 +207,21 @@ int main(int argc, char ** argv) {
         .FORCE_TYPE = CONF(prr->lua, force_mode),
         .KERNEL_TYPE = CONF(prr->lua, kernel_type),
         .SOFTENING_TYPE = CONF(prr->lua, force_softening_type),
+        .FD_GRADIENT = CONF(prr->lua, force_fd_gradient),
         .PAINTER_TYPE = CONF(prr->lua, painter_type),
         .painter_support = CONF(prr->lua, painter_support),
+        .PaintAtomic = CONF(prr->lua, paint_atomic),
         .NprocY = prr->cli->NprocY,
         .UseFFTW = prr->cli->UseFFTW,
+        .FFTBatch = CONF(prr->lua, fft_batch),
+        .FuseHalfSteps = CONF(prr->lua, fuse_half_steps),
+        .ForceFFTPrecision = CONF(prr->lua, force_fft_precision),
+        .BalancedDomain = CONF(prr->lua, domain_balance),
+        .MeshHalo = CONF(prr->lua, mesh_halo),
+        .DecomposeSkin = CONF(prr->lua, decompose_skin),
+        .LocalSortInterval = CONF(prr->lua, local_sort_interval),
+        .CompactPosition = CONF(prr->lua, compact_position),
+        .CompactLPTDisplacement = CONF(prr->lua, compact_lpt_displacement),
         .ExtraAttributes = 0,
         .pgdc = CONF(prr->lua, pgdc),
         .pgdc_alpha0 = CONF(prr->lua, pgdc_alpha0),
@@ -218,6 +240,14 @@ int main(int argc, char ** argv) {
 
     run_fastpm(config, prr, comm);
 
+    if(CONF(prr->lua, fft_wisdom)) {
+        if(libfastpm_export_fft_wisdom(CONF(prr->lua, fft_wisdom), comm)) {
+            fastpm_info("Exported FFT wisdom to '%s'.\n", CONF(prr->lua, fft_wisdom));
+        } else {
+            fastpm_info("Failed to export FFT wisdom to '%s'.\n", CONF(prr->lua, fft_wisdom));
+        }
+    }
+
     free_lua_parameters(prr->lua);
     free_cli_parameters(prr->cli);
 
@@ -637,6 +667,9 @@ prepare_cdm(FastPMSolver * fastpm, RunData * prr, double a0, MPI_Comm comm)
     /* we may need a read gadget ic here too */
     if(CONF(prr->lua, read_runpbic)) {                 //runpbic is old code. dont think about when it comes to ncdm.
         FastPMStore * p = fastpm_solver_get_species(fastpm, FASTPM_SPECIES_CDM);
+        if(p->x == NULL) {
+            fastpm_raise(-1, "read_runpbic does not support compact_position.\n");
+        }
         int temp_dx1 = 0;
         int temp_dx2 = 0;
         if(p->dx1 == NULL) {
@@ -753,7 +786,7 @@ prepare_ncdm(FastPMSolver * fastpm, RunData * prr, double a0, MPI_Comm comm)
     fastpm_store_init_evenly(ncdm,
           fastpm_species_get_name(FASTPM_SPECIES_NCDM),
           total_np_ncdm,
-          cdm->attributes | COLUMN_MASS,
+          (cdm->attributes & ~COLUMN_POS_FIXED) | COLUMN_POS | COLUMN_MASS,
           fastpm->config->alloc_factor,
           comm);
 
@@ -763,7 +796,7 @@ prepare_ncdm(FastPMSolver * fastpm, RunData * prr, double a0, MPI_Comm comm)
     fastpm_store_init_evenly(ncdm_sites,
           fastpm_species_get_name(FASTPM_SPECIES_NCDM),
           total_np_ncdm_sites,
-          cdm->attributes,                           //dont need mass col for sites
+          (cdm->attributes & ~COLUMN_POS_FIXED) | COLUMN_POS, //dont need mass col for sites
           fastpm->config->alloc_factor,
           comm);
 
@@ -1428,6 +1461,7 @@ take_a_snapshot(FastPMSolver * fastpm, RunData * prr)
         FastPMFloat * rho_k = pm_alloc(fastpm->basepm);
 
         fastpm_painter_init(painter, fastpm->basepm, fastpm->config->PAINTER_TYPE, fastpm->config->painter_support);
+        painter->use_atomic = fastpm->config->PaintAtomic;
 
         fastpm_paint(painter, rho_x, cdm, FASTPM_FIELD_DESCR_NONE);
         pm_r2c(fastpm->basepm, rho_x, rho_k);
@@ -1455,7 +1489,8 @@ take_a_snapshot(FastPMSolver * fastpm, RunData * prr)
             fastpm_store_init(&subsample[si],
                         p->name,
                         fastpm_store_subsample(p, mask, NULL),
-                        p->attributes & (~COLUMN_ACC) & (~COLUMN_MASK),
+                        p->attributes & (~COLUMN_ACC) & (~COLUMN_MASK)
+                            & (~COLUMN_POS_FIXED) & (~COLUMN_DX1_FIXED) & (~COLUMN_DX2_FIXED),
                         FASTPM_MEMORY_FLOATING);
             fastpm_store_subsample(p, mask, &subsample[si]);
             fastpm_memory_free(p->mem, mask);
@@ -1693,7 +1728,7 @@ report_domain(FastPMSolver * fastpm, FastPMForceEvent * event, RunData * prr)
     {
         double min[3], max[3], std[3];
 
-        fastpm_store_summary(p, COLUMN_POS, comm, "<>", min, max);
+        fastpm_store_summary(p, fastpm_store_get_position_attribute(p), comm, "<>", min, max);
         fastpm_store_summary(p, COLUMN_VEL, comm, "s", std);
 
         fastpm_info("Position range (a = %06.4f): min = %g %g %g max = %g %g %g \n",
@@ -46,7 +46,7 @@ schema.declare{name='N_nu',              type='number', required=false, default=
 schema.declare{name='m_ncdm',            type='array:number', required=false, default={}, help="Mass of ncdm particles in eV. Enter in descending order."}
 schema.declare{name='pm_nc_factor',      type='array:number',  required=true, help="A list of {a, PM resolution}, "}
 schema.declare{name='lpt_nc_factor',     type='number', required=false, default=1, help="PM resolution use in lpt and linear density field."}
-schema.declare{name='np_alloc_factor',   type='number', required=true, help="Over allocation factor for load imbalance" }
+schema.declare{name='np_alloc_factor',   type='number', required=true, help="Over allocation factor for load imbalance; the particle stores grow beyond it when needed, within the memory bound." }
 schema.declare{name='compute_potential', type='boolean', required=false, default=false, help="Calculate the gravitional potential."}
 schema.declare{name='n_shell',           type='number', required=false, default=10, help="Number of shells of FD distribution for ncdm splitting. Set n_shell=0 for no ncdm particles."}
 schema.declare{name='lvk',               type='boolean', required=false, default=true, help="Use the low velocity kernel when splitting FD for ncdm."}
@@ -131,6 +131,7 @@ end
 -- Force calculation --
 schema.declare{name='painter_type',        type='enum', default='cic', help="Type of painter."}
 schema.declare{name='painter_support',     type='int', default=2, help="Support (size) of the painting kernel"}
+schema.declare{name='paint_atomic',        type='boolean', default=false, help="Paint from several threads with atomic updates of the mesh, instead of colouring the particles by slabs of the mesh. Only used with more than one thread."}
 schema.painter_type.choices = {
     cic = 'FASTPM_PAINTER_CIC',
     linear = 'FASTPM_PAINTER_LINEAR',
@@ -309,6 +310,41 @@ schema.force_softening_type.choices = {
     twothird = 'FASTPM_SOFTENING_TWO_THIRD',
 }
 
+schema.declare{name='force_fd_gradient',       type='boolean', default=false, help='Take the gradient of the potential in real space with a 4 point finite difference; one c2r per force instead of three. Identical to the Fourier space gradient of kernels 1_4, 3_4 and gadget.'}
+
+schema.declare{name='fft_batch',               type='boolean', default=false, help='Transform the force components and the 2LPT fields in one batched c2r, sharing the global transposes. Uses one more mesh per batched field.'}
+
+schema.declare{name='force_fft_precision',     type='int', default=0, help='Precision in bits (32 or 64) of the FFTs of the force meshes; the IC and LPT meshes keep the precision of the build. 32 in a double precision build halves the traffic of the global transposes of the force; the meshes are still stored in double. 0 for the precision of the build.'}
+
+schema.declare{name='fuse_half_steps',         type='boolean', default=false, help='Apply the closing kick of a step and the opening kick of the next in one pass over the particles, and likewise the two drifts around the synchronization point. Halves the passes of the particle update; the results differ from the unfused update only by rounding.'}
+
+schema.declare{name='domain_balance',          type='boolean', default=false, help='Decompose the particles into domains with about the same number of particles, instead of following the PM mesh; the mesh cells are exchanged between the domains and the PM mesh when painting and reading out. Allows a smaller np_alloc_factor for clustered boxes.'}
+
+schema.declare{name='mesh_halo',               type='boolean', default=false, help='Paint and read out the force on the local PM region padded by a margin of cells, and exchange the margin cells with the neighbouring ranks, instead of creating particle ghosts. The traffic follows the surface of the regions rather than the particles near the edges. Uses one more local mesh. Implied by domain_balance.'}
+
+schema.declare{name='decompose_skin',          type='number', default=0, help='Width of the skin in PM cells for the incremental decomposition. Particles deeper than the skin inside a rank are not tested again until the total drift since the last full decomposition exceeds the skin. 0 to test all particles in every decomposition. Not used with domain_balance.'}
+
+schema.declare{name='local_sort_interval',     type='int', default=0, help='Sort the particles on each rank along a Morton curve after every this many full decompositions, for the cache reuse in painting and reading out. 0 to never sort.'}
+
+schema.declare{name='compact_position',        type='boolean', default=false, help='Store the positions of the CDM particles as 32-bit fixed point fractions of the box instead of doubles, saving 12 bytes per particle. The resolution is BoxSize / 2**32. Snapshots and halo finding still see double positions.'}
+
+schema.declare{name='compact_lpt_displacement', type='boolean', default=false, help='Store the LPT displacements kept by COLA as 16-bit integers in units of the largest displacement / 32767, instead of floats, saving 12 bytes per particle. Snapshots still see float displacements.'}
+
+schema.declare{name='exchange_buffer_size',    type='number', default=0, help='Buffer size in MB per rank for moving particles between ranks. The particles are sent in chunks and unpacked as they arrive, so the exchange needs no buffer as large as the particles moved. Besides the buffer the exchange uses 4 bytes per particle slot of the store, and 8 bytes per particle moved in a pass. 0 to move all particles at once.'}
+
+schema.declare{name='node_aware_exchange', type='boolean', default=false, help='Route the sparse all to all exchanges (particles, ghosts, mesh halos) through one leader rank per shared memory node, reducing the number of messages between nodes. The leaders hold twice the data their node exchanges.'}
+
+schema.declare{name='ranks_per_node',      type='int', default=0, help='Group this many consecutive ranks into a node for node_aware_exchange, instead of the ranks that share memory; e.g. to try the node-aware exchange on one machine. 0 for the ranks that share memory.'}
+
+schema.declare{name='fft_planning', type='enum', default='estimate', help="Effort of planning the FFTs. 'measure' and 'patient' time trial transforms for faster plans, which takes long unless fft_wisdom holds the plans of an earlier run with the same nc, process mesh and precision."}
+schema.fft_planning.choices = {
+    estimate = 'FASTPM_FFT_ESTIMATE',
+    measure = 'FASTPM_FFT_MEASURE',
+    patient = 'FASTPM_FFT_PATIENT',
+}
+
+schema.declare{name='fft_wisdom', type='string', help='File of FFT wisdom. Read before the plans are made if it exists, and written with the plans of this run at the end.'}
+
 schema.declare{name='constraints',      type='array:number',  help="A list of {x, y, z, peak-sigma}, giving the constraints in MPC/h units. "}
 function schema.constraints.action (constraints)
     if constraints == nil then
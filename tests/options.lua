@@ -0,0 +1,100 @@
+-- parameter file
+-- A small run to compare the optional code paths against the default ones.
+-- The arguments are keywords; each turns on an option, and all of them name
+-- the output directory, e.g. options-fastpm-paint_atomic/powerspec_1.0000.txt.
+------ Size of the simulation --------
+
+-- For Testing
+nc = 64
+boxsize = 256.0
+
+local function has(keyword)
+    for i,k in pairs(args) do
+        if k == keyword then
+            return true
+        end
+    end
+    return false
+end
+
+-------- Time Sequence ----
+-- 'steps' for short steps, e.g. for the options that act between the steps.
+if has('steps') then
+    time_step = linspace(0.1, 1, 19)
+else
+    time_step = linspace(0.1, 1, 3)
+end
+
+output_redshifts= {0.0}  -- redshifts of output
+
+-- Cosmology --
+Omega_m = 0.307494
+h       = 0.6774
+
+-- Start with a linear density field
+read_powerspectrum= "powerspec.txt"
+linear_density_redshift = 0.0 -- the redshift of the linear density field.
+random_seed= 100
+particle_fraction = 1.0
+--
+-------- Approximation Method ---------------
+if has('cola') then
+    force_mode = "cola"
+else
+    force_mode = "fastpm"
+end
+kernel_type = "1_4"
+
+growth_mode = "LCDM"
+
+pm_nc_factor = 2
+lpt_nc_factor = 1
+
+np_alloc_factor= 4.0      -- Amount of memory allocated for particle
+
+-- 'threaded' only names the output of a run with -T > 1.
+
+if has('paint_atomic') then
+    paint_atomic = true
+end
+if has('force_fd_gradient') then
+    force_fd_gradient = true
+end
+if has('fft_batch') then
+    fft_batch = true
+end
+if has('domain_balance') then
+    domain_balance = true
+end
+if has('decompose_skin') then
+    decompose_skin = 4.0
+end
+if has('mesh_halo') then
+    mesh_halo = true
+end
+if has('compact_position') then
+    compact_position = true
+end
+if has('compact_lpt_displacement') then
+    compact_lpt_displacement = true
+end
+if has('force_fft_precision') then
+    force_fft_precision = 32
+end
+if has('node_aware_exchange') then
+    node_aware_exchange = true
+    -- two nodes of two ranks on one machine
+    ranks_per_node = 2
+end
+
+-------- Output ---------------
+
+prefix = 'options'
+for i,k in pairs(args) do
+    if i > 0 then
+    prefix = prefix .. '-' .. k
+    end
+end
+
+-- 1d power spectrum (raw), without shotnoise correction
+write_powerspectrum = prefix .. "/powerspec"
@@ -0,0 +1,22 @@
+#! /bin/bash
+
+source testfunctions.sh
+
+FASTPM="`dirname $0`/../src/fastpm -T 1"
+log=`mktemp`
+logfused=`mktemp`
+
+assert_success "mpirun -n 4 $FASTPM nbodykit.lua > $log"
+assert_success "mpirun -n 4 $FASTPM nbodykit-fused.lua > $logfused"
+
+echo "---- Validating the log output -------"
+assert_file_contains $logfused 'RSD factor.*1.140331e-02'
+assert_file_contains $logfused 'sigma8.*0.815897'
+
+# the fused half steps only change the rounding of the particle update.
+echo "---- Comparing with the unfused run -------"
+for a in 0.5500 1.0000; do
+    assert_success "compare_powerspectrum nbodykit/powerspec_$a.txt nbodykit-fused/powerspec_$a.txt"
+done
+
+report_test_status
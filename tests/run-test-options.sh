@@ -0,0 +1,65 @@
+#! /bin/bash
+
+# Runs options.lua with the optional code paths turned on, and compares
+# the power spectra with the runs on the default paths.
+
+source testfunctions.sh
+
+FASTPM="`dirname $0`/../src/fastpm"
+
+# compare the power spectra of the runs options-$1 and options-$2 to the tolerance $3.
+compare_runs () {
+    for a in 0.5500 1.0000; do
+        assert_success "compare_powerspectrum options-$1/powerspec_$a.txt options-$2/powerspec_$a.txt $3"
+    done
+}
+
+assert_success "mpirun -n 4 $FASTPM -T 1 options.lua fastpm > /dev/null"
+
+# painting from several threads only changes the order of the sums.
+assert_success "mpirun -n 4 $FASTPM -T 2 options.lua fastpm threaded > /dev/null"
+assert_success "mpirun -n 4 $FASTPM -T 2 options.lua fastpm threaded paint_atomic > /dev/null"
+compare_runs fastpm fastpm-threaded 1e-4
+compare_runs fastpm fastpm-threaded-paint_atomic 1e-4
+
+# the real space 4 point gradient is the Fourier space gradient of kernel 1_4.
+assert_success "mpirun -n 4 $FASTPM -T 1 options.lua fastpm force_fd_gradient > /dev/null"
+compare_runs fastpm fastpm-force_fd_gradient 1e-4
+
+# a batched c2r does the same transforms with shared transposes.
+assert_success "mpirun -n 4 $FASTPM -T 1 options.lua fastpm fft_batch > /dev/null"
+compare_runs fastpm fastpm-fft_batch 1e-4
+
+# the balanced domains only change where the particles are painted and read out.
+assert_success "mpirun -n 4 $FASTPM -T 1 options.lua fastpm domain_balance > /dev/null"
+compare_runs fastpm fastpm-domain_balance 1e-4
+
+# the skin only skips the particles that cannot have left their rank;
+# short steps such that some decompositions are incremental.
+log=`mktemp`
+assert_success "mpirun -n 4 $FASTPM -T 1 options.lua fastpm steps > /dev/null"
+assert_success "mpirun -n 4 $FASTPM -T 1 options.lua fastpm steps decompose_skin > $log"
+assert_file_contains $log 'Decomposing the skin only'
+compare_runs fastpm-steps fastpm-steps-decompose_skin 1e-4
+
+# the halo of the mesh replaces the particle ghosts.
+assert_success "mpirun -n 4 $FASTPM -T 1 options.lua fastpm mesh_halo > /dev/null"
+compare_runs fastpm fastpm-mesh_halo 1e-4
+
+# the fixed point positions resolve boxsize / 2**32.
+assert_success "mpirun -n 4 $FASTPM -T 1 options.lua fastpm compact_position > /dev/null"
+compare_runs fastpm fastpm-compact_position 1e-4
+
+# the 16 bit LPT displacements resolve 1 / 32767 of the largest one; that
+# moves the particles by up to ~1e-3 Mpc/h, seen at the high k bins.
+assert_success "mpirun -n 4 $FASTPM -T 1 options.lua cola > /dev/null"
+assert_success "mpirun -n 4 $FASTPM -T 1 options.lua cola compact_lpt_displacement > /dev/null"
+compare_runs cola cola-compact_lpt_displacement 1e-3
+
+# the exchanges through the node leaders move the same data.
+log=`mktemp`
+assert_success "mpirun -n 4 $FASTPM -T 1 options.lua fastpm node_aware_exchange > $log"
+assert_file_contains $log 'Node-aware Alltoallv on 2 nodes of 4 ranks'
+compare_runs fastpm fastpm-node_aware_exchange 1e-4
+
+report_test_status
@@ -42,6 +42,16 @@ assert_file_contains () {
   fi
 }
 
+# compare the power of the power spectrum files $1 and $2 bin by bin,
+# to the relative tolerance $3 (default 1e-4).
+compare_powerspectrum () {
+  local tol=${3:-1e-4}
+  paste -d ' ' <(grep -v '^#' $1) <(grep -v '^#' $2) | \
+      awk -v tol=$tol \
+          '{ d = $2 - $5; if(d < 0) d = -d; if(d > tol * ($2 < 0 ? -$2 : $2) + 1e-10) bad ++ }
+           END { if(NR == 0 || bad > 0) { print bad " of " NR " bins differ"; exit 1 } }'
+}
+
 report_test_status () {
   if [ $NUMFAILS -gt 0 ]; then
      echo "$0: Some tests have failed."
@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <alloca.h>
+#include <mpi.h>
+#include <math.h>
+#include <fastpm/libfastpm.h>
+#include <fastpm/logging.h>
+
+/* Compares the secant crossing solver of the lightcone against bisection,
+ * on the trajectories of the particles of a short run and the real horizon. */
+
+struct params {
+    FastPMHorizon * horizon;
+    FastPMDriftFactor * drift;
+    FastPMStore * p;
+    ptrdiff_t i;
+    double shift[3];
+    int nevals;
+};
+
+static double
+funct(double a, void * userdata)
+{
+    struct params * P = userdata;
+    double x[3];
+    fastpm_drift_one(P->drift, P->p, P->i, x, a);
+    double r = 0;
+    int d;
+    for(d = 0; d < 3; d ++) {
+        x[d] += P->shift[d];
+        r += x[d] * x[d];
+    }
+    P->nevals ++;
+    return sqrt(r) - HorizonDistance(a, P->horizon);
+}
+
+/* the reference: bisection down to rounding */
+static int
+bisect(double * solution, double lo, double hi, struct params * P)
+{
+    double f_lo = funct(lo, P);
+    double f_hi = funct(hi, P);
+    if(f_lo == 0) { *solution = lo; return 1; }
+    if(f_hi == 0) { *solution = hi; return 1; }
+    if(!((f_lo < 0) != (f_hi < 0))) return 0;
+    int iter;
+    for(iter = 0; iter < 100; iter ++) {
+        double mid = 0.5 * (lo + hi);
+        if(mid <= lo || mid >= hi) break;
+        double f = funct(mid, P);
+        if((f < 0) == (f_lo < 0)) {
+            lo = mid;
+            f_lo = f;
+        } else {
+            hi = mid;
+        }
+    }
+    *solution = 0.5 * (lo + hi);
+    return 1;
+}
+
+int main(int argc, char * argv[]) {
+
+    MPI_Init(&argc, &argv);
+
+    libfastpm_init();
+
+    MPI_Comm comm = MPI_COMM_WORLD;
+
+    fastpm_set_msg_handler(fastpm_default_msg_handler, comm, NULL);
+
+    FastPMConfig * config = & (FastPMConfig) {
+        .nc = 32,
+        .boxsize = 4096.,
+        .alloc_factor = 2.0,
+        .cosmology = NULL,
+        .vpminit = (VPMInit[]) {
+            {.a_start = 0, .pm_nc_factor = 1},
+            {.a_start = -1, .pm_nc_factor = 0},
+        },
+        .FORCE_TYPE = FASTPM_FORCE_FASTPM,
+        .nLPT = 2.5,
+    };
+    FastPMSolver solver[1];
+
+    fastpm_solver_init(solver, config, comm);
+
+    FastPMFloat * rho_init_ktruth = pm_alloc(solver->basepm);
+
+    struct fastpm_powerspec_eh_params eh = {
+        .Norm = 5e6,
+        .hubble_param = 0.7,
+        .omegam = 0.260,
+        .omegab = 0.044,
+    };
+    fastpm_ic_fill_gaussiank(solver->basepm, rho_init_ktruth, 2004, FASTPM_DELTAK_GADGET);
+    fastpm_ic_induce_correlation(solver->basepm, rho_init_ktruth, (fastpm_fkfunc)fastpm_utils_powerspec_eh, &eh);
+
+    fastpm_solver_setup_lpt(solver, FASTPM_SPECIES_CDM, rho_init_ktruth, NULL, 0.1);
+
+    double time_step[] = {0.1, 0.3, 0.5};
+    fastpm_solver_evolve(solver, time_step, sizeof(time_step) / sizeof(time_step[0]));
+
+    FastPMStore * p = fastpm_solver_get_species(solver, FASTPM_SPECIES_CDM);
+
+    FastPMHorizon * horizon = malloc(sizeof(FastPMHorizon));
+    fastpm_horizon_init(horizon, 1.0, solver->cosmology);
+
+    FastPMDriftFactor drift;
+    fastpm_drift_init(&drift, solver, p->meta.a_x, p->meta.a_v, 1.0);
+
+    /* the observer at the center of the box, such that the horizon sweeps through it */
+    struct params P = {
+        .horizon = horizon,
+        .drift = &drift,
+        .p = p,
+        .shift = {-0.5 * config->boxsize, -0.5 * config->boxsize, -0.5 * config->boxsize},
+    };
+
+    double a_i = p->meta.a_x;
+    double a_f = 1.0;
+
+    ptrdiff_t ncross = 0;
+    ptrdiff_t nmismatch = 0;
+    ptrdiff_t nevals = 0;
+    double maxerr = 0;
+    ptrdiff_t i;
+    for(i = 0; i < p->np; i ++) {
+        double a_secant = 0, a_bisect = 0;
+        P.i = i;
+        P.nevals = 0;
+        int found = fastpm_horizon_solve(horizon, &a_secant, a_i, a_f, funct, &P);
+        nevals += P.nevals;
+        int found_ref = bisect(&a_bisect, a_i, a_f, &P);
+        if(found != found_ref) {
+            nmismatch ++;
+            continue;
+        }
+        if(!found) continue;
+        ncross ++;
+        double err = fabs(a_secant - a_bisect);
+        if(err > maxerr) maxerr = err;
+    }
+
+    MPI_Allreduce(MPI_IN_PLACE, &ncross, 1, MPI_LONG, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &nmismatch, 1, MPI_LONG, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &nevals, 1, MPI_LONG, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &maxerr, 1, MPI_DOUBLE, MPI_MAX, comm);
+
+    ptrdiff_t np = p->np;
+    MPI_Allreduce(MPI_IN_PLACE, &np, 1, MPI_LONG, MPI_SUM, comm);
+
+    fastpm_info("%td of %td particles cross the horizon between a = %g and %g\n", ncross, np, a_i, a_f);
+    fastpm_info("secant solver: %g evaluations per particle, max error in a = %g\n", 1.0 * nevals / np, maxerr);
+
+    if(ncross == 0) {
+        fastpm_raise(-1, "no particle crosses the horizon; the test is void.\n");
+    }
+    if(nmismatch > 0) {
+        fastpm_raise(-1, "%td particles disagree with bisection on whether they cross.\n", nmismatch);
+    }
+    /* the solver promises 1e-7 in a */
+    if(maxerr > 1e-6) {
+        fastpm_raise(-1, "secant solution off by %g in a.\n", maxerr);
+    }
+
+    fastpm_horizon_destroy(horizon);
+    free(horizon);
+
+    pm_free(solver->basepm, rho_init_ktruth);
+    fastpm_solver_destroy(solver);
+
+    libfastpm_cleanup();
+    MPI_Finalize();
+    return 0;
+}
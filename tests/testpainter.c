@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <alloca.h>
+#include <mpi.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <fastpm/libfastpm.h>
+#include <fastpm/logging.h>
+
+/* Paints the same random particles with one thread, with several threads
+ * colouring the particles by slabs, and with several threads and atomics;
+ * the meshes shall agree up to the order of the sums. */
+
+static uint64_t
+hash64(uint64_t x)
+{
+    /* splitmix64 */
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static void
+paint(FastPMPainter * painter, FastPMFloat * canvas, FastPMStore * p, int nthreads, int use_atomic)
+{
+#ifdef _OPENMP
+    int old = omp_get_max_threads();
+    omp_set_num_threads(nthreads);
+#endif
+    painter->use_atomic = use_atomic;
+    fastpm_paint(painter, canvas, p, FASTPM_FIELD_DESCR_NONE);
+#ifdef _OPENMP
+    omp_set_num_threads(old);
+#endif
+}
+
+static double
+compare(PM * pm, FastPMFloat * canvas, FastPMFloat * ref, MPI_Comm comm)
+{
+    double maxdiff = 0, maxref = 0;
+    ptrdiff_t i;
+    for(i = 0; i < pm_allocsize(pm); i ++) {
+        double d = fabs(canvas[i] - ref[i]);
+        if(d > maxdiff) maxdiff = d;
+        if(fabs(ref[i]) > maxref) maxref = fabs(ref[i]);
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &maxdiff, 1, MPI_DOUBLE, MPI_MAX, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &maxref, 1, MPI_DOUBLE, MPI_MAX, comm);
+    return maxdiff / maxref;
+}
+
+int main(int argc, char * argv[]) {
+
+    MPI_Init(&argc, &argv);
+
+    libfastpm_init();
+
+    MPI_Comm comm = MPI_COMM_WORLD;
+
+    fastpm_set_msg_handler(fastpm_default_msg_handler, comm, NULL);
+
+    FastPMConfig * config = & (FastPMConfig) {
+        .nc = 32,
+        .boxsize = 256.,
+        .alloc_factor = 2.0,
+        .cosmology = NULL,
+        .vpminit = (VPMInit[]) {
+            {.a_start = 0, .pm_nc_factor = 2},
+            {.a_start = -1, .pm_nc_factor = 0},
+        },
+        .FORCE_TYPE = FASTPM_FORCE_FASTPM,
+        .nLPT = 2.5,
+    };
+    FastPMSolver solver[1];
+
+    fastpm_solver_init(solver, config, comm);
+
+    FastPMFloat * rho_init_ktruth = pm_alloc(solver->basepm);
+
+    struct fastpm_powerspec_eh_params eh = {
+        .Norm = 5e6,
+        .hubble_param = 0.7,
+        .omegam = 0.260,
+        .omegab = 0.044,
+    };
+    fastpm_ic_fill_gaussiank(solver->basepm, rho_init_ktruth, 2004, FASTPM_DELTAK_GADGET);
+    fastpm_ic_induce_correlation(solver->basepm, rho_init_ktruth, (fastpm_fkfunc)fastpm_utils_powerspec_eh, &eh);
+
+    fastpm_solver_setup_lpt(solver, FASTPM_SPECIES_CDM, rho_init_ktruth, NULL, 0.1);
+
+    pm_free(solver->basepm, rho_init_ktruth);
+
+    FastPMStore * p = fastpm_solver_get_species(solver, FASTPM_SPECIES_CDM);
+
+    /* an eighth of the particles in a clump, such that many threads hit the same cells */
+    ptrdiff_t i;
+    for(i = 0; i < p->np; i ++) {
+        uint64_t h = hash64(p->id[i]);
+        double pos[3];
+        int d;
+        for(d = 0; d < 3; d ++) {
+            double u = (h >> (20 * d)) % 1048576 / 1048576.;
+            pos[d] = (h >> 61) == 0 ? config->boxsize * (0.5 + 0.01 * u) : config->boxsize * u;
+        }
+        fastpm_store_set_position(p, i, pos);
+    }
+
+    PM * pm = fastpm_find_pm(solver, 1.0);
+
+    fastpm_store_wrap(p, pm_boxsize(pm));
+    if(0 != fastpm_store_decompose(p, (fastpm_store_target_func) FastPMTargetPM, pm, comm)) {
+        fastpm_raise(-1, "out of space for the particles.\n");
+    }
+
+    FastPMFloat * ref = pm_alloc(pm);
+    FastPMFloat * canvas = pm_alloc(pm);
+
+    struct {
+        FastPMPainterType type;
+        int support;
+        const char * name;
+    } painters[] = {
+        {FASTPM_PAINTER_CIC, 2, "cic"},
+        {FASTPM_PAINTER_LANCZOS, 4, "lanczos2"},
+    };
+
+    int k;
+    for(k = 0; k < sizeof(painters) / sizeof(painters[0]); k ++) {
+        FastPMPainter painter[1];
+        fastpm_painter_init(painter, pm, painters[k].type, painters[k].support);
+
+        if(pm_i_region(pm)->size[0] < 4 * painter->support) {
+            fastpm_raise(-1, "The local mesh is too thin to colour the particles; the test is void.\n");
+        }
+
+        paint(painter, ref, p, 1, 0);
+        paint(painter, canvas, p, 4, 0);
+        double coloured = compare(pm, canvas, ref, comm);
+        paint(painter, canvas, p, 4, 1);
+        double atomic = compare(pm, canvas, ref, comm);
+
+        fastpm_info("%s painter: relative difference to one thread %g coloured, %g atomic\n",
+            painters[k].name, coloured, atomic);
+
+        /* only the order of the sums differ; the clump puts thousands of particles in a cell */
+        double tol = sizeof(FastPMFloat) == 4 ? 1e-4 : 1e-10;
+        if(coloured > tol || atomic > tol) {
+            fastpm_raise(-1, "%s painter: the threaded painting differs from one thread.\n", painters[k].name);
+        }
+    }
+
+    pm_free(pm, canvas);
+    pm_free(pm, ref);
+
+    fastpm_solver_destroy(solver);
+
+    libfastpm_cleanup();
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+#include <math.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <fastpm/libfastpm.h>
+#include <fastpm/logging.h>
+
+/* Checks the columns of a store that are not plain copies of the values:
+ * the compact positions are fixed-point fractions of the box;
+ * the local sort against qsort, and the permutation in every amount of
+ * free memory, with several threads. */
+
+static int nfails = 0;
+
+static uint64_t
+hash64(uint64_t x)
+{
+    /* splitmix64 */
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/* A row of the store is a function of its original index, kept in x[0];
+ * the ids repeat, for the stability of the sort. */
+static void
+fill_row(FastPMStore * p, ptrdiff_t i, ptrdiff_t orig)
+{
+    uint64_t h = hash64(orig);
+    p->x[i][0] = orig;
+    p->x[i][1] = (h % 1048576) / 1048576. * 256.;
+    p->x[i][2] = ((h >> 20) % 1048576) / 1048576. * 256.;
+    p->v[i][0] = orig % 1000;
+    p->v[i][1] = -(orig % 1000);
+    p->v[i][2] = 0.5;
+    p->id[i] = hash64(orig % 5003);
+    p->mask[i] = orig & 0xff;
+}
+
+static int
+check_row(FastPMStore * p, ptrdiff_t i, ptrdiff_t orig)
+{
+    uint64_t h = hash64(orig);
+    return p->x[i][0] == orig
+        && p->x[i][1] == (h % 1048576) / 1048576. * 256.
+        && p->x[i][2] == ((h >> 20) % 1048576) / 1048576. * 256.
+        && p->v[i][0] == orig % 1000
+        && p->v[i][1] == -(orig % 1000)
+        && p->v[i][2] == 0.5
+        && p->id[i] == hash64(orig % 5003)
+        && p->mask[i] == (orig & 0xff);
+}
+
+static void
+fill_store(FastPMStore * p, ptrdiff_t np)
+{
+    fastpm_store_init(p, "sort", np, COLUMN_POS | COLUMN_VEL | COLUMN_ID | COLUMN_MASK, FASTPM_MEMORY_HEAP);
+    p->np = np;
+    ptrdiff_t i;
+    for(i = 0; i < np; i ++) {
+        fill_row(p, i, i);
+    }
+}
+
+struct keyed {
+    uint64_t key;
+    ptrdiff_t orig;
+};
+
+static int
+cmp_keyed(const void * a, const void * b)
+{
+    const struct keyed * ka = a;
+    const struct keyed * kb = b;
+    if(ka->key != kb->key) return ka->key < kb->key ? -1 : 1;
+    /* the sort is stable */
+    if(ka->orig != kb->orig) return ka->orig < kb->orig ? -1 : 1;
+    return 0;
+}
+
+static void
+check_position(FastPMStore * p, double x, double expected, const char * what)
+{
+    double L = p->meta._x_box[0];
+    double pos[3] = {x, 0, 0};
+    double out[3];
+
+    fastpm_store_set_position(p, 0, pos);
+    fastpm_store_get_position(p, 0, out);
+
+    /* the accessors of the column are used by the IO and the exchanges */
+    int ci = fastpm_store_find_column_id(p, COLUMN_POS_FIXED);
+    double col = p->_column_info[ci].to_double(p, 0, ci, 0);
+    p->_column_info[ci].from_double(p, 0, ci, 0, x);
+    double col2 = p->_column_info[ci].to_double(p, 0, ci, 0);
+
+    /* half of the resolution, and the rounding of the double */
+    double tol = 0.5 * L / 4294967296.0 * (1 + 1e-9);
+
+    int ok = out[0] >= 0 && out[0] < L
+          && fabs(out[0] - expected) <= tol
+          && col == out[0] && col2 == out[0];
+
+    if(!ok) {
+        fastpm_ilog(INFO, "FAIL %s: x = %.17g decodes to %.17g (column %.17g %.17g), expected %.17g\n",
+            what, x, out[0], col, col2, expected);
+        nfails ++;
+    }
+}
+
+static void
+test_compact_position(double L)
+{
+    FastPMStore p[1];
+    fastpm_store_init(p, "xfix", 1, COLUMN_POS_FIXED, FASTPM_MEMORY_HEAP);
+    p->np = 1;
+    if(p->x != NULL || p->xfix == NULL) {
+        fastpm_raise(-1, "a store with COLUMN_POS_FIXED shall only have the compact positions.\n");
+    }
+    int d;
+    for(d = 0; d < 3; d ++) p->meta._x_box[d] = L;
+
+    double h = L / 4294967296.0;
+
+    /* the interior */
+    int i;
+    for(i = 0; i < 1000; i ++) {
+        double x = L * (i + 0.5 * sin(i)) / 1000.;
+        if(x < 0) x = 0;
+        check_position(p, x, x, "interior");
+    }
+    check_position(p, 0, 0, "zero");
+    check_position(p, 0.5 * L, 0.5 * L, "half");
+
+    /* the last representable position is one step short of the box */
+    check_position(p, L - h, L - h, "last step");
+
+    /* within half a step of the box, the fraction rounds to 2**32 and wraps to 0 */
+    check_position(p, L - 0.25 * h, 0, "2**32");
+    check_position(p, L, 0, "box");
+
+    /* periodic wraps from outside the box */
+    check_position(p, L + 0.25 * L, 0.25 * L, "above the box");
+    check_position(p, -0.25 * L, 0.75 * L, "below the box");
+    check_position(p, 3 * L + 0.125 * L, 0.125 * L, "several boxes above");
+    check_position(p, -2 * L - 0.125 * L, 0.875 * L, "several boxes below");
+    check_position(p, -0.25 * h, 0, "just below zero");
+
+    fastpm_store_destroy(p);
+}
+
+static void
+test_sort(ptrdiff_t np, int nthreads, fastpm_store_sort_key_func key_func, void * userdata, const char * what)
+{
+    FastPMStore p[1];
+    fill_store(p, np);
+
+    struct keyed * ref = malloc(sizeof(ref[0]) * np);
+    ptrdiff_t i;
+    for(i = 0; i < np; i ++) {
+        ref[i].key = key_func(p, i, userdata);
+        ref[i].orig = i;
+    }
+    qsort(ref, np, sizeof(ref[0]), cmp_keyed);
+
+#ifdef _OPENMP
+    int old = omp_get_max_threads();
+    omp_set_num_threads(nthreads);
+#endif
+    fastpm_store_sort(p, key_func, userdata);
+#ifdef _OPENMP
+    omp_set_num_threads(old);
+#endif
+
+    ptrdiff_t bad = 0;
+    for(i = 0; i < np; i ++) {
+        if(!check_row(p, i, ref[i].orig)) bad ++;
+    }
+    if(bad > 0) {
+        fastpm_ilog(INFO, "FAIL sort by %s of %td particles with %d threads: %td rows differ from qsort\n",
+            what, np, nthreads, bad);
+        nfails ++;
+    }
+    free(ref);
+    fastpm_store_destroy(p);
+}
+
+/* how much free memory the permutation finds, which decides how it moves the rows */
+enum { ROOM_ALL, ROOM_COLUMN, ROOM_NONE };
+
+static void
+test_permute(ptrdiff_t np, int nthreads, int room, int is_permutation, const char * what)
+{
+    FastPMStore p[1];
+
+    /* measure the store, then bound the memory to the store and the room */
+    libfastpm_set_memory_bound(0);
+    fill_store(p, np);
+    FastPMMemory * mem = p->mem;
+    size_t used = mem->total_bytes - mem->free_bytes;
+    size_t largest = sizeof(p->x[0]) * np;
+    fastpm_store_destroy(p);
+
+    size_t bound = 0;
+    if(room == ROOM_COLUMN) bound = used + 65 * mem->alignment + largest;
+    if(room == ROOM_NONE) bound = used + 65 * mem->alignment;
+    libfastpm_set_memory_bound(bound);
+
+    fill_store(p, np);
+
+    ptrdiff_t * ind = malloc(sizeof(ind[0]) * np);
+    ptrdiff_t i;
+    if(is_permutation) {
+        for(i = 0; i < np; i ++) ind[i] = i;
+        for(i = np - 1; i > 0; i --) {
+            ptrdiff_t j = hash64(i) % (i + 1);
+            ptrdiff_t t = ind[i]; ind[i] = ind[j]; ind[j] = t;
+        }
+    } else {
+        /* repeats and omits some rows */
+        for(i = 0; i < np; i ++) ind[i] = hash64(i) % np;
+    }
+
+#ifdef _OPENMP
+    int old = omp_get_max_threads();
+    omp_set_num_threads(nthreads);
+#endif
+    fastpm_store_permute(p, ind);
+#ifdef _OPENMP
+    omp_set_num_threads(old);
+#endif
+
+    ptrdiff_t bad = 0;
+    for(i = 0; i < np; i ++) {
+        if(!check_row(p, i, ind[i])) bad ++;
+    }
+    if(bad > 0) {
+        fastpm_ilog(INFO, "FAIL permute (%s) of %td particles with %d threads: %td rows are wrong\n",
+            what, np, nthreads, bad);
+        nfails ++;
+    }
+    free(ind);
+    fastpm_store_destroy(p);
+    libfastpm_set_memory_bound(0);
+}
+
+int main(int argc, char * argv[]) {
+
+    MPI_Init(&argc, &argv);
+
+    libfastpm_init();
+
+    MPI_Comm comm = MPI_COMM_WORLD;
+
+    fastpm_set_msg_handler(fastpm_default_msg_handler, comm, NULL);
+
+    test_compact_position(1000.);
+    test_compact_position(384.);
+    test_compact_position(1.);
+
+    double BoxSize[3] = {100003., 256., 256.};
+    int nthreads[] = {1, 3, 4};
+    int k;
+    for(k = 0; k < 3; k ++) {
+        test_sort(100003, nthreads[k], FastPMLocalSortByID, NULL, "id");
+        test_sort(100003, nthreads[k], FastPMLocalSortByMorton, BoxSize, "morton");
+        /* fewer particles than threads */
+        test_sort(2, nthreads[k], FastPMLocalSortByID, NULL, "id");
+    }
+    test_sort(0, 4, FastPMLocalSortByID, NULL, "id");
+
+    for(k = 0; k < 3; k ++) {
+        test_permute(100003, nthreads[k], ROOM_ALL, 1, "all columns at once");
+        test_permute(100003, nthreads[k], ROOM_COLUMN, 1, "one column at a time");
+        test_permute(100003, nthreads[k], ROOM_NONE, 1, "in place by cycles");
+        test_permute(100003, nthreads[k], ROOM_NONE, 0, "gathered by malloc");
+        test_permute(100003, nthreads[k], ROOM_ALL, 0, "not a permutation");
+    }
+
+    if(nfails > 0) {
+        fastpm_raise(-1, "%d checks of the store failed.\n", nfails);
+    }
+    fastpm_info("All checks of the store passed.\n");
+
+    libfastpm_cleanup();
+    MPI_Finalize();
+    return 0;
+}